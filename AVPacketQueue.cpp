@@ -5,74 +5,162 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <vector>
 #include <chrono>
+#include <atomic>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 }
+#include "ThreadSignal.h"
+#include "PlayerMemoryPool.h"
 #include "AVPacketQueue.h"
 
-SmartAvPacket::SmartAvPacket(const AVPacket* packet) : m_error(-1)
+static uint32_t RoundUpToPowerOfTwo(uint32_t value)
 {
-    m_error = av_copy_packet(&m_packet, packet);
+    uint32_t ret = 1;
+    while (ret < value)
+        ret <<= 1;
+    return ret;
 }
 
-SmartAvPacket::~SmartAvPacket()
+AVPacketQueue::AVPacketQueue(PlayerMemoryPool* memoryPool, int64_t byteLimit, int64_t durationLimit, int packetLimit /*= 1024*/) :
+    m_memoryPool(memoryPool),
+    m_slots(NULL),
+    m_capacity(RoundUpToPowerOfTwo(packetLimit > 0 ? packetLimit : 1)),
+    m_mask(0),
+    m_head(0),
+    m_tail(0),
+    m_bytes(0),
+    m_duration(0),
+    m_byteLimit(byteLimit),
+    m_durationLimit(durationLimit),
+    m_lastTimeStamp(AV_NOPTS_VALUE),
+    m_dataSignal(NULL),
+    m_spaceSignal(NULL)
 {
-    if (!m_error){
-        av_free_packet(&m_packet);
+    m_timeBase.num = 1;
+    m_timeBase.den = 1000;
+    m_mask = m_capacity - 1;
+    m_slots = new Slot[m_capacity];
+    for (uint32_t i = 0; i < m_capacity; ++i){
+        av_init_packet(&m_slots[i].packet);
+        m_slots[i].packet.data = NULL;
+        m_slots[i].packet.size = 0;
+        m_slots[i].duration = 0;
     }
 }
 
-AVPacketQueue::AVPacketQueue(int sizeLimit /*= 100*/) : m_sizeLimit(sizeLimit)
+AVPacketQueue::~AVPacketQueue()
 {
+    ResetQueue();
+    delete[] m_slots;
+}
 
+void AVPacketQueue::SetTimeBase(AVRational timeBase)
+{
+    m_timeBase = timeBase;
 }
 
-AVPacketQueue::~AVPacketQueue()
+void AVPacketQueue::SetSignals(ThreadSignal* dataSignal, ThreadSignal* spaceSignal)
 {
-    ResetQueue();
+    m_dataSignal = dataSignal;
+    m_spaceSignal = spaceSignal;
 }
 
-void AVPacketQueue::PutPacket(const AVPacket* packet)
+int64_t AVPacketQueue::PacketDuration(const AVPacket* packet)
 {
-    SmartAvPacket *newPack = new SmartAvPacket(packet);
-    if (!newPack->m_error){
-        m_mutex.lock();
-        m_queue.push_back(newPack);
-        if (m_queue.size() > m_sizeLimit){
-            delete m_queue.front();
-            m_queue.pop_front();
-        }
-        m_mutex.unlock();
+    AVRational milliseconds{ 1, 1000 };
+    int64_t timeStamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    int64_t duration = 0;
+    if (packet->duration > 0){
+        duration = av_rescale_q(packet->duration, m_timeBase, milliseconds);
     }
+    else if (timeStamp != AV_NOPTS_VALUE && m_lastTimeStamp != AV_NOPTS_VALUE && timeStamp > m_lastTimeStamp){
+        duration = av_rescale_q(timeStamp - m_lastTimeStamp, m_timeBase, milliseconds);
+    }
+    if (timeStamp != AV_NOPTS_VALUE)
+        m_lastTimeStamp = timeStamp;
+    return duration;
 }
 
-SmartAvPacket* AVPacketQueue::GetPacket()
+bool AVPacketQueue::PutPacket(AVPacket* packet)
 {
-    m_mutex.lock();
-    SmartAvPacket* ret = NULL;
-    if (!m_queue.empty()){
-        ret = m_queue.front();
-        m_queue.pop_front();
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) >= m_capacity)
+        return false;
+    Slot* slot = &m_slots[tail & m_mask];
+    if (packet->buf == NULL){
+        //Demuxer owned data is valid only until the next av_read_frame, so take our own copy.
+        bool copied = m_memoryPool != NULL ? m_memoryPool->CopyPacket(&slot->packet, packet) : av_packet_ref(&slot->packet, packet) >= 0;
+        if (!copied)
+            return false;
     }
-    m_mutex.unlock();
-    return ret;
+    else{
+        av_packet_move_ref(&slot->packet, packet);
+    }
+    slot->duration = PacketDuration(&slot->packet);
+    m_bytes += slot->packet.size;
+    m_duration += slot->duration;
+    //Checked after publishing, both sides sequentially consistent: a consumer that took the
+    //last packet before the store is seen here, one that takes it later sees the new packet.
+    m_tail.store(tail + 1, std::memory_order_seq_cst);
+    if (m_dataSignal != NULL && m_head.load(std::memory_order_seq_cst) == tail)
+        m_dataSignal->Notify();
+    return true;
+}
+
+bool AVPacketQueue::GetPacket(AVPacket* packet)
+{
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_seq_cst))
+        return false;
+    Slot* slot = &m_slots[head & m_mask];
+    bool wasFull = IsFull();
+    m_bytes -= slot->packet.size;
+    m_duration -= slot->duration;
+    av_packet_move_ref(packet, &slot->packet);
+    m_head.store(head + 1, std::memory_order_seq_cst);
+    if (m_spaceSignal != NULL && (wasFull || IsEmpty()))
+        m_spaceSignal->Notify();
+    return true;
 }
 
 void AVPacketQueue::ResetQueue()
 {
-    m_mutex.lock();
-    for (auto pack : m_queue){
-        delete pack;
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    while (GetPacket(&packet)){
+        av_free_packet(&packet);
     }
-    m_queue.clear();
-    m_mutex.unlock();
+    m_lastTimeStamp = AV_NOPTS_VALUE;
 }
 
 int AVPacketQueue::GetSize() const
 {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    return m_queue.size(); 
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+}
+
+int64_t AVPacketQueue::GetBytes() const
+{
+    return m_bytes;
+}
+
+int64_t AVPacketQueue::GetDuration() const
+{
+    return m_duration;
+}
+
+bool AVPacketQueue::IsFull() const
+{
+    return GetSize() >= (int)m_capacity || m_bytes >= m_byteLimit || m_duration >= m_durationLimit;
+}
+
+bool AVPacketQueue::IsEmpty() const
+{
+    return GetSize() == 0;
 }
\ No newline at end of file
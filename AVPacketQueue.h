@@ -1,27 +1,58 @@
 #ifndef AUDIOPACKETQUEUE_H
 #define AUDIOPACKETQUEUE_H
 
-class SmartAvPacket
-{
-public:
-    AVPacket m_packet;
-    int m_error;
-    SmartAvPacket(const AVPacket* packet);
-    ~SmartAvPacket();
-};
+class PlayerMemoryPool;
+class ThreadSignal;
 
+//Bounded single-producer/single-consumer packet ring.
+//The demuxer is the only producer and a decoder is the only consumer, so slots are
+//handed over with two atomic indices and packets are moved by reference, not copied.
+//Besides the slot count the queue tracks buffered bytes and duration, the demuxer
+//checks IsFull() and stops reading instead of the queue dropping packets.
 class AVPacketQueue
 {
 private:
-    std::list<SmartAvPacket*> m_queue;
-    int m_sizeLimit;
-    mutable std::recursive_mutex m_mutex;
+    struct Slot
+    {
+        AVPacket packet;
+        int64_t duration; //milliseconds
+    };
+
+    PlayerMemoryPool* m_memoryPool;
+    Slot* m_slots;
+    uint32_t m_capacity;
+    uint32_t m_mask;
+    std::atomic<uint32_t> m_head; //next slot to read, written by consumer only
+    std::atomic<uint32_t> m_tail; //next slot to write, written by producer only
+    std::atomic<int64_t> m_bytes;
+    std::atomic<int64_t> m_duration; //milliseconds
+    int64_t m_byteLimit;
+    int64_t m_durationLimit; //milliseconds
+    AVRational m_timeBase;
+    int64_t m_lastTimeStamp; //producer only
+    ThreadSignal* m_dataSignal;
+    ThreadSignal* m_spaceSignal;
+
+    AVPacketQueue(const AVPacketQueue&) = delete;
+    AVPacketQueue& operator=(const AVPacketQueue&) = delete;
+    int64_t PacketDuration(const AVPacket* packet);
 public:
-    AVPacketQueue(int sizeLimit = 100);
+    AVPacketQueue(PlayerMemoryPool* memoryPool, int64_t byteLimit, int64_t durationLimit, int packetLimit = 1024);
     ~AVPacketQueue();
-    void PutPacket(const AVPacket* packet);
-    SmartAvPacket* GetPacket();
+    void SetTimeBase(AVRational timeBase);
+    //dataSignal is notified when the queue stops being empty, spaceSignal when it stops
+    //being full or runs empty. Either may be NULL.
+    void SetSignals(ThreadSignal* dataSignal, ThreadSignal* spaceSignal);
+    //Takes the packet reference over. Returns false and leaves the packet untouched if all slots are taken.
+    bool PutPacket(AVPacket* packet);
+    //Moves the oldest packet into a blank packet. Caller frees it with av_free_packet.
+    bool GetPacket(AVPacket* packet);
     int GetSize() const;
+    int64_t GetBytes() const;
+    int64_t GetDuration() const;
+    bool IsFull() const;
+    bool IsEmpty() const;
+    //Must not run concurrently with GetPacket.
     void ResetQueue();
 };
-#endif //AUDIOPACKETQUEUE_H
\ No newline at end of file
+#endif //AUDIOPACKETQUEUE_H
@@ -6,37 +6,49 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
 #include <chrono>
+#include <atomic>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 }
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PlayerMemoryPool.h"
+#include "CodecDecoder.h"
 #include "FrameQueueManager.h"
 #include "DecodingThread.h"
 #include "AudioDecoder.h"
 
-AudioDecoder::AudioDecoder(AVCodecContext * audioCodecContext, AVPacketQueue * packetQueue, AVStream* audioStream) :
+AudioDecoder::AudioDecoder(AVCodecContext * audioCodecContext, AVPacketQueue * packetQueue, AVStream* audioStream, PlayerMemoryPool* memoryPool) :
 m_packetQueue(packetQueue),
-m_currentPacket(NULL),
 m_audioClock(0),
-m_leftPacketSize(0),
+m_endOfStream(false),
 m_pFrame(NULL),
 m_CodecContext(audioCodecContext),
-m_audioStream(audioStream)
+m_decoder(NULL),
+m_audioStream(audioStream),
+m_memoryPool(memoryPool)
 {
-    m_pFrame = av_frame_alloc();
+    av_init_packet(&m_currentPacket);
+    m_currentPacket.data = NULL;
+    m_currentPacket.size = 0;
+    m_pFrame = m_memoryPool->AllocFrame();
+    if (m_CodecContext)
+        m_decoder = new CodecDecoder(m_CodecContext);
 }
 
 AudioDecoder::~AudioDecoder()
 {
     m_mutex.lock();
-    if (m_currentPacket != NULL){
-        delete m_currentPacket;
-        m_currentPacket = NULL;
-    }
-   
-    av_free(m_pFrame);
+    av_free_packet(&m_currentPacket);
+    delete m_decoder;
+    m_memoryPool->FreeFrame(&m_pFrame);
     m_mutex.unlock();
 }
 
@@ -58,66 +70,66 @@ int AudioDecoder::GetNextFrameData(uint8_t *audio_buf, int buf_size, int64_t & f
 
     while (1){
         ScopedLock lock(m_mutex);
-        while (m_leftPacketSize > 0){
-            int gotFrame = 0;
-            int len = avcodec_decode_audio4(m_CodecContext, m_pFrame, &gotFrame, &m_currentPacket->m_packet);
-            if (len < 0){
-                m_leftPacketSize = 0;
-                break;
-            }
-            m_leftPacketSize -= len;
-            if (gotFrame){
-                int32_t sampleSize = av_samples_get_buffer_size(NULL, 1, 1, m_CodecContext->sample_fmt, 1);
-                if (sampleSize * m_CodecContext->channels * m_pFrame->nb_samples > m_pFrame->linesize[0] ||
-                    (GetSampleFormat() > AV_SAMPLE_FMT_DBL && FrameDataForChannelsAvailable(m_pFrame->data, m_CodecContext->channels)))
-                {
-                    for (int32_t sample = 0; sample < m_pFrame->nb_samples; ++sample){
-                        for (int32_t channel = 0; channel < m_CodecContext->channels; ++channel){
-                            memcpy(audio_buf, m_pFrame->data[channel], sampleSize);
-                            m_pFrame->data[channel] += sampleSize;
-                            audio_buf += sampleSize;
-                        }
+        int ret = m_decoder->ReceiveFrame(m_pFrame);
+        if (ret == 0){
+            int32_t sampleSize = av_samples_get_buffer_size(NULL, 1, 1, m_CodecContext->sample_fmt, 1);
+            if (sampleSize * m_CodecContext->channels * m_pFrame->nb_samples > m_pFrame->linesize[0] ||
+                (GetSampleFormat() > AV_SAMPLE_FMT_DBL && FrameDataForChannelsAvailable(m_pFrame->data, m_CodecContext->channels)))
+            {
+                for (int32_t sample = 0; sample < m_pFrame->nb_samples; ++sample){
+                    for (int32_t channel = 0; channel < m_CodecContext->channels; ++channel){
+                        memcpy(audio_buf, m_pFrame->data[channel], sampleSize);
+                        m_pFrame->data[channel] += sampleSize;
+                        audio_buf += sampleSize;
                     }
                 }
-                else{
-                    memcpy(audio_buf, m_pFrame->data[0], sampleSize * m_pFrame->nb_samples * m_CodecContext->channels);
-                }
-                framePts = m_audioClock;
-                m_audioClock += m_pFrame->nb_samples * 1000 / m_CodecContext->sample_rate;
-                return sampleSize * m_pFrame->nb_samples * m_CodecContext->channels;
             }
+            else{
+                memcpy(audio_buf, m_pFrame->data[0], sampleSize * m_pFrame->nb_samples * m_CodecContext->channels);
+            }
+            framePts = m_audioClock;
+            m_audioClock += m_pFrame->nb_samples * 1000 / m_CodecContext->sample_rate;
+            return sampleSize * m_pFrame->nb_samples * m_CodecContext->channels;
         }
-        if (m_currentPacket){
-            delete m_currentPacket;
-            m_currentPacket = NULL;
-        }
-        m_leftPacketSize = 0;
-        m_currentPacket = m_packetQueue->GetPacket();
-        if (!m_currentPacket){
+        if (ret == AVERROR_EOF){
             return 0;
         }
-        m_leftPacketSize = m_currentPacket->m_packet.size;
-        if (m_currentPacket->m_packet.pts != AV_NOPTS_VALUE){
-            m_audioClock = av_q2d(m_audioStream->time_base) * 1000 * m_currentPacket->m_packet.pts;
+        //Either the decoder wants more data or it dropped a broken packet.
+        if (!m_packetQueue->GetPacket(&m_currentPacket)){
+            if (!m_endOfStream)
+                return 0;
+            //Recheck the queue, the flag is raised after the last packet was queued.
+            if (!m_packetQueue->GetPacket(&m_currentPacket)){
+                m_decoder->SendPacket(NULL);
+                continue;
+            }
+        }
+        if (m_currentPacket.pts != AV_NOPTS_VALUE){
+            m_audioClock = av_q2d(m_audioStream->time_base) * 1000 * m_currentPacket.pts;
         }
+        m_decoder->SendPacket(&m_currentPacket);
+        av_free_packet(&m_currentPacket);
     }
 }
 
 void AudioDecoder::Reset()
 {
+    ScopedLock lock(m_mutex);
+    //The packet queue has a single consumer, so it is flushed under the decoder lock.
+    m_packetQueue->ResetQueue();
+    m_endOfStream = false;
     if (!m_CodecContext){
         return;
     }
-    ScopedLock lock(m_mutex);
-    avcodec_flush_buffers(m_CodecContext);
-    av_free(m_pFrame);
-    m_pFrame = av_frame_alloc();
-    if (m_currentPacket != NULL){
-        delete m_currentPacket;
-        m_currentPacket = NULL;
-    }
+    m_decoder->Flush();
+    av_frame_unref(m_pFrame);
+    av_free_packet(&m_currentPacket);
     m_audioClock = 0;
-    m_leftPacketSize = 0;
+}
+
+void AudioDecoder::SetEndOfStream()
+{
+    m_endOfStream = true;
 }
 
 int AudioDecoder::GetSampleRate() const
@@ -3,21 +3,28 @@
 
 #include "AVPacketQueue.h"
 
+class PlayerMemoryPool;
+class CodecDecoder;
+
 class AudioDecoder
 {
     AVPacketQueue* m_packetQueue;
-    SmartAvPacket*  m_currentPacket;
+    AVPacket m_currentPacket;
     int64_t m_audioClock; //milliseconds
-    int m_leftPacketSize;
+    std::atomic<bool> m_endOfStream;
     AVFrame *m_pFrame;
     AVCodecContext* m_CodecContext;
+    CodecDecoder* m_decoder;
     AVStream* m_audioStream;
+    PlayerMemoryPool* m_memoryPool;
     std::recursive_mutex m_mutex;
 public:
-    AudioDecoder(AVCodecContext * audioCodecContext, AVPacketQueue * packetQueue, AVStream* audioStream);
+    AudioDecoder(AVCodecContext * audioCodecContext, AVPacketQueue * packetQueue, AVStream* audioStream, PlayerMemoryPool* memoryPool);
     ~AudioDecoder();
     int GetNextFrameData(uint8_t *audio_buf, int buf_size, int64_t & framePts);
     void Reset();
+    //Called by the demuxer after the last packet is queued, the decoder is drained once the queue runs dry.
+    void SetEndOfStream();
     int GetSampleRate() const;
     int GetSampleSizeBytes() const;
     int GetNumberOfChannels() const;
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <errno.h>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#include "CodecDecoder.h"
+
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 37, 100)
+#define HAVE_SEND_RECEIVE_API 1
+#else
+#define HAVE_SEND_RECEIVE_API 0
+#endif
+
+CodecDecoder::CodecDecoder(AVCodecContext* codecContext) :
+    m_codecContext(codecContext),
+    m_leftPacketSize(0),
+    m_draining(false),
+    m_drained(false)
+{
+    av_init_packet(&m_packet);
+    m_packet.data = NULL;
+    m_packet.size = 0;
+}
+
+CodecDecoder::~CodecDecoder()
+{
+    av_free_packet(&m_packet);
+}
+
+int CodecDecoder::DecodeEmulated(AVFrame* frame, AVPacket* packet, int* gotFrame)
+{
+    if (m_codecContext->codec_type == AVMEDIA_TYPE_AUDIO)
+        return avcodec_decode_audio4(m_codecContext, frame, gotFrame, packet);
+    return avcodec_decode_video2(m_codecContext, frame, gotFrame, packet);
+}
+
+int CodecDecoder::SendPacket(AVPacket* packet)
+{
+    if (m_draining)
+        return AVERROR_EOF;
+#if HAVE_SEND_RECEIVE_API
+    if (packet == NULL || packet->size == 0)
+        m_draining = true;
+    return avcodec_send_packet(m_codecContext, m_draining ? NULL : packet);
+#else
+    if (m_leftPacketSize > 0)
+        return AVERROR(EAGAIN);
+    if (packet == NULL || packet->size == 0)
+    {
+        m_draining = true;
+        return 0;
+    }
+    int ret = av_packet_ref(&m_packet, packet);
+    if (ret < 0)
+        return ret;
+    m_leftPacketSize = m_packet.size;
+    return 0;
+#endif
+}
+
+int CodecDecoder::ReceiveFrame(AVFrame* frame)
+{
+#if HAVE_SEND_RECEIVE_API
+    return avcodec_receive_frame(m_codecContext, frame);
+#else
+    //Like avcodec_receive_frame the frame is handed back to the decoder first.
+    av_frame_unref(frame);
+    while (m_leftPacketSize > 0)
+    {
+        //Audio decoders may take several calls for one packet, each returning a frame.
+        AVPacket packet = m_packet;
+        packet.data += m_packet.size - m_leftPacketSize;
+        packet.size = m_leftPacketSize;
+        int gotFrame = 0;
+        int len = DecodeEmulated(frame, &packet, &gotFrame);
+        if (len < 0)
+        {
+            m_leftPacketSize = 0;
+            av_free_packet(&m_packet);
+            return len;
+        }
+        //A decoder that neither consumes bytes nor outputs a frame would loop forever.
+        m_leftPacketSize = (len == 0 && !gotFrame) ? 0 : m_leftPacketSize - len;
+        if (m_leftPacketSize <= 0)
+        {
+            m_leftPacketSize = 0;
+            av_free_packet(&m_packet);
+        }
+        if (gotFrame)
+            return 0;
+    }
+    if (!m_draining)
+        return AVERROR(EAGAIN);
+    if (m_drained)
+        return AVERROR_EOF;
+    //Empty packets make delayed decoders return the frames they still hold.
+    AVPacket flushPacket;
+    av_init_packet(&flushPacket);
+    flushPacket.data = NULL;
+    flushPacket.size = 0;
+    int gotFrame = 0;
+    if (DecodeEmulated(frame, &flushPacket, &gotFrame) >= 0 && gotFrame)
+        return 0;
+    m_drained = true;
+    return AVERROR_EOF;
+#endif
+}
+
+void CodecDecoder::Flush()
+{
+    avcodec_flush_buffers(m_codecContext);
+    av_free_packet(&m_packet);
+    m_leftPacketSize = 0;
+    m_draining = false;
+    m_drained = false;
+}
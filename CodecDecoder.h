@@ -0,0 +1,33 @@
+#ifndef CODECDECODER_H
+#define CODECDECODER_H
+
+//Send/receive decoding on top of one opened codec context. Newer libavcodec versions
+//provide it natively, older ones are driven through avcodec_decode_video2/audio4 with
+//the same semantics: every frame a packet produces is returned before the next packet
+//is accepted, and sending a NULL packet drains the frames the decoder still holds.
+class CodecDecoder
+{
+    AVCodecContext* m_codecContext;
+    AVPacket m_packet; //packet being consumed by the emulated decoder
+    int m_leftPacketSize;
+    bool m_draining;
+    bool m_drained;
+
+    CodecDecoder(const CodecDecoder&) = delete;
+    CodecDecoder& operator=(const CodecDecoder&) = delete;
+
+    int DecodeEmulated(AVFrame* frame, AVPacket* packet, int* gotFrame);
+public:
+    CodecDecoder(AVCodecContext* codecContext);
+    ~CodecDecoder();
+    //Returns 0 on success, AVERROR(EAGAIN) while frames of the previous packet
+    //are not received yet and AVERROR_EOF once draining started.
+    int SendPacket(AVPacket* packet);
+    //Returns 0 with a frame, AVERROR(EAGAIN) when a new packet is needed and
+    //AVERROR_EOF when the drained decoder has no frames left.
+    int ReceiveFrame(AVFrame* frame);
+    //Drops buffered data, must follow every seek and is needed to decode again after a drain.
+    void Flush();
+};
+
+#endif//CODECDECODER_H
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <string.h>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+}
+#include "ColorKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+//AVX-512 intrinsics need Visual Studio 2017 15.3 or a GCC/Clang compiler.
+#if HAVE_X86_KERNELS && (!defined(_MSC_VER) || _MSC_VER >= 1911)
+#define HAVE_AVX512_KERNELS 1
+#else
+#define HAVE_AVX512_KERNELS 0
+#endif
+
+//MSVC compiles any intrinsic anywhere, GCC and Clang want the instruction set per function.
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+//BT.601 limited range in 6 bit fixed point. Every kernel uses the same 16 bit saturating
+//math, so all of them produce identical output.
+#define COLOR_Y_OFFSET 16
+#define COLOR_Y_SCALE 74 //1.164
+#define COLOR_V_TO_R 102 //1.596
+#define COLOR_U_TO_G 25 //0.391
+#define COLOR_V_TO_G 52 //0.813
+#define COLOR_U_TO_B 129 //2.018
+#define COLOR_ROUNDING 32
+
+static inline int ClampColor(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int SaturateShort(int value)
+{
+    return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+template <bool nv12, bool bgra>
+static void RowScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        int d = (nv12 ? u[(x & ~1)] : u[x >> 1]) - 128;
+        int e = (nv12 ? u[(x & ~1) + 1] : v[x >> 1]) - 128;
+        int yc = (y[x] - COLOR_Y_OFFSET) * COLOR_Y_SCALE + COLOR_ROUNDING;
+        int r = ClampColor(SaturateShort(yc + COLOR_V_TO_R * e) >> 6);
+        int g = ClampColor((yc - COLOR_U_TO_G * d - COLOR_V_TO_G * e) >> 6);
+        int b = ClampColor(SaturateShort(yc + COLOR_U_TO_B * d) >> 6);
+        dst[0] = bgra ? b : r;
+        dst[1] = g;
+        dst[2] = bgra ? r : b;
+        dst[3] = 255;
+        dst += 4;
+    }
+}
+
+#if HAVE_X86_KERNELS
+
+//Eight pixels of 16 bit y, u and v to 32 bytes of RGBA or BGRA.
+template <bool bgra>
+static inline void StorePixelsSSE2(uint8_t* dst, __m128i y, __m128i u, __m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    __m128i yc = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(COLOR_Y_OFFSET)), _mm_set1_epi16(COLOR_Y_SCALE)),
+        _mm_set1_epi16(COLOR_ROUNDING));
+    __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    __m128i r = _mm_adds_epi16(yc, _mm_mullo_epi16(e, _mm_set1_epi16(COLOR_V_TO_R)));
+    __m128i g = _mm_subs_epi16(_mm_subs_epi16(yc, _mm_mullo_epi16(d, _mm_set1_epi16(COLOR_U_TO_G))),
+        _mm_mullo_epi16(e, _mm_set1_epi16(COLOR_V_TO_G)));
+    __m128i b = _mm_adds_epi16(yc, _mm_mullo_epi16(d, _mm_set1_epi16(COLOR_U_TO_B)));
+    r = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(r, 6), zero), max);
+    g = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(g, 6), zero), max);
+    b = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(b, 6), zero), max);
+    __m128i first = _mm_or_si128(bgra ? b : r, _mm_slli_epi16(g, 8));
+    __m128i second = _mm_or_si128(bgra ? r : b, _mm_set1_epi16((short)0xFF00));
+    _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(first, second));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(first, second));
+}
+
+template <bool nv12, bool bgra>
+static void RowSSE2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i luma = _mm_loadu_si128((const __m128i*)(y + x));
+        __m128i uw, vw;
+        if (nv12)
+        {
+            __m128i uv = _mm_loadu_si128((const __m128i*)(u + x));
+            uw = _mm_and_si128(uv, _mm_set1_epi16(0x00FF));
+            vw = _mm_srli_epi16(uv, 8);
+        }
+        else
+        {
+            uw = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + x / 2)), zero);
+            vw = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(v + x / 2)), zero);
+        }
+        StorePixelsSSE2<bgra>(dst + x * 4, _mm_unpacklo_epi8(luma, zero), _mm_unpacklo_epi16(uw, uw), _mm_unpacklo_epi16(vw, vw));
+        StorePixelsSSE2<bgra>(dst + x * 4 + 32, _mm_unpackhi_epi8(luma, zero), _mm_unpackhi_epi16(uw, uw), _mm_unpackhi_epi16(vw, vw));
+    }
+    RowScalar<nv12, bgra>(y + x, nv12 ? u + x : u + x / 2, v + x / 2, dst + x * 4, width - x);
+}
+
+template <bool nv12, bool bgra>
+KERNEL_TARGET("avx2")
+static void RowAVX2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi16(255);
+    const __m128i evenBytes = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14);
+    const __m128i oddBytes = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x)));
+        __m256i uw, vw;
+        if (nv12)
+        {
+            __m128i uv = _mm_loadu_si128((const __m128i*)(u + x));
+            uw = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(uv, evenBytes));
+            vw = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(uv, oddBytes));
+        }
+        else
+        {
+            __m128i u8 = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+            __m128i v8 = _mm_loadl_epi64((const __m128i*)(v + x / 2));
+            uw = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8));
+            vw = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8));
+        }
+        __m256i yc = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(luma, _mm256_set1_epi16(COLOR_Y_OFFSET)),
+            _mm256_set1_epi16(COLOR_Y_SCALE)), _mm256_set1_epi16(COLOR_ROUNDING));
+        __m256i d = _mm256_sub_epi16(uw, _mm256_set1_epi16(128));
+        __m256i e = _mm256_sub_epi16(vw, _mm256_set1_epi16(128));
+        __m256i r = _mm256_adds_epi16(yc, _mm256_mullo_epi16(e, _mm256_set1_epi16(COLOR_V_TO_R)));
+        __m256i g = _mm256_subs_epi16(_mm256_subs_epi16(yc, _mm256_mullo_epi16(d, _mm256_set1_epi16(COLOR_U_TO_G))),
+            _mm256_mullo_epi16(e, _mm256_set1_epi16(COLOR_V_TO_G)));
+        __m256i b = _mm256_adds_epi16(yc, _mm256_mullo_epi16(d, _mm256_set1_epi16(COLOR_U_TO_B)));
+        r = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(r, 6), zero), max);
+        g = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(g, 6), zero), max);
+        b = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(b, 6), zero), max);
+        __m256i first = _mm256_or_si256(bgra ? b : r, _mm256_slli_epi16(g, 8));
+        __m256i second = _mm256_or_si256(bgra ? r : b, _mm256_set1_epi16((short)0xFF00));
+        //Unpacking works per 128 bit lane, the permutes put the pixels back in order.
+        __m256i low = _mm256_unpacklo_epi16(first, second);
+        __m256i high = _mm256_unpackhi_epi16(first, second);
+        _mm256_storeu_si256((__m256i*)(dst + x * 4), _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + x * 4 + 32), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+    RowScalar<nv12, bgra>(y + x, nv12 ? u + x : u + x / 2, v + x / 2, dst + x * 4, width - x);
+}
+
+#if HAVE_AVX512_KERNELS
+template <bool nv12, bool bgra>
+KERNEL_TARGET("avx512f,avx512bw")
+static void RowAVX512(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi16(255);
+    const __m256i evenBytes = _mm256_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14,
+        0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14);
+    const __m256i oddBytes = _mm256_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15,
+        1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15);
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m512i luma = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(y + x)));
+        __m512i uw, vw;
+        if (nv12)
+        {
+            __m256i uv = _mm256_loadu_si256((const __m256i*)(u + x));
+            uw = _mm512_cvtepu8_epi16(_mm256_shuffle_epi8(uv, evenBytes));
+            vw = _mm512_cvtepu8_epi16(_mm256_shuffle_epi8(uv, oddBytes));
+        }
+        else
+        {
+            __m128i u8 = _mm_loadu_si128((const __m128i*)(u + x / 2));
+            __m128i v8 = _mm_loadu_si128((const __m128i*)(v + x / 2));
+            uw = _mm512_cvtepu8_epi16(_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(u8, u8)), _mm_unpackhi_epi8(u8, u8), 1));
+            vw = _mm512_cvtepu8_epi16(_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(v8, v8)), _mm_unpackhi_epi8(v8, v8), 1));
+        }
+        __m512i yc = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_sub_epi16(luma, _mm512_set1_epi16(COLOR_Y_OFFSET)),
+            _mm512_set1_epi16(COLOR_Y_SCALE)), _mm512_set1_epi16(COLOR_ROUNDING));
+        __m512i d = _mm512_sub_epi16(uw, _mm512_set1_epi16(128));
+        __m512i e = _mm512_sub_epi16(vw, _mm512_set1_epi16(128));
+        __m512i r = _mm512_adds_epi16(yc, _mm512_mullo_epi16(e, _mm512_set1_epi16(COLOR_V_TO_R)));
+        __m512i g = _mm512_subs_epi16(_mm512_subs_epi16(yc, _mm512_mullo_epi16(d, _mm512_set1_epi16(COLOR_U_TO_G))),
+            _mm512_mullo_epi16(e, _mm512_set1_epi16(COLOR_V_TO_G)));
+        __m512i b = _mm512_adds_epi16(yc, _mm512_mullo_epi16(d, _mm512_set1_epi16(COLOR_U_TO_B)));
+        r = _mm512_min_epi16(_mm512_max_epi16(_mm512_srai_epi16(r, 6), zero), max);
+        g = _mm512_min_epi16(_mm512_max_epi16(_mm512_srai_epi16(g, 6), zero), max);
+        b = _mm512_min_epi16(_mm512_max_epi16(_mm512_srai_epi16(b, 6), zero), max);
+        __m512i first = _mm512_or_si512(bgra ? b : r, _mm512_slli_epi16(g, 8));
+        __m512i second = _mm512_or_si512(bgra ? r : b, _mm512_set1_epi16((short)0xFF00));
+        //low holds pixels 0-3, 8-11, 16-19, 24-27 and high the rest, interleave the lanes back.
+        __m512i low = _mm512_unpacklo_epi16(first, second);
+        __m512i high = _mm512_unpackhi_epi16(first, second);
+        __m512i front = _mm512_shuffle_i64x2(low, high, _MM_SHUFFLE(1, 0, 1, 0));
+        __m512i back = _mm512_shuffle_i64x2(low, high, _MM_SHUFFLE(3, 2, 3, 2));
+        _mm512_storeu_si512((void*)(dst + x * 4), _mm512_shuffle_i64x2(front, front, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm512_storeu_si512((void*)(dst + x * 4 + 64), _mm512_shuffle_i64x2(back, back, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    RowScalar<nv12, bgra>(y + x, nv12 ? u + x : u + x / 2, v + x / 2, dst + x * 4, width - x);
+}
+
+//FFmpeg of this age has no AVX-512 flag, so the CPU and the OS are asked directly.
+static bool CpuHasAvx512BW()
+{
+    unsigned int regs[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+    __cpuid((int*)regs, 1);
+#else
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    if (!(regs[2] & (1u << 27))) //OSXSAVE
+        return false;
+#ifdef _MSC_VER
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0Low = 0, xcr0High = 0;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+    //SSE, AVX, opmask and both halves of the ZMM registers must be saved by the OS.
+    if ((xcr0 & 0xE6) != 0xE6)
+        return false;
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, 7, 0);
+#else
+    __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    return (regs[1] & (1u << 16)) && (regs[1] & (1u << 30)); //AVX512F and AVX512BW
+}
+#endif//HAVE_AVX512_KERNELS
+
+#endif//HAVE_X86_KERNELS
+
+template <bool nv12, bool bgra>
+static ColorRowKernel BestKernel()
+{
+#if HAVE_X86_KERNELS
+#if HAVE_AVX512_KERNELS
+    if (CpuHasAvx512BW())
+        return &RowAVX512<nv12, bgra>;
+#endif
+    int flags = av_get_cpu_flags();
+    if (flags & AV_CPU_FLAG_AVX2)
+        return &RowAVX2<nv12, bgra>;
+    if (flags & AV_CPU_FLAG_SSE2)
+        return &RowSSE2<nv12, bgra>;
+#endif
+    return &RowScalar<nv12, bgra>;
+}
+
+template <bool nv12, bool bgra>
+static ColorRowKernel LevelKernel(ColorKernelLevel level)
+{
+    switch (level)
+    {
+    case ColorKernelLevel::scalar:
+        return &RowScalar<nv12, bgra>;
+#if HAVE_X86_KERNELS
+    case ColorKernelLevel::sse2:
+        return (av_get_cpu_flags() & AV_CPU_FLAG_SSE2) ? &RowSSE2<nv12, bgra> : NULL;
+    case ColorKernelLevel::avx2:
+        return (av_get_cpu_flags() & AV_CPU_FLAG_AVX2) ? &RowAVX2<nv12, bgra> : NULL;
+#if HAVE_AVX512_KERNELS
+    case ColorKernelLevel::avx512:
+        return CpuHasAvx512BW() ? &RowAVX512<nv12, bgra> : NULL;
+#endif
+#endif
+    case ColorKernelLevel::best:
+        return BestKernel<nv12, bgra>();
+    default:
+        return NULL;
+    }
+}
+
+ColorRowKernel FindColorRowKernel(AVPixelFormat srcFormat, AVColorRange srcRange, AVPixelFormat dstFormat,
+    ColorKernelLevel level /*= ColorKernelLevel::best*/)
+{
+    //Full range input and every other layout keep going through swscale.
+    if (srcRange == AVCOL_RANGE_JPEG)
+        return NULL;
+    bool bgra = dstFormat == AV_PIX_FMT_BGRA;
+    if (!bgra && dstFormat != AV_PIX_FMT_RGBA)
+        return NULL;
+    if (srcFormat == AV_PIX_FMT_YUV420P)
+        return bgra ? LevelKernel<false, true>(level) : LevelKernel<false, false>(level);
+    if (srcFormat == AV_PIX_FMT_NV12)
+        return bgra ? LevelKernel<true, true>(level) : LevelKernel<true, false>(level);
+    return NULL;
+}
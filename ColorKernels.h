@@ -0,0 +1,24 @@
+#ifndef COLORKERNELS_H
+#define COLORKERNELS_H
+
+//Converts one picture row of yuv420p (u and v planes) or nv12 (u holds the interleaved
+//chroma, v is unused) to 32 bit RGBA or BGRA, with the same BT.601 limited range
+//coefficients swscale uses by default.
+typedef void (*ColorRowKernel)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width);
+
+//Instruction sets the kernels are written for.
+enum class ColorKernelLevel
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512,
+    best //the fastest the CPU supports
+};
+
+//NULL when swscale has to do the conversion, or when the build or the CPU lacks the level
+//asked for. Levels other than best are for tests and benchmarks.
+ColorRowKernel FindColorRowKernel(AVPixelFormat srcFormat, AVColorRange srcRange, AVPixelFormat dstFormat,
+    ColorKernelLevel level = ColorKernelLevel::best);
+
+#endif//COLORKERNELS_H
@@ -5,18 +5,66 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
 #include <chrono>
+#include <string>
+#include <atomic>
+#include <algorithm>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 }
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PlayerMemoryPool.h"
+#include "CodecDecoder.h"
 #include "AVPacketQueue.h"
 #include "AudioDecoder.h"
 #include "FrameQueueManager.h"
 #include "DecodingThread.h"
+#include "SeekIndex.h"
+#include "MappedFile.h"
+#include "ReadAheadFile.h"
+#include "PushInput.h"
 
-#define WAIT_TIME 50
+std::mutex DecodingThread::s_decodeThreadsGuard;
+int DecodingThread::s_reservedDecodeThreads = 0;
+
+int DecodingThread::ReserveDecodeThreads(int requested)
+{
+    std::lock_guard<std::mutex> lock(s_decodeThreadsGuard);
+    int budget = std::max((int)std::thread::hardware_concurrency(), 1);
+    if (requested <= 0)
+        requested = std::min(budget, MAX_AUTO_DECODE_THREADS);
+    //Every decoder gets at least one thread even when the budget is spent.
+    int threads = std::max(1, std::min(requested, budget - s_reservedDecodeThreads));
+    s_reservedDecodeThreads += threads;
+    return threads;
+}
+
+void DecodingThread::ReleaseDecodeThreads(int threads)
+{
+    std::lock_guard<std::mutex> lock(s_decodeThreadsGuard);
+    s_reservedDecodeThreads -= threads;
+}
+
+void DecodingThread::ConfigureThreading(AVCodec* codec)
+{
+    m_decodeThreads = ReserveDecodeThreads(m_requestedDecodeThreads);
+    m_decodingStuff.pCodecCtx->thread_count = m_decodeThreads;
+    //Frame threading scales best but delays output by one frame per thread,
+    //slice threading is the fallback for codecs that cannot run frames in parallel.
+    if (codec->capabilities & CODEC_CAP_FRAME_THREADS)
+        m_decodingStuff.pCodecCtx->thread_type = FF_THREAD_FRAME;
+    else if (codec->capabilities & CODEC_CAP_SLICE_THREADS)
+        m_decodingStuff.pCodecCtx->thread_type = FF_THREAD_SLICE;
+    else
+        m_decodingStuff.pCodecCtx->thread_count = 1;
+}
 
 int DecodingThreadErrorCodeToInt(DecodingThreadErrorCode code)
 {
@@ -30,191 +78,290 @@ int DecodingThreadErrorCodeToInt(DecodingThreadErrorCode code)
     }
 }
 
-void DecodingThread::ThreadFunc()
+StepResult DecodingThread::DecodeStep(int64_t& delay)
 {
-    while (true)
+    if (m_destroying)
+        return StepResult::finished;
+    bool needsFreeFrame = m_currentTask == Task::play || m_currentTask == Task::create;
+    if (needsFreeFrame && m_frameQueueManager->GetFreeFramesCount() == 0)
     {
-        if (m_destroying)
-            return;
-        if(m_frameQueueManager->GetFreeFramesCount() == 0)
+        //Commands must not wait until the showing thread hands a frame back.
+        if (m_currentTask == Task::play && HasPendingTask())
         {
-            std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(WAIT_TIME));
-            continue;
+            TakeNextTask();
+            return StepResult::again;
         }
-        switch (m_currentTask)
+        return StepResult::wait;
+    }
+    switch (m_currentTask)
+    {
+        case Task::create:
+            return DecodeFirstFrame();
+        case Task::play:
+            return DecodeFrame();
+        case Task::pause:
+            m_frameDecodeStarted = false;
+            if (m_reportPause){
+                OnPaused();
+                m_reportPause = false;
+            }
+            if (!HasPendingTask())
+                return StepResult::wait;
+            TakeNextTask();
+            return StepResult::again;
+        case Task::stop:
+        case Task::seek:
         {
-            case Task::create:
-                if (!DecodeFirstFrame())
-                    return;
-                break;
-            case Task::play:
-                DecodeFrame();
-                break;
-            case Task::pause:
-                if (m_reportPause){
-                    OnPaused();
-                    m_reportPause = false;
-                }
-                std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(WAIT_TIME));
-                TakeNextTask();
-                break;
-            case Task::stop:
-                if (!FindFirstFrame(0))
-                    return;
-                if (m_firstFrameDone)
+            bool stop = m_currentTask == Task::stop;
+            SeekProgress progress = FindFirstFrame();
+            if (progress == SeekProgress::pending)
+                return StepResult::wait;
+            if (progress == SeekProgress::settling)
+            {
+                delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    m_seekSettleDeadline - std::chrono::steady_clock::now()).count() + 1;
+                return StepResult::waitFor;
+            }
+            if (progress == SeekProgress::failed)
+                return StepResult::finished;
+            if (m_firstFrameDone)
+            {
+                if (stop)
                     OnStopped();
-                break;
-            case Task::seek:
-                if (!FindFirstFrame(m_currentSeekPosition))
-                    return;
-                if (m_firstFrameDone)
+                else
                     OnSeekDone();
-                break;
+            }
+            return StepResult::again;
         }
     }
+    return StepResult::again;
 }
 
-void DecodingThread::DecodeFrame()
+StepResult DecodingThread::DecodeFrame()
 {
-    if (ReadNextPacket(true))
+    //Waiting for packets counts as decode time, the frame queue has to cover both.
+    if (!m_frameDecodeStarted)
     {
-        if (m_decodingStuff.frameFinished)
-        {
-            ScopedLock lock(m_mutex);
-            m_frameQueueManager->SaveFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-            //m_decodingStuff.pFrame = av_frame_alloc();
-            OnFrameReady();
-            TakeNextTask();
-        }
+        m_frameDecodeStart = std::chrono::steady_clock::now();
+        m_frameDecodeStarted = true;
     }
-    else
+    if (!ReadNextPacket())
     {
         m_currentTask = Task::pause;
         OnVideoEnd();
+        return StepResult::again;
     }
+    if (!m_decodingStuff.frameFinished)
+    {
+        //Commands are taken while waiting for the demuxer.
+        if (!HasPendingTask())
+            return StepResult::wait;
+        TakeNextTask();
+        return StepResult::again;
+    }
+    ScopedLock lock(m_mutex);
+    m_frameDecodeStarted = false;
+    m_frameQueueManager->ReportDecodeTime(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_frameDecodeStart).count());
+    m_frameQueueManager->SaveFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
+    OnFrameReady();
+    TakeNextTask();
+    return StepResult::again;
 }
 
-bool DecodingThread::FindFirstFrame(const int64_t position)
+void DecodingThread::StartSeek()
+{
+    //Read together with the generation, so a Seek() in between is not missed.
+    ScopedLock lock(m_taskMutex);
+    m_seekStartGeneration = m_seekGeneration;
+    m_seekTarget = m_currentTask == Task::stop ? 0 : m_currentSeekPosition;
+    m_seekPreview = m_currentTask == Task::seek && m_currentSeekPreview;
+    m_seekSettling = false;
+    m_seekSaveFailures = 0;
+    m_seekFrom = m_seekTarget;
+    m_seekFramePending = true;
+}
+
+bool DecodingThread::SeekRetargeted() const
+{
+    return m_currentTask == Task::seek && m_seekGeneration != m_seekStartGeneration;
+}
+
+DecodingThread::SeekProgress DecodingThread::FindFirstFrame()
 {
     ScopedLock lock(m_mutex);
-    bool found = false;
-    int64_t curSeekPos = position;
-    OnSeekStart();
-    while (1)
+    if (!m_seekRunning)
+    {
+        m_seekRunning = true;
+        StartSeek();
+        m_frameDecodeStarted = false;
+        OnSeekStart();
+    }
+    SeekProgress progress = SeekProgress::pending;
+    while (progress == SeekProgress::pending)
     {
-        bool prevFrameAvailable = false;
-        if (SeekFrame(curSeekPos))
+        //While scrubbing the frames decoded for an older target are of no use.
+        if (SeekRetargeted())
+            StartSeek();
+        if (m_seekSettling)
+        {
+            //A task queued behind the seek, e.g. play, wants the exact frame right away.
+            if (std::chrono::steady_clock::now() < m_seekSettleDeadline && !HasPendingTask())
+                return SeekProgress::settling;
+            //The target held still, decode up to the exact frame from the keyframe again.
+            m_seekSettling = false;
+            m_seekFramePending = true;
+        }
+        if (m_seekFramePending)
         {
-            while (1)
+            //Frames before the target are only decoded. The latest one is kept by reference
+            //in case the target falls between two frames, nothing is copied until the end.
+            m_prevFrameAvailable = false;
+            av_frame_unref(m_decodingStuff.pPrevFrame);
+            m_decodingStuff.pCodecCtx->skip_frame = AVDISCARD_DEFAULT;
+            if (!SeekFrame(m_seekFrom))
             {
-                if (ReadNextPacket(true))
-                {
-                    if (m_decodingStuff.frameFinished)
-                    {
-                        int64_t time = av_frame_get_best_effort_timestamp(m_decodingStuff.pFrame) * (CurrentTimeBaseSeconds() * 1000);
-                        m_currentPTS = time;
-                        if (time >= position)
-                        {
-                            if ((time - position) < (CurrentTimeBaseSeconds() * 1000))
-                            {
-                                m_frameQueueManager->SaveFirstFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-                                //m_decodingStuff.pFrame = av_frame_alloc();
-                                found = true;
-                                break;
-                            }
-                            else if (prevFrameAvailable)
-                            {
-                                m_frameQueueManager->SaveFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-                                //m_decodingStuff.pFrame = av_frame_alloc();
-                                found = true;
-                                break;
-                            }
-                            else if (curSeekPos == 0)
-                            {
-                                m_frameQueueManager->SaveFirstFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-                                //m_decodingStuff.pFrame = av_frame_alloc();
-                                found = true;
-                                break;
-                            }
-                            else
-                            {
-                                curSeekPos = curSeekPos < 1000 ? 0 : curSeekPos - 1000;
-                                break;
-                            }
-                        }
-                        else
-                        {
-                            if ((position - time) < (CurrentTimeBaseSeconds() * 1000))
-                            {
-                                m_frameQueueManager->SaveFirstFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-                                //m_decodingStuff.pFrame = av_frame_alloc();
-                                found = true;
-                                break;
-                            }
-                            else
-                            {
-                                prevFrameAvailable = true;
-                                m_frameQueueManager->SaveFirstFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-                                //m_decodingStuff.pFrame = av_frame_alloc();
-                            }
-                        }
-                    }
-                }
-                else
-                {
-                    if (prevFrameAvailable)
-                    {
-                        found = true;
-                        break;
-                    }
-                    else if (curSeekPos == 0)
-                    {
-                        OnError(DecodingThreadErrorCode::SeekError);
-                        return false;
-                    }
-                    else
-                    {
-                        curSeekPos = curSeekPos < 1000 ? 0 : curSeekPos - 1000;
-                        break;
-                    }
-                }
+                OnError(DecodingThreadErrorCode::SeekError);
+                progress = SeekProgress::failed;
+                break;
+            }
+            m_seekFramePending = false;
+        }
+        if (!ReadNextPacket())
+        {
+            if (m_destroying)
+            {
+                progress = SeekProgress::failed;
+            }
+            else if (m_prevFrameAvailable)
+            {
+                progress = SaveSeekFrame(m_decodingStuff.pPrevFrame);
+            }
+            else if (m_seekFrom == 0)
+            {
+                OnError(DecodingThreadErrorCode::SeekError);
+                progress = SeekProgress::failed;
+            }
+            else
+            {
+                m_seekFrom = m_seekFrom < 1000 ? 0 : m_seekFrom - 1000;
+                m_seekFramePending = true;
+            }
+            continue;
+        }
+        //Resumed by the next packet, the decoder keeps its state meanwhile.
+        if (!m_decodingStuff.frameFinished)
+            return SeekProgress::pending;
+        int64_t time = av_frame_get_best_effort_timestamp(m_decodingStuff.pFrame) * (CurrentTimeBaseSeconds() * 1000);
+        m_currentPTS = time;
+        if (m_seekPreview)
+        {
+            m_seekPreview = false;
+            //A keyframe on the target is the exact frame already.
+            if ((time > m_seekTarget ? time - m_seekTarget : m_seekTarget - time) >= (CurrentTimeBaseSeconds() * 1000))
+            {
+                progress = SaveSeekFrame(m_decodingStuff.pFrame, true);
+                if (progress != SeekProgress::found)
+                    continue;
+                progress = SeekProgress::pending;
+                OnPreviewReady();
+                m_seekSettling = true;
+                m_seekSettleDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SEEK_REFINE_DELAY_MS);
+                continue;
+            }
+        }
+        if (time >= m_seekTarget)
+        {
+            if ((time - m_seekTarget) < (CurrentTimeBaseSeconds() * 1000))
+            {
+                progress = SaveSeekFrame(m_decodingStuff.pFrame);
+            }
+            else if (m_prevFrameAvailable)
+            {
+                progress = SaveSeekFrame(m_decodingStuff.pPrevFrame);
+                if (progress == SeekProgress::found)
+                    m_frameQueueManager->SaveFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
+            }
+            else if (m_seekFrom == 0)
+            {
+                progress = SaveSeekFrame(m_decodingStuff.pFrame);
+            }
+            else
+            {
+                m_seekFrom = m_seekFrom < 1000 ? 0 : m_seekFrom - 1000;
+                m_seekFramePending = true;
             }
         }
         else
         {
-            OnError(DecodingThreadErrorCode::SeekError);
-            return false;
+            if ((m_seekTarget - time) < (CurrentTimeBaseSeconds() * 1000))
+            {
+                progress = SaveSeekFrame(m_decodingStuff.pFrame);
+            }
+            else
+            {
+                m_prevFrameAvailable = true;
+                av_frame_unref(m_decodingStuff.pPrevFrame);
+                av_frame_move_ref(m_decodingStuff.pPrevFrame, m_decodingStuff.pFrame);
+                //Far from the target nobody will see the non-reference frames, the codec may drop them.
+                m_decodingStuff.pCodecCtx->skip_frame = (m_seekTarget - time) > SEEK_SKIP_NONREF_DISTANCE ?
+                    AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+            }
         }
-        if (found)
+        if (progress == SeekProgress::found)
         {
-            m_firstFrameDone = true;
-            OnFirstFrameDone();
-            TakeNextTask();
-            return true;
+            //Checked with the task taken in one go, a Seek() after this queues a seek of its own.
+            ScopedLock taskLock(m_taskMutex);
+            if (SeekRetargeted())
+                progress = SeekProgress::pending;
+            else
+                TakeNextTask();
         }
     }
+    m_seekRunning = false;
+    m_decodingStuff.pCodecCtx->skip_frame = AVDISCARD_DEFAULT;
+    av_frame_unref(m_decodingStuff.pPrevFrame);
+    if (m_destroying)
+        return SeekProgress::failed;
+    if (progress == SeekProgress::found)
+    {
+        m_firstFrameDone = true;
+        OnFirstFrameDone();
+    }
+    return progress;
 }
 
-bool DecodingThread::DecodeFirstFrame()
+DecodingThread::SeekProgress DecodingThread::SaveSeekFrame(AVFrame* frame, bool preview /*= false*/)
 {
-    if (ReadNextPacket(true))
+    if (m_frameQueueManager->SaveFirstFrame(frame, CurrentTimeBaseSeconds(), preview))
+        return SeekProgress::found;
+    if (m_destroying)
+        return SeekProgress::failed;
+    //The presenter would wait for a frame that is not there, the seek is done again instead.
+    if (++m_seekSaveFailures <= SEEK_SAVE_RETRIES)
     {
-        if (m_decodingStuff.frameFinished)
-        {
-            ScopedLock lock(m_mutex);
-            m_frameQueueManager->SaveFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
-            //m_decodingStuff.pFrame = av_frame_alloc();
-            m_firstFrameDone = true;
-            OnFirstFrameDone();
-            TakeNextTask();
-        }
-        return true;
+        m_seekFramePending = true;
+        return SeekProgress::pending;
     }
-    else
+    OnError(DecodingThreadErrorCode::SeekError);
+    return SeekProgress::failed;
+}
+
+StepResult DecodingThread::DecodeFirstFrame()
+{
+    if (!ReadNextPacket())
     {
         OnError(DecodingThreadErrorCode::DecodingError);
-        return false;
+        return StepResult::finished;
     }
+    if (!m_decodingStuff.frameFinished)
+        return StepResult::wait;
+    ScopedLock lock(m_mutex);
+    m_frameQueueManager->SaveFrame(m_decodingStuff.pFrame, CurrentTimeBaseSeconds());
+    m_firstFrameDone = true;
+    OnFirstFrameDone();
+    TakeNextTask();
+    return StepResult::again;
 }
 
 bool DecodingThread::SeekFrame(int64_t milliseconds)
@@ -223,15 +370,27 @@ bool DecodingThread::SeekFrame(int64_t milliseconds)
     AVRational timebase{ 1, 1000 };
     int64_t seekTime = av_rescale_q(milliseconds, timebase,
         m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex]->time_base);
+    SeekIndexEntry keyframe;
+    if (m_seekIndex != NULL && m_seekIndex->FindKeyframe(seekTime, keyframe))
+    {
+        //Landing on the keyframe before the target bounds the decoding to one GOP.
+        seekTime = keyframe.pts;
+        seekFlags = AVSEEK_FLAG_BACKWARD;
+    }
+    ScopedLock demuxLock(m_demuxMutex);
     if (av_seek_frame(m_decodingStuff.pFormatCtx, m_decodingStuff.videoStreamIndex,
         seekTime, seekFlags) >= 0)
     {
-        m_audioPacketQueue->ResetQueue();
+        if (m_seekIndex != NULL)
+            m_seekIndex->PlayerSeeked();
+        //The demux thread is held by m_demuxMutex, so both queues can be flushed here.
+        DropPendingPacket();
         m_videoPacketQueue->ResetQueue();
-        avcodec_flush_buffers(m_decodingStuff.pCodecCtx);
+        m_decodingStuff.videoDecoder->Flush();
         m_audioDecoder->Reset();
-        av_free(m_decodingStuff.pFrame);
-        m_decodingStuff.pFrame = av_frame_alloc();
+        av_frame_unref(m_decodingStuff.pFrame);
+        m_demuxEOF = false;
+        m_demuxSignal.Notify();
         return true;
     }
     else
@@ -241,6 +400,12 @@ bool DecodingThread::SeekFrame(int64_t milliseconds)
     }
 }
 
+bool DecodingThread::HasPendingTask()
+{
+    ScopedLock lock(m_taskMutex);
+    return !m_taskQueue.empty();
+}
+
 void DecodingThread::TakeNextTask()
 {
     ScopedLock lock(m_taskMutex);
@@ -265,56 +430,129 @@ void DecodingThread::TakeNextTask()
         m_currentTask = m_taskQueue.front();
         if (m_currentTask == Task::stop || m_currentTask == Task::seek)
             m_seekDone = false;
+        if (m_currentTask == Task::seek)
+            m_seekQueued = false;
         m_taskQueue.pop();
     }
     m_reportPause = m_currentTask == Task::pause && !wasPause;
 }
 
-bool DecodingThread::ReadNextPacket(bool fillBothQueues)
+bool DecodingThread::CanReadPacket() const
 {
-    bool no_more_packets = false;
-    m_decodingStuff.frameFinished = 0;
-    if (av_read_frame(m_decodingStuff.pFormatCtx, &m_decodingStuff.packet) >= 0)
+    bool audioFull = m_decodingStuff.audioStreamIndex != -1 && m_audioPacketQueue->IsFull();
+    bool videoFull = m_videoPacketQueue->IsFull();
+    if (!audioFull && !videoFull)
+        return true;
+    //A full queue holds demuxing back only while the other stream still has packets,
+    //otherwise badly interleaved files would starve one decoder forever.
+    return (audioFull && !videoFull && m_videoPacketQueue->IsEmpty()) ||
+        (videoFull && !audioFull && m_decodingStuff.audioStreamIndex != -1 && m_audioPacketQueue->IsEmpty());
+}
+
+bool DecodingThread::QueuePendingPacket()
+{
+    AVPacketQueue* queue = NULL;
+    if (m_decodingStuff.packet.stream_index == m_decodingStuff.videoStreamIndex)
+        queue = m_videoPacketQueue;
+    else if (m_decodingStuff.packet.stream_index == m_decodingStuff.audioStreamIndex)
+        queue = m_audioPacketQueue;
+    if (queue != NULL && !queue->PutPacket(&m_decodingStuff.packet))
+    {
+        //Keep the packet until there is room. Audio nobody consumes must not stall video decoding though.
+        if (queue != m_audioPacketQueue || !m_videoPacketQueue->IsEmpty())
+            return false;
+    }
+    av_free_packet(&m_decodingStuff.packet);
+    m_decodingStuff.packetPending = false;
+    return true;
+}
+
+void DecodingThread::DropPendingPacket()
+{
+    if (m_decodingStuff.packetPending)
     {
-        if (m_decodingStuff.packet.stream_index == m_decodingStuff.videoStreamIndex)
-        {
-            m_videoPacketQueue->PutPacket(&m_decodingStuff.packet);
-        }
-        else if (m_decodingStuff.packet.stream_index == m_decodingStuff.audioStreamIndex)
-        {
-            m_audioPacketQueue->PutPacket(&m_decodingStuff.packet);
-        }
         av_free_packet(&m_decodingStuff.packet);
+        m_decodingStuff.packetPending = false;
     }
-    else
+}
+
+bool DecodingThread::DemuxNextPacket()
+{
+    ScopedLock lock(m_demuxMutex);
+    if (m_demuxEOF)
+        return false;
+    if (m_decodingStuff.packetPending)
+        return QueuePendingPacket();
+    if (!CanReadPacket())
+        return false;
+    int ret = av_read_frame(m_decodingStuff.pFormatCtx, &m_decodingStuff.packet);
+    if (ret < 0)
     {
-        no_more_packets = true;
+        if (m_seekIndex != NULL && ret == AVERROR_EOF)
+            m_seekIndex->PlayerInputEnded();
+        m_demuxEOF = true;
+        m_audioDecoder->SetEndOfStream();
+        m_signal.Notify();
+        return false;
     }
+    if (m_seekIndex != NULL)
+        m_seekIndex->AddPlayerPacket(m_decodingStuff.packet);
+    m_decodingStuff.packetPending = true;
+    return QueuePendingPacket();
+}
+
+StepResult DecodingThread::DemuxStep(int64_t& delay)
+{
+    if (m_destroying)
+        return StepResult::finished;
+    //Sleeps while the queues are full or the input ended, the decoders and seeks wake it up.
+    return DemuxNextPacket() ? StepResult::again : StepResult::wait;
+}
+
+void DecodingThread::UpdateCurrentPTS()
+{
+    int64_t pts = av_frame_get_best_effort_timestamp(m_decodingStuff.pFrame);
+    if (pts != AV_NOPTS_VALUE) {
+        m_currentPTS = pts
+            * (av_q2d(m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex]->time_base)
+            * 1000);
+    }
+}
 
-    if (!fillBothQueues || m_audioPacketQueue->GetSize() > 10 || m_decodingStuff.audioStreamIndex == -1 || no_more_packets)
+bool DecodingThread::ReadNextPacket()
+{
+    m_decodingStuff.frameFinished = 0;
+    while (!m_destroying)
     {
-        ScopedLock lock(m_mutex);
-        while (m_videoPacketQueue->GetSize() && !m_decodingStuff.frameFinished)
         {
-            SmartAvPacket* currentPacket = m_videoPacketQueue->GetPacket();
-            if (currentPacket)
+            ScopedLock lock(m_mutex);
+            //Frames left from earlier packets come first, a packet may produce several of them.
+            int ret = m_decodingStuff.videoDecoder->ReceiveFrame(m_decodingStuff.pFrame);
+            if (ret == 0)
             {
-                avcodec_decode_video2(m_decodingStuff.pCodecCtx, m_decodingStuff.pFrame,
-                    &m_decodingStuff.frameFinished, &currentPacket->m_packet);
-                delete currentPacket;
+                m_decodingStuff.frameFinished = 1;
+                UpdateCurrentPTS();
+                return true;
             }
-        }
-        if (m_decodingStuff.frameFinished)
-        {
-            if (m_decodingStuff.packet.dts != AV_NOPTS_VALUE) {
-                m_currentPTS = av_frame_get_best_effort_timestamp(m_decodingStuff.pFrame)
-                    * (av_q2d(m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex]->time_base)
-                    * 1000);
+            if (ret == AVERROR_EOF)
+                return false;
+            if (m_videoPacketQueue->GetPacket(&m_decodingStuff.videoPacket))
+            {
+                m_decodingStuff.videoDecoder->SendPacket(&m_decodingStuff.videoPacket);
+                av_free_packet(&m_decodingStuff.videoPacket);
+                continue;
+            }
+            //The EOF flag is set after the last packet is queued, so recheck the queue once it is seen.
+            if (m_demuxEOF && m_videoPacketQueue->IsEmpty())
+            {
+                m_decodingStuff.videoDecoder->SendPacket(NULL);
+                continue;
             }
-            return true;
         }
+        //The caller waits for the demuxer to notify m_signal.
+        return true;
     }
-    return !no_more_packets;
+    return false;
 }
 
 void DecodingThread::InitializeDecodingStuff()
@@ -322,22 +560,35 @@ void DecodingThread::InitializeDecodingStuff()
     m_decodingStuff.videoStreamIndex = -1;
     m_decodingStuff.audioStreamIndex = -1;
     m_decodingStuff.frameFinished = 0;
+    m_decodingStuff.packetPending = false;
+    av_init_packet(&m_decodingStuff.videoPacket);
+    m_decodingStuff.videoPacket.data = NULL;
+    m_decodingStuff.videoPacket.size = 0;
     m_decodingStuff.pFormatCtx = NULL;
     m_decodingStuff.pCodecCtx = NULL;
+    m_decodingStuff.videoDecoder = NULL;
     m_decodingStuff.pAudioCodecCtx = NULL;
     m_decodingStuff.pFrame = NULL;
+    m_decodingStuff.pPrevFrame = NULL;
     m_decodingStuff.avio_ctx = NULL;
     m_decodingStuff.avio_ctx_buffer = NULL;
     m_decodingStuff.bufferData = NULL;
+    m_decodingStuff.pushReader = NULL;
 }
 
 void DecodingThread::FreeDecodingStuff()
 {
+    DropPendingPacket();
     if (m_decodingStuff.pFormatCtx != NULL)
     {
         avformat_close_input(&m_decodingStuff.pFormatCtx);
         m_decodingStuff.pFormatCtx = NULL;
     }
+    if (m_decodingStuff.videoDecoder != NULL)
+    {
+        delete m_decodingStuff.videoDecoder;
+        m_decodingStuff.videoDecoder = NULL;
+    }
     if (m_decodingStuff.pCodecCtx != NULL)
     {
         avcodec_close(m_decodingStuff.pCodecCtx);
@@ -350,13 +601,18 @@ void DecodingThread::FreeDecodingStuff()
     }
     if (m_decodingStuff.pFrame != NULL)
     {
-        av_free(m_decodingStuff.pFrame);
-        m_decodingStuff.pFrame = NULL;
+        m_memoryPool->FreeFrame(&m_decodingStuff.pFrame);
+    }
+    if (m_decodingStuff.pPrevFrame != NULL)
+    {
+        m_memoryPool->FreeFrame(&m_decodingStuff.pPrevFrame);
     }
     if (m_decodingStuff.avio_ctx != NULL)
     {
-        av_free(m_decodingStuff.avio_ctx);
-        m_decodingStuff.avio_ctx = NULL;
+        //avio may have swapped the buffer it was given for a bigger one.
+        av_freep(&m_decodingStuff.avio_ctx->buffer);
+        av_freep(&m_decodingStuff.avio_ctx);
+        m_decodingStuff.avio_ctx_buffer = NULL;
     }
     
     if (m_decodingStuff.bufferData != NULL)
@@ -364,6 +620,11 @@ void DecodingThread::FreeDecodingStuff()
         delete m_decodingStuff.bufferData;
         m_decodingStuff.bufferData = NULL;
     }
+    if (m_decodingStuff.pushReader != NULL)
+    {
+        delete m_decodingStuff.pushReader;
+        m_decodingStuff.pushReader = NULL;
+    }
 
     if (m_audioDecoder != NULL)
     {
@@ -372,23 +633,75 @@ void DecodingThread::FreeDecodingStuff()
     }
 }
 
-DecodingThread::DecodingThread(const char* filePath, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue) :
+DecodingThread::DecodingThread(const char* filePath, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue, PlayerMemoryPool* memoryPool, int decodeThreads, const char* seekIndexCacheDirectory, bool mapFile, int ioBufferSize, int readAheadBytes) :
     m_frameQueueManager(frameQueueManager),
     m_audioPacketQueue(audioPacketQueue),
     m_videoPacketQueue(videoPacketQueue),
+    m_memoryPool(memoryPool),
     m_currentTask(Task::create),
     m_destroying(false),
     m_firstFrameDone(false),
+    m_frameDecodeStarted(false),
     m_seekDone(false),
     m_initialized(false),
     m_currentSeekPosition(0),
+    m_currentSeekPreview(false),
     m_currentPTS(0),
     m_frameSize(0, 0),
-    m_reportPause(false)
+    m_reportPause(false),
+    m_seekRunning(false),
+    m_seekFramePending(false),
+    m_prevFrameAvailable(false),
+    m_seekTarget(0),
+    m_seekFrom(0),
+    m_seekPreview(false),
+    m_seekSettling(false),
+    m_seekSaveFailures(0),
+    m_seekStartGeneration(0),
+    m_seekGeneration(0),
+    m_seekQueued(false),
+    m_demuxEOF(false),
+    m_requestedDecodeThreads(decodeThreads),
+    m_decodeThreads(0),
+    m_seekIndex(NULL),
+    m_mappedFile(NULL),
+    m_readAheadFile(NULL),
+    m_pushInput(NULL),
+    m_decodeTask(m_signal, [this](int64_t& delay) { return this->DecodeStep(delay); }),
+    m_demuxTask(m_demuxSignal, [this](int64_t& delay) { return this->DemuxStep(delay); })
 {
     InitializeDecodingStuff();
-    int err = 0;
-    if ((err = avformat_open_input(&m_decodingStuff.pFormatCtx, filePath, NULL, 0)) != 0)
+    m_frameQueueManager->SetFreeFrameSignal(&m_signal);
+    if (mapFile)
+    {
+        m_mappedFile = new MappedFile();
+        if (!m_mappedFile->Open(filePath))
+        {
+            delete m_mappedFile;
+            m_mappedFile = NULL;
+        }
+    }
+    else if (readAheadBytes > 0)
+    {
+        m_readAheadFile = new ReadAheadFile();
+        if (!m_readAheadFile->Open(filePath, readAheadBytes))
+        {
+            delete m_readAheadFile;
+            m_readAheadFile = NULL;
+        }
+    }
+    if (m_mappedFile != NULL)
+    {
+        if (!OpenMemoryInput(m_mappedFile->Data(), m_mappedFile->Size(), ioBufferSize, filePath))
+            return;
+        m_decodingStuff.bufferData->file = m_mappedFile;
+    }
+    else if (m_readAheadFile != NULL)
+    {
+        if (!OpenCustomInput(m_readAheadFile, &read_ahead_read_packet, &read_ahead_seek, ioBufferSize, filePath, NULL))
+            return;
+    }
+    else if (avformat_open_input(&m_decodingStuff.pFormatCtx, filePath, NULL, 0) != 0)
         return;
     if (avformat_find_stream_info(m_decodingStuff.pFormatCtx, NULL)<0)
         return;
@@ -396,7 +709,17 @@ DecodingThread::DecodingThread(const char* filePath, FrameQueueManager* frameQue
 
     Initialize();
 
-    m_audioDecoder = new AudioDecoder(m_decodingStuff.pAudioCodecCtx, m_audioPacketQueue, m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex]);
+    m_audioDecoder = new AudioDecoder(m_decodingStuff.pAudioCodecCtx, m_audioPacketQueue, m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex], m_memoryPool);
+    if (m_initialized)
+    {
+        m_seekIndex = new SeekIndex();
+        //The index scans the same view, without opening the file a second time.
+        if (m_mappedFile != NULL)
+            m_seekIndex->Start(m_mappedFile->Data(), m_mappedFile->Size(), m_decodingStuff.videoStreamIndex, seekIndexCacheDirectory,
+                SeekIndex::GetFileModifiedTime(filePath));
+        else
+            m_seekIndex->Start(filePath, m_decodingStuff.videoStreamIndex, seekIndexCacheDirectory);
+    }
 }
 
 void DecodingThread::Initialize()
@@ -433,12 +756,21 @@ void DecodingThread::Initialize()
     if (avcodec_copy_context(m_decodingStuff.pCodecCtx, pCodecCtxOrig) != 0) {
         return;
     }
+    ConfigureThreading(pCodec);
+    //Decoded frames stay valid after the next decode call, seeking keeps one aside without copying it.
+    m_decodingStuff.pCodecCtx->refcounted_frames = 1;
     // Open codec
     if (avcodec_open2(m_decodingStuff.pCodecCtx, pCodec, NULL)<0)
         return; // Could not open codec
-    m_decodingStuff.pFrame = av_frame_alloc();
+    m_decodingStuff.videoDecoder = new CodecDecoder(m_decodingStuff.pCodecCtx);
+    m_decodingStuff.pFrame = m_memoryPool->AllocFrame();
+    m_decodingStuff.pPrevFrame = m_memoryPool->AllocFrame();
+    m_videoPacketQueue->SetTimeBase(m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex]->time_base);
+    m_videoPacketQueue->SetSignals(&m_signal, &m_demuxSignal);
     m_initialized = true;
     if (m_decodingStuff.audioStreamIndex != -1){//If we have audio stream
+        m_audioPacketQueue->SetTimeBase(m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex]->time_base);
+        m_audioPacketQueue->SetSignals(NULL, &m_demuxSignal);
         pCodecCtxOrig = m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex]->codec;
 
         pCodec = NULL;
@@ -466,6 +798,12 @@ int read_packet(void *opaque, uint8_t *buf, int buf_size)
 {
     buffer_data *bd = (struct buffer_data *)opaque;
     buf_size = FFMIN(buf_size, bd->size - bd->currentPos);
+    if (bd->file != NULL && bd->currentPos + buf_size > bd->prefetchedPos)
+    {
+        //Stay a window ahead of the demuxer, so it rarely waits for a page fault to be read.
+        bd->file->Prefetch(bd->currentPos, MAPPED_FILE_READAHEAD);
+        bd->prefetchedPos = bd->currentPos + MAPPED_FILE_READAHEAD;
+    }
     
     memcpy(buf, bd->currentPosPtr, buf_size);
     bd->currentPosPtr += buf_size;
@@ -493,64 +831,191 @@ int64_t seek(void *opaque, int64_t offset, int whence)
     case AVSEEK_SIZE:
         return bd->size;
     }
-    if (res_pos < bd->size && res_pos > 0)
+    if (res_pos < bd->size && res_pos >= 0)
     {
         bd->currentPos = res_pos;
         bd->currentPosPtr = bd->ptr + res_pos;
+        bd->prefetchedPos = res_pos; //the next read prefetches from here
         return res_pos;
     }
     return -1;
 }
 
-DecodingThread::DecodingThread(uint8_t* buffer, int64_t bufferSize, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue) :
+DecodingThread::DecodingThread(uint8_t* buffer, int64_t bufferSize, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue, PlayerMemoryPool* memoryPool, int decodeThreads, const char* seekIndexCacheDirectory, int ioBufferSize) :
     m_frameQueueManager(frameQueueManager),
     m_audioPacketQueue(audioPacketQueue),
     m_videoPacketQueue(videoPacketQueue),
+    m_memoryPool(memoryPool),
     m_currentTask(Task::create),
     m_destroying(false),
     m_firstFrameDone(false),
+    m_frameDecodeStarted(false),
     m_seekDone(false),
     m_initialized(false),
     m_currentSeekPosition(0),
+    m_currentSeekPreview(false),
     m_currentPTS(0),
     m_frameSize(0, 0),
-    m_reportPause(false)
+    m_reportPause(false),
+    m_seekRunning(false),
+    m_seekFramePending(false),
+    m_prevFrameAvailable(false),
+    m_seekTarget(0),
+    m_seekFrom(0),
+    m_seekPreview(false),
+    m_seekSettling(false),
+    m_seekSaveFailures(0),
+    m_seekStartGeneration(0),
+    m_seekGeneration(0),
+    m_seekQueued(false),
+    m_demuxEOF(false),
+    m_requestedDecodeThreads(decodeThreads),
+    m_decodeThreads(0),
+    m_seekIndex(NULL),
+    m_mappedFile(NULL),
+    m_readAheadFile(NULL),
+    m_pushInput(NULL),
+    m_decodeTask(m_signal, [this](int64_t& delay) { return this->DecodeStep(delay); }),
+    m_demuxTask(m_demuxSignal, [this](int64_t& delay) { return this->DemuxStep(delay); })
 {
     InitializeDecodingStuff();
-    size_t avio_ctx_buffer_size = 4096;
-    int ret = 0;
+    m_frameQueueManager->SetFreeFrameSignal(&m_signal);
+    if (!OpenMemoryInput(buffer, bufferSize, ioBufferSize, NULL))
+        return;
+    if (avformat_find_stream_info(m_decodingStuff.pFormatCtx, NULL)<0)
+        return;
+    av_dump_format(m_decodingStuff.pFormatCtx, 0, NULL, 0);
+
+    Initialize();
+
+    m_audioDecoder = new AudioDecoder(m_decodingStuff.pAudioCodecCtx, m_audioPacketQueue, m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex], m_memoryPool);
+    if (m_initialized)
+    {
+        m_seekIndex = new SeekIndex();
+        m_seekIndex->Start(buffer, bufferSize, m_decodingStuff.videoStreamIndex, seekIndexCacheDirectory);
+    }
+}
+
+bool DecodingThread::OpenMemoryInput(uint8_t* buffer, int64_t bufferSize, int ioBufferSize, const char* url)
+{
     /* fill opaque structure used by the AVIOContext read callback */
-    m_decodingStuff.bufferData = new buffer_data{ buffer, bufferSize, 0, buffer };
-    
+    m_decodingStuff.bufferData = new buffer_data{ buffer, bufferSize, 0, buffer, NULL, 0 };
+    return OpenCustomInput(m_decodingStuff.bufferData, &read_packet, &seek, ioBufferSize, url, NULL);
+}
+
+bool DecodingThread::OpenCustomInput(void* opaque, int(*readPacket)(void*, uint8_t*, int), int64_t(*seekInput)(void*, int64_t, int),
+    int ioBufferSize, const char* url, AVDictionary** options)
+{
+    int avio_ctx_buffer_size = ioBufferSize > 0 ? ioBufferSize : DEFAULT_IO_BUFFER_SIZE;
     m_decodingStuff.pFormatCtx = avformat_alloc_context();
     m_decodingStuff.avio_ctx_buffer = (uint8_t*)av_malloc(avio_ctx_buffer_size);
-    
+
     m_decodingStuff.avio_ctx = avio_alloc_context(m_decodingStuff.avio_ctx_buffer, avio_ctx_buffer_size,
-        0, m_decodingStuff.bufferData, &read_packet, NULL, &seek);
-    
+        0, opaque, readPacket, NULL, seekInput);
+
     m_decodingStuff.pFormatCtx->pb = m_decodingStuff.avio_ctx;
-    ret = avformat_open_input(&m_decodingStuff.pFormatCtx, NULL, NULL, NULL);
-    
+    //The url is only a hint for probing, the custom pb is what gets read.
+    return avformat_open_input(&m_decodingStuff.pFormatCtx, url, NULL, options) == 0;
+}
+
+DecodingThread::DecodingThread(PushInput* input, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue, PlayerMemoryPool* memoryPool, int decodeThreads, int ioBufferSize) :
+    m_frameQueueManager(frameQueueManager),
+    m_audioPacketQueue(audioPacketQueue),
+    m_videoPacketQueue(videoPacketQueue),
+    m_memoryPool(memoryPool),
+    m_currentTask(Task::create),
+    m_destroying(false),
+    m_firstFrameDone(false),
+    m_frameDecodeStarted(false),
+    m_seekDone(false),
+    m_initialized(false),
+    m_currentSeekPosition(0),
+    m_currentSeekPreview(false),
+    m_currentPTS(0),
+    m_frameSize(0, 0),
+    m_reportPause(false),
+    m_seekRunning(false),
+    m_seekFramePending(false),
+    m_prevFrameAvailable(false),
+    m_seekTarget(0),
+    m_seekFrom(0),
+    m_seekPreview(false),
+    m_seekSettling(false),
+    m_seekSaveFailures(0),
+    m_seekStartGeneration(0),
+    m_seekGeneration(0),
+    m_seekQueued(false),
+    m_demuxEOF(false),
+    m_requestedDecodeThreads(decodeThreads),
+    m_decodeThreads(0),
+    m_seekIndex(NULL),
+    m_mappedFile(NULL),
+    m_readAheadFile(NULL),
+    m_pushInput(input),
+    m_decodeTask(m_signal, [this](int64_t& delay) { return this->DecodeStep(delay); }),
+    m_demuxTask(m_demuxSignal, [this](int64_t& delay) { return this->DemuxStep(delay); })
+{
+    InitializeDecodingStuff();
+    m_frameQueueManager->SetFreeFrameSignal(&m_signal);
+    //Probe only the start of the input, the defaults would wait for several megabytes to arrive.
+    AVDictionary* options = NULL;
+    char value[32];
+    snprintf(value, sizeof(value), "%d", PUSH_INPUT_PROBE_SIZE);
+    av_dict_set(&options, "probesize", value, 0);
+    snprintf(value, sizeof(value), "%d", PUSH_INPUT_ANALYZE_DURATION * 1000);
+    av_dict_set(&options, "analyzeduration", value, 0);
+    m_decodingStuff.pushReader = new PushInputReader{ input, 0 };
+    bool opened = OpenCustomInput(m_decodingStuff.pushReader, &push_input_read_packet, &push_input_seek, ioBufferSize, NULL, &options);
+    av_dict_free(&options);
+    if (!opened)
+        return;
     if (avformat_find_stream_info(m_decodingStuff.pFormatCtx, NULL)<0)
         return;
     av_dump_format(m_decodingStuff.pFormatCtx, 0, NULL, 0);
 
     Initialize();
 
-    m_audioDecoder = new AudioDecoder(m_decodingStuff.pAudioCodecCtx, m_audioPacketQueue, m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex]);
+    m_audioDecoder = new AudioDecoder(m_decodingStuff.pAudioCodecCtx, m_audioPacketQueue, m_decodingStuff.pFormatCtx->streams[m_decodingStuff.audioStreamIndex], m_memoryPool);
+    if (m_initialized)
+    {
+        //Indexed while the input arrives, an input only known by its start has nothing to cache by.
+        m_seekIndex = new SeekIndex();
+        m_seekIndex->Start(input, m_decodingStuff.videoStreamIndex);
+    }
 }
 
-void DecodingThread::Start()
+void DecodingThread::Start(PlayerScheduler* scheduler /*= NULL*/)
 {
-    m_thread = std::thread([this] { this->ThreadFunc(); });
+    m_demuxTask.Start(m_pushInput != NULL ? NULL : scheduler);
+    m_decodeTask.Start(scheduler);
 }
 
 DecodingThread::~DecodingThread()
 {
     m_destroying = true;
-    m_thread.join();
+    //Wakes the demuxer and the seek index out of reads waiting for data.
+    if (m_pushInput != NULL)
+        m_pushInput->Abort();
+    m_signal.Notify();
+    m_demuxSignal.Notify();
+    m_decodeTask.Stop();
+    m_demuxTask.Stop();
+    delete m_seekIndex;
     avformat_close_input(&m_decodingStuff.pFormatCtx);
     FreeDecodingStuff();
+    delete m_mappedFile;
+    delete m_readAheadFile;
+    ReleaseDecodeThreads(m_decodeThreads);
+}
+
+void DecodingThread::GetInputStats(PlayerInputStats& stats) const
+{
+    if (m_readAheadFile == NULL)
+    {
+        memset(&stats, 0, sizeof(stats));
+        return;
+    }
+    m_readAheadFile->GetStats(stats);
 }
 
 void DecodingThread::AddListener(DecodingThreadListener* listener)
@@ -575,6 +1040,7 @@ void DecodingThread::Play()
         return;
     ScopedLock lock(m_taskMutex);
     m_taskQueue.push(Task::play);
+    m_signal.Notify();
 }
 
 void DecodingThread::Pause()
@@ -583,6 +1049,7 @@ void DecodingThread::Pause()
         return;
     ScopedLock lock(m_taskMutex);
     m_taskQueue.push(Task::pause);
+    m_signal.Notify();
 }
 
 void DecodingThread::Stop()
@@ -591,15 +1058,24 @@ void DecodingThread::Stop()
         return;
     ScopedLock lock(m_taskMutex);
     m_taskQueue.push(Task::stop);
+    m_signal.Notify();
 }
 
-void DecodingThread::Seek(int64_t timeInMilliseconds)
+void DecodingThread::Seek(int64_t timeInMilliseconds, bool preview /*= false*/)
 {
     if (m_destroying)
         return;
     ScopedLock lock(m_taskMutex);
     m_currentSeekPosition = timeInMilliseconds;
-    m_taskQueue.push(Task::seek);
+    m_currentSeekPreview = preview;
+    ++m_seekGeneration;
+    //A seek task already waiting or running picks the new target up.
+    if (!m_seekQueued && m_currentTask != Task::seek)
+    {
+        m_taskQueue.push(Task::seek);
+        m_seekQueued = true;
+    }
+    m_signal.Notify();
 }
 
 double DecodingThread::CurrentTimeBaseSeconds() const
@@ -611,8 +1087,19 @@ double DecodingThread::CurrentTimeBaseSeconds() const
 int64_t DecodingThread::Duration() const
 {
     //ScopedLock lock(m_mutex);
-    return m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex]->duration *
-        (av_q2d(m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex]->time_base) * 1000);
+    AVStream* stream = m_decodingStuff.pFormatCtx->streams[m_decodingStuff.videoStreamIndex];
+    if (stream->duration != AV_NOPTS_VALUE)
+        return stream->duration * (av_q2d(stream->time_base) * 1000);
+    //Streams without a duration are measured by the seek index once it is complete.
+    int64_t end = m_seekIndex != NULL ? m_seekIndex->GetEndTimestamp() : AV_NOPTS_VALUE;
+    if (end != AV_NOPTS_VALUE)
+    {
+        int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        return (end - start) * (av_q2d(stream->time_base) * 1000);
+    }
+    if (m_decodingStuff.pFormatCtx->duration != AV_NOPTS_VALUE)
+        return m_decodingStuff.pFormatCtx->duration / (AV_TIME_BASE / 1000);
+    return 0;
 }
 
 void DecodingThread::OnError(DecodingThreadErrorCode error)
@@ -685,4 +1172,13 @@ void DecodingThread::OnFirstFrameDone()
     ScopedLock lock(m_eventMutex);
     for (auto listener : m_listeners)
         listener->OnFirstFrameDone();
-}
\ No newline at end of file
+}
+
+void DecodingThread::OnPreviewReady()
+{
+    if (m_destroying)
+        return;
+    ScopedLock lock(m_eventMutex);
+    for (auto listener : m_listeners)
+        listener->OnPreviewReady();
+}
@@ -1,6 +1,12 @@
 #ifndef DECODINGTHREAD_H
 #define DECODINGTHREAD_H
 
+#define MAX_AUTO_DECODE_THREADS 16
+#define SEEK_SKIP_NONREF_DISTANCE 1000 //milliseconds before the seek target
+#define SEEK_REFINE_DELAY_MS 150 //a preview seek decodes the exact frame once no newer target came for this long
+#define SEEK_SAVE_RETRIES 2 //seeks started over when the frame queue could not take the first frame
+#define DEFAULT_IO_BUFFER_SIZE (32 * 1024) //bytes handed to the demuxer per read from memory
+
 #include "DecodingThreadListener.h"
 
 enum class DecodingThreadErrorCode
@@ -11,15 +17,31 @@ enum class DecodingThreadErrorCode
 
 int DecodingThreadErrorCodeToInt(DecodingThreadErrorCode code);
 
+class MappedFile;
+class ReadAheadFile;
+struct PlayerInputStats;
+class PushInput;
+struct PushInputReader;
+class PlayerScheduler;
+
 struct buffer_data {
     uint8_t *ptr;
     const int64_t size; ///< size left in the buffer
     int64_t currentPos;
     uint8_t *currentPosPtr;
+    MappedFile *file; ///< prefetched ahead of the reads when ptr is its view
+    int64_t prefetchedPos;
 };
 
+//AVIOContext callbacks reading from a buffer_data.
+int read_packet(void *opaque, uint8_t *buf, int buf_size);
+int64_t seek(void *opaque, int64_t offset, int whence);
+
 class AudioDecoder;
 class AVPacketQueue;
+class CodecDecoder;
+class PlayerMemoryPool;
+class SeekIndex;
 
 class DecodingThread : public DecodingThreadListener
 {
@@ -33,19 +55,32 @@ class DecodingThread : public DecodingThreadListener
         seek
     };
 
+    enum class SeekProgress
+    {
+        pending, //waits for packets, FindFirstFrame continues where it stopped
+        settling, //a preview is shown, the exact frame is decoded at m_seekSettleDeadline
+        found,
+        failed
+    };
+
     struct DecodingStuff
     {
         AVFormatContext *pFormatCtx;
         int videoStreamIndex;
         int audioStreamIndex;
         AVCodecContext *pCodecCtx;
+        CodecDecoder *videoDecoder;
         AVCodecContext *pAudioCodecCtx;
         int frameFinished;
         AVPacket packet;
+        bool packetPending; //packet is read but its queue had no room yet
+        AVPacket videoPacket;
         AVFrame *pFrame;
+        AVFrame *pPrevFrame; //last frame before the seek target, held by reference
         AVIOContext *avio_ctx;
         uint8_t *avio_ctx_buffer;
         buffer_data * bufferData;
+        PushInputReader * pushReader;
     };
 
     bool m_firstFrameDone;
@@ -53,7 +88,11 @@ class DecodingThread : public DecodingThreadListener
     std::queue<Task> m_taskQueue;
     Task m_currentTask;
     std::pair<int, int> m_frameSize;
-    std::thread m_thread;
+    ThreadSignal m_signal;
+    ThreadSignal m_demuxSignal;
+    ScheduledTask m_decodeTask;
+    ScheduledTask m_demuxTask;
+    std::recursive_mutex m_demuxMutex; //guards the format context and the pending packet
     std::recursive_mutex m_taskMutex;
     std::recursive_mutex m_eventMutex;
     mutable std::recursive_mutex m_mutex;
@@ -61,39 +100,99 @@ class DecodingThread : public DecodingThreadListener
     AVPacketQueue *m_videoPacketQueue;
     AudioDecoder* m_audioDecoder;
     FrameQueueManager* m_frameQueueManager;
+    PlayerMemoryPool* m_memoryPool;
     DecodingStuff m_decodingStuff;
     int64_t m_currentSeekPosition;
+    bool m_currentSeekPreview; //guarded by m_taskMutex like m_currentSeekPosition
     int64_t m_currentPTS;
+    std::chrono::steady_clock::time_point m_frameDecodeStart;
+    bool m_frameDecodeStarted; //m_frameDecodeStart belongs to the frame being decoded
     bool m_destroying;
     bool m_seekDone;
     bool m_initialized;
     bool m_reportPause;
+    //State of the seek FindFirstFrame is in the middle of.
+    bool m_seekRunning;
+    bool m_seekFramePending; //SeekFrame(m_seekFrom) is still to be done
+    bool m_prevFrameAvailable;
+    int64_t m_seekTarget;
+    int64_t m_seekFrom;
+    bool m_seekPreview; //the keyframe is still to be shown before the exact frame
+    bool m_seekSettling;
+    int m_seekSaveFailures;
+    std::chrono::steady_clock::time_point m_seekSettleDeadline;
+    unsigned m_seekStartGeneration; //m_seekGeneration m_seekTarget was taken at
+    std::atomic<unsigned> m_seekGeneration; //bumped by every Seek() under m_taskMutex
+    bool m_seekQueued; //a Task::seek waits in m_taskQueue, guarded by m_taskMutex
+    std::atomic<bool> m_demuxEOF;
+    int m_requestedDecodeThreads; //0 picks the thread count automatically
+    int m_decodeThreads; //threads taken from the process budget
+    SeekIndex* m_seekIndex;
+    MappedFile* m_mappedFile; //view the demuxer reads from, NULL for other inputs
+    ReadAheadFile* m_readAheadFile; //NULL for other inputs
+    PushInput* m_pushInput; //owned by the application
+
+    //Cores shared by the decoders of all players in the process.
+    static std::mutex s_decodeThreadsGuard;
+    static int s_reservedDecodeThreads;
+    static int ReserveDecodeThreads(int requested);
+    static void ReleaseDecodeThreads(int threads);
 
-    bool FindFirstFrame(int64_t position);
+    SeekProgress FindFirstFrame();
+    //found, or pending with the seek started over, or failed once the retries are used up.
+    SeekProgress SaveSeekFrame(AVFrame* frame, bool preview = false);
+    //Takes the target of the current stop or seek task.
+    void StartSeek();
+    //A seek task got a newer target since StartSeek.
+    bool SeekRetargeted() const;
+    bool HasPendingTask();
     void TakeNextTask();
-    bool ReadNextPacket(bool fillBothQueues);
-    void DecodeFrame();
-    bool DecodeFirstFrame();
+    bool CanReadPacket() const;
+    bool QueuePendingPacket();
+    void DropPendingPacket();
+    bool DemuxNextPacket();
+    StepResult DemuxStep(int64_t& delay);
+    StepResult DecodeStep(int64_t& delay);
+    void UpdateCurrentPTS();
+    //False at the end of the stream, frameFinished is 0 when the packets for a frame are not there yet.
+    bool ReadNextPacket();
+    StepResult DecodeFrame();
+    StepResult DecodeFirstFrame();
     bool SeekFrame(int64_t milliseconds);
     void Initialize();
+    void ConfigureThreading(AVCodec* codec);
     void InitializeDecodingStuff();
     void FreeDecodingStuff();
+    bool OpenMemoryInput(uint8_t* buffer, int64_t bufferSize, int ioBufferSize, const char* url);
+    bool OpenCustomInput(void* opaque, int(*readPacket)(void*, uint8_t*, int), int64_t(*seekInput)(void*, int64_t, int),
+        int ioBufferSize, const char* url, AVDictionary** options);
 public:
-    DecodingThread(const char* filePath, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue);
-    DecodingThread(uint8_t* buffer, int64_t bufferSize, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue);
+    //mapFile reads the file through a MappedFile, otherwise readAheadBytes above 0 reads it through a
+    //ReadAheadFile. Without either, or when they fail, ffmpeg's file reader is used.
+    //ioBufferSize is what the demuxer reads at once, 0 uses DEFAULT_IO_BUFFER_SIZE.
+    DecodingThread(const char* filePath, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue, PlayerMemoryPool* memoryPool, int decodeThreads = 0, const char* seekIndexCacheDirectory = NULL, bool mapFile = false, int ioBufferSize = 0, int readAheadBytes = 0);
+    DecodingThread(uint8_t* buffer, int64_t bufferSize, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue, PlayerMemoryPool* memoryPool, int decodeThreads = 0, const char* seekIndexCacheDirectory = NULL, int ioBufferSize = 0);
+    //Returns once the start of the input arrived, the input is aborted when the thread is destroyed.
+    DecodingThread(PushInput* input, FrameQueueManager* frameQueueManager, AVPacketQueue* audioPacketQueue, AVPacketQueue* videoPacketQueue, PlayerMemoryPool* memoryPool, int decodeThreads = 0, int ioBufferSize = 0);
     ~DecodingThread();
-    void ThreadFunc();
     bool InitializedSuccessful()const { return m_initialized; }
-    void Start();
+    //Decodes and demuxes on threads of their own, or as tasks of scheduler if not NULL.
+    //A PushInput's demuxer always gets its own thread, its reads wait for the data to arrive.
+    void Start(PlayerScheduler* scheduler = NULL);
     void AddListener(DecodingThreadListener* listener);
     void RemoveListener(DecodingThreadListener* listener);
     void Play();
     void Pause();
     void Stop();
-    void Seek(int64_t timeInMilliseconds);
+    //Only the newest target counts, a seek waiting or in progress takes it over and
+    //restarts from it before its next packet. A preview seek shows the keyframe the
+    //demuxer lands on at once and decodes the exact frame when the target settled.
+    void Seek(int64_t timeInMilliseconds, bool preview = false);
     double CurrentTimeBaseSeconds() const;
     int64_t Duration() const;
     AudioDecoder* GetAudioDecoder() const { return m_audioDecoder; }
+    //Read ahead counters, zero for inputs read another way.
+    void GetInputStats(PlayerInputStats& stats) const;
 
     //DecodingThreadListener interface
     void OnError(DecodingThreadErrorCode error);
@@ -104,6 +203,7 @@ public:
     void OnSeekDone();
     void OnVideoEnd();
     void OnFirstFrameDone();
+    void OnPreviewReady();
 };
 
 #endif//DECODINGTHREAD_H
@@ -14,6 +14,8 @@ public:
     virtual void OnVideoEnd() = 0;
     virtual void OnFirstFrameDone() = 0;
     virtual void OnSeekStart() = 0;
+    //A preview seek saved its keyframe as first frame, the exact frame follows with OnSeekDone.
+    virtual void OnPreviewReady() = 0;
 };
 
 #endif//DECODING_THREAD_LISTENER_H
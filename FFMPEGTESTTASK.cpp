@@ -10,7 +10,13 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
 #include <chrono>
+#include <atomic>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -18,6 +24,9 @@ extern "C"{
 }
 #include <SDL.h>
 #include <SDL_thread.h>
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PushInput.h"
 #include "FfmpegPlayer.h"
 
 const char* filePath1 = "tuborg.wmv";
@@ -45,6 +54,8 @@ public:
     int m_frameCounter;
     int seek_counter;
     std::thread m_thread;
+    std::thread m_feedThread;
+    PushInput *m_input;
     FfmpegPlayer *m_player;
     SDL_Window *screen;
     SDL_Renderer *renderer;
@@ -52,9 +63,9 @@ public:
     SDL_AudioSpec wanted_spec;
     SDL_AudioSpec spec;
 
-    std::vector<char> buffer_f;
     bool m_paused;
-    void Go(int x, int y, const char* filename)
+    //scheduler runs the player on threads shared with the other players, NULL gives it threads of its own.
+    void Go(int x, int y, const char* filename, PlayerScheduler* scheduler = NULL)
     {
         m_paused = true;
         m_frameCounter = 0;
@@ -64,16 +75,41 @@ public:
         m_finished = false;
         m_rendererInitialized = false;
         buffer = NULL;
+        m_input = NULL;
         m_player = new FfmpegPlayer();
-        std::ifstream file(filename, std::ios::binary);
-        file.seekg(0, std::ios::end);
-        std::streamsize size = file.tellg();
-        file.seekg(0, std::ios::beg);
-
-        buffer_f = std::vector<char>(size);
-        if (file.read(buffer_f.data(), size)){
-            m_player->Initialize( (uint8_t*)buffer_f.data(), (int64_t)size, this);
-        }
+        m_player->SetMappedFileInput(true);
+        m_player->SetScheduler(scheduler);
+        m_player->Initialize(filename, this);
+    }
+
+    //Plays the file while a thread feeds it in at bytesPerSecond, like a download would.
+    void GoStreamed(int x, int y, const char* filename, int bytesPerSecond)
+    {
+        m_paused = true;
+        m_frameCounter = 0;
+        seek_counter = 100;
+        m_x = x;
+        m_y = y;
+        m_finished = false;
+        m_rendererInitialized = false;
+        buffer = NULL;
+        m_player = new FfmpegPlayer();
+        m_input = new PushInput();
+        std::string path(filename);
+        m_feedThread = std::thread([this, path, bytesPerSecond]
+        {
+            std::ifstream file(path, std::ios::binary);
+            std::vector<char> chunk(64 * 1024);
+            int64_t chunkMillis = (int64_t)chunk.size() * 1000 / bytesPerSecond;
+            while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0)
+            {
+                if (!m_input->Push((uint8_t*)chunk.data(), (int)file.gcount()))
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(chunkMillis));
+            }
+            m_input->Finish();
+        });
+        m_player->Initialize(m_input, this);
     }
 
     void seek(int time)
@@ -161,15 +197,21 @@ public:
                 SDL_PIXELFORMAT_BGR888,
                 SDL_TEXTUREACCESS_STREAMING,
                 m_frameWidth, m_frameHeight);
-            m_bufferSize = m_frameWidth * m_frameHeight * 4 * sizeof(uint8_t);
-            buffer = new uint8_t[m_bufferSize];
             m_rendererInitialized = true;
             SDL_PauseAudio(0);
         }
         //std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(80));
-        if (m_player->GetAvailableFrame(&buffer, m_bufferSize))
+        //The frame is written straight into the texture, no intermediate buffer.
+        void* pixels = NULL;
+        int pitch = 0;
+        if (SDL_LockTexture(sdlTexture, NULL, &pixels, &pitch) != 0)
+            return;
+        uint8_t* data[4] = { (uint8_t*)pixels, NULL, NULL, NULL };
+        int linesize[4] = { pitch, 0, 0, 0 };
+        bool frameWritten = m_player->GetAvailableFrame(data, linesize, m_frameWidth, m_frameHeight);
+        SDL_UnlockTexture(sdlTexture);
+        if (frameWritten)
         {
-            SDL_UpdateTexture(sdlTexture, NULL, buffer, m_frameWidth*sizeof(uint8_t)* 4);
             SDL_RenderClear(renderer);
             SDL_RenderCopy(renderer, sdlTexture, NULL, NULL);
             SDL_RenderPresent(renderer);
@@ -193,6 +235,9 @@ public:
     void Free()
     {
         delete m_player;
+        if (m_feedThread.joinable())
+            m_feedThread.join();
+        delete m_input;
     }
 };
 
@@ -202,14 +247,17 @@ public:
 int _tmain(int argc, _TCHAR* argv[])
 {
     int counter=0;
+    //One thread per core for all the players below, declared first so it outlives them.
+    PlayerScheduler scheduler;
     MainClass cl1, cl2, cl3, cl4, cl5, cl6, cl7, cl8, cl9, cl10, cl11, cl12, cl13, cl14, cl15, cl16;
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
         fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
         exit(1);
     }
-    cl1.Go(50,50,filePath1);
-    //cl2.Go(100,100,filePath2);
-    //cl3.Go(150,150,filePath3);
+    cl1.Go(50,50,filePath1, &scheduler);
+    //cl2.Go(100,100,filePath2, &scheduler);
+    //cl3.Go(150,150,filePath3, &scheduler);
+    //cl4.GoStreamed(200, 200, filePath1, 512 * 1024);
     /*cl4.Go(75, 75);
     cl5.Go(100, 100);*/
     bool finished = false;
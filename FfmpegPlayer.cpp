@@ -5,29 +5,49 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
 #include <chrono>
+#include <atomic>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 }
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PlayerMemoryPool.h"
 #include "AVPacketQueue.h"
 #include "FrameQueueManager.h"
 #include "DecodingThread.h"
 #include "ShowingThread.h"
+#include "ReadAheadFile.h"
 #include "FfmpegPlayer.h"
 
-#define WORKING_THREAD_WAIT_TIME 40
+#define AUDIO_QUEUE_MAX_BYTES (512 * 1024)
+#define AUDIO_QUEUE_MAX_DURATION 3000
+#define VIDEO_QUEUE_MAX_BYTES (8 * 1024 * 1024)
+#define VIDEO_QUEUE_MAX_DURATION 2000
+#define PACKET_QUEUE_MAX_PACKETS 512
 //External Interface to interact with player.
 
 std::recursive_mutex FfmpegPlayer::s_globalContextGuard;
 bool FfmpegPlayer::s_commonInitialized = false;
 
-FfmpegPlayer::FfmpegPlayer(bool sendAsyncCallbacks /* = true*/) : m_decodingThread(NULL),
+FfmpegPlayer::FfmpegPlayer(bool sendAsyncCallbacks /* = true*/) :
+    m_workingTask(m_signal, [this](int64_t& delay) { return this->WorkingStep(delay); }),
+    m_scheduler(NULL),
+    m_decodingThread(NULL),
     m_showingThread(NULL),
     m_audioPacketQueue(NULL),
+    m_videoPacketQueue(NULL),
     m_frameQueueManager(NULL),
+    m_memoryPool(NULL),
     m_listener(NULL),
+    m_events(!sendAsyncCallbacks),
     m_currentTask(FfmpegPlayerTaskType::None),
     m_Ok(true),
     m_decodingThreadPlaying(false),
@@ -36,7 +56,17 @@ FfmpegPlayer::FfmpegPlayer(bool sendAsyncCallbacks /* = true*/) : m_decodingThre
     m_isLooped(false),
     m_decodingThreadReachedEOF(false),
     m_fileEnded(false),
-    m_reportPlay(false)
+    m_playConfirmPending(false),
+    m_reportPlay(false),
+    m_decodeThreads(0),
+    m_conversionThreads(0),
+    m_outputWidth(0),
+    m_outputHeight(0),
+    m_minFrameQueueDepth(FRAME_QUEUE_MIN_DEPTH),
+    m_maxFrameQueueDepth(FRAME_QUEUE_MAX_DEPTH),
+    m_mapInputFile(false),
+    m_inputBufferSize(0),
+    m_readAheadBytes(READ_AHEAD_DEFAULT_WINDOW)
 {
 
 }
@@ -46,7 +76,8 @@ FfmpegPlayer::~FfmpegPlayer()
     m_mutex.lock();
     m_destroying = true;
     m_mutex.unlock();
-    m_workingThread.join();
+    m_signal.Notify();
+    m_workingTask.Stop();
 
     if (m_showingThread != NULL)
         delete m_showingThread;
@@ -58,6 +89,8 @@ FfmpegPlayer::~FfmpegPlayer()
         delete m_audioPacketQueue;
     if (m_videoPacketQueue != NULL)
         delete m_videoPacketQueue;
+    if (m_memoryPool != NULL)
+        delete m_memoryPool;
 }
 
 bool FfmpegPlayer::Initialize(const char* filePath, FfmpegPlayerListener* listener, AVPixelFormat format /*= PIX_FMT_RGBA*/)
@@ -72,18 +105,20 @@ bool FfmpegPlayer::Initialize(const char* filePath, FfmpegPlayerListener* listen
         s_commonInitialized = true;
     }
     m_currentTask = FfmpegPlayerTask(FfmpegPlayerTaskType::Initialize);
-    m_audioPacketQueue = new AVPacketQueue(1000);
-    m_videoPacketQueue = new AVPacketQueue(10000);
-    m_frameQueueManager = new FrameQueueManager(4, format);
-    m_decodingThread = new DecodingThread(filePath, m_frameQueueManager, m_audioPacketQueue, m_videoPacketQueue);
+    m_memoryPool = new PlayerMemoryPool();
+    m_audioPacketQueue = new AVPacketQueue(m_memoryPool, AUDIO_QUEUE_MAX_BYTES, AUDIO_QUEUE_MAX_DURATION, PACKET_QUEUE_MAX_PACKETS);
+    m_videoPacketQueue = new AVPacketQueue(m_memoryPool, VIDEO_QUEUE_MAX_BYTES, VIDEO_QUEUE_MAX_DURATION, PACKET_QUEUE_MAX_PACKETS);
+    m_frameQueueManager = new FrameQueueManager(m_minFrameQueueDepth, m_maxFrameQueueDepth, format, m_memoryPool, m_scheduler);
+    m_frameQueueManager->SetConversionThreads(ConversionThreadsToUse());
+    m_frameQueueManager->SetOutputSize(m_outputWidth, m_outputHeight);
+    m_decodingThread = new DecodingThread(filePath, m_frameQueueManager, m_audioPacketQueue, m_videoPacketQueue, m_memoryPool, DecodeThreadsToUse(),
+        m_seekIndexCacheDirectory.empty() ? NULL : m_seekIndexCacheDirectory.c_str(), m_mapInputFile, m_inputBufferSize, m_readAheadBytes);
     if (!m_decodingThread->InitializedSuccessful())
         return false;
     m_showingThread = new ShowingThread(m_decodingThread, m_frameQueueManager,m_decodingThread->GetAudioDecoder());
     m_decodingThread->AddListener(this);
     m_showingThread->AddListener(this);
-    m_workingThread = std::thread([this] { this->WorkingThread(); });
-    m_decodingThread->Start();
-    m_showingThread->Start();
+    StartThreads();
     return true;
 }
 
@@ -99,18 +134,48 @@ bool FfmpegPlayer::Initialize(uint8_t* buffer, int64_t bufferSize, FfmpegPlayerL
         s_commonInitialized = true;
     }
     m_currentTask = FfmpegPlayerTask(FfmpegPlayerTaskType::Initialize);
-    m_audioPacketQueue = new AVPacketQueue(1000);
-    m_videoPacketQueue = new AVPacketQueue(10000);
-    m_frameQueueManager = new FrameQueueManager(4, format);
-    m_decodingThread = new DecodingThread(buffer, bufferSize, m_frameQueueManager, m_audioPacketQueue, m_videoPacketQueue);
+    m_memoryPool = new PlayerMemoryPool();
+    m_audioPacketQueue = new AVPacketQueue(m_memoryPool, AUDIO_QUEUE_MAX_BYTES, AUDIO_QUEUE_MAX_DURATION, PACKET_QUEUE_MAX_PACKETS);
+    m_videoPacketQueue = new AVPacketQueue(m_memoryPool, VIDEO_QUEUE_MAX_BYTES, VIDEO_QUEUE_MAX_DURATION, PACKET_QUEUE_MAX_PACKETS);
+    m_frameQueueManager = new FrameQueueManager(m_minFrameQueueDepth, m_maxFrameQueueDepth, format, m_memoryPool, m_scheduler);
+    m_frameQueueManager->SetConversionThreads(ConversionThreadsToUse());
+    m_frameQueueManager->SetOutputSize(m_outputWidth, m_outputHeight);
+    m_decodingThread = new DecodingThread(buffer, bufferSize, m_frameQueueManager, m_audioPacketQueue, m_videoPacketQueue, m_memoryPool, DecodeThreadsToUse(),
+        m_seekIndexCacheDirectory.empty() ? NULL : m_seekIndexCacheDirectory.c_str(), m_inputBufferSize);
     if (!m_decodingThread->InitializedSuccessful())
         return false;
     m_showingThread = new ShowingThread(m_decodingThread, m_frameQueueManager, m_decodingThread->GetAudioDecoder());
     m_decodingThread->AddListener(this);
     m_showingThread->AddListener(this);
-    m_workingThread = std::thread([this] { this->WorkingThread(); });
-    m_decodingThread->Start();
-    m_showingThread->Start();
+    StartThreads();
+    return true;
+}
+
+bool FfmpegPlayer::Initialize(PushInput* input, FfmpegPlayerListener* listener, AVPixelFormat format /*= PIX_FMT_RGBA*/)
+{
+    if (input == NULL || listener == NULL)
+        return false;
+    m_listener = listener;
+    ScopedLock lock(s_globalContextGuard);
+    if (!s_commonInitialized)
+    {
+        av_register_all();
+        s_commonInitialized = true;
+    }
+    m_currentTask = FfmpegPlayerTask(FfmpegPlayerTaskType::Initialize);
+    m_memoryPool = new PlayerMemoryPool();
+    m_audioPacketQueue = new AVPacketQueue(m_memoryPool, AUDIO_QUEUE_MAX_BYTES, AUDIO_QUEUE_MAX_DURATION, PACKET_QUEUE_MAX_PACKETS);
+    m_videoPacketQueue = new AVPacketQueue(m_memoryPool, VIDEO_QUEUE_MAX_BYTES, VIDEO_QUEUE_MAX_DURATION, PACKET_QUEUE_MAX_PACKETS);
+    m_frameQueueManager = new FrameQueueManager(m_minFrameQueueDepth, m_maxFrameQueueDepth, format, m_memoryPool, m_scheduler);
+    m_frameQueueManager->SetConversionThreads(ConversionThreadsToUse());
+    m_frameQueueManager->SetOutputSize(m_outputWidth, m_outputHeight);
+    m_decodingThread = new DecodingThread(input, m_frameQueueManager, m_audioPacketQueue, m_videoPacketQueue, m_memoryPool, DecodeThreadsToUse(), m_inputBufferSize);
+    if (!m_decodingThread->InitializedSuccessful())
+        return false;
+    m_showingThread = new ShowingThread(m_decodingThread, m_frameQueueManager, m_decodingThread->GetAudioDecoder());
+    m_decodingThread->AddListener(this);
+    m_showingThread->AddListener(this);
+    StartThreads();
     return true;
 }
 
@@ -119,6 +184,7 @@ void FfmpegPlayer::Stop()
     ScopedLock lock(m_mutex);
     m_isLooped = false;
     m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Stop));
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::Pause()
@@ -128,6 +194,7 @@ void FfmpegPlayer::Pause()
         return;
     m_isLooped = false;
     m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Pause));
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::Play(bool loop/* = false*/)
@@ -138,15 +205,43 @@ void FfmpegPlayer::Play(bool loop/* = false*/)
         m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Stop));
     m_isLooped = loop;
     m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Play));
+    m_signal.Notify();
 }
 
-void FfmpegPlayer::Seek(int64_t timeMilliceconds)
+void FfmpegPlayer::Seek(int64_t timeMilliceconds, FfmpegPlayerSeekMode mode /*= FfmpegPlayerSeekMode::Exact*/)
 {
+    bool preview = mode == FfmpegPlayerSeekMode::Preview;
     ScopedLock lock(m_mutex);
+    //While scrubbing only the newest target matters. A seek still waiting takes it over,
+    //plays queued after it stay. So does the seek in progress, the decoding thread leaves
+    //the old target at the next packet and reports the seek done once.
+    auto pending = m_taskQueue.rbegin();
+    while (pending != m_taskQueue.rend() && pending->m_type == FfmpegPlayerTaskType::Play)
+        ++pending;
+    if (pending != m_taskQueue.rend())
+    {
+        if (pending->m_type == FfmpegPlayerTaskType::Seek)
+        {
+            pending->m_time = timeMilliceconds;
+            pending->m_preview = preview;
+            return;
+        }
+    }
+    else if (m_currentTask.m_type == FfmpegPlayerTaskType::Seek && !m_currentTask.m_reported)
+    {
+        m_currentTask.m_time = timeMilliceconds;
+        m_currentTask.m_preview = preview;
+        m_currentTask.m_decodingThreadConfirmation = false;
+        m_currentTask.m_showingThreadConfirmation = false;
+        m_decodingThread->Seek(timeMilliceconds, preview);
+        return;
+    }
     m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Seek));
     m_taskQueue.back().m_time = timeMilliceconds;
+    m_taskQueue.back().m_preview = preview;
     if (m_decodingThreadPlaying && m_showingThread->IsPlaying())
         m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Play));
+    m_signal.Notify();
 }
 
 int64_t FfmpegPlayer::GetDuration() const
@@ -161,23 +256,111 @@ int64_t FfmpegPlayer::GetPlaybackTime() const
     return m_showingThread->GetPlayBackTime();
 }
 
+void FfmpegPlayer::SetDecodeThreads(int threads)
+{
+    m_decodeThreads = threads < 0 ? 0 : threads;
+}
+
+void FfmpegPlayer::SetConversionThreads(int threads)
+{
+    m_conversionThreads = threads < 0 ? 0 : threads;
+    if (m_frameQueueManager != NULL)
+        m_frameQueueManager->SetConversionThreads(ConversionThreadsToUse());
+}
+
+void FfmpegPlayer::SetOutputSize(int width, int height)
+{
+    m_outputWidth = width > 0 && height > 0 ? width : 0;
+    m_outputHeight = width > 0 && height > 0 ? height : 0;
+    if (m_frameQueueManager != NULL)
+        m_frameQueueManager->SetOutputSize(m_outputWidth, m_outputHeight);
+}
+
+void FfmpegPlayer::SetFrameQueueDepth(int minFrames, int maxFrames)
+{
+    //One frame on screen and one ready is the least that plays.
+    m_minFrameQueueDepth = minFrames < 2 ? 2 : minFrames;
+    m_maxFrameQueueDepth = maxFrames < m_minFrameQueueDepth ? m_minFrameQueueDepth : maxFrames;
+}
+
+void FfmpegPlayer::SetSeekIndexCacheDirectory(const char* directory)
+{
+    m_seekIndexCacheDirectory = directory != NULL ? directory : "";
+}
+
+void FfmpegPlayer::SetMappedFileInput(bool mapped)
+{
+    m_mapInputFile = mapped;
+}
+
+void FfmpegPlayer::SetReadAhead(int bytes)
+{
+    m_readAheadBytes = bytes < 0 ? 0 : bytes;
+}
+
+void FfmpegPlayer::SetInputBufferSize(int bytes)
+{
+    m_inputBufferSize = bytes < 0 ? 0 : bytes;
+}
+
+void FfmpegPlayer::SetScheduler(PlayerScheduler* scheduler)
+{
+    m_scheduler = scheduler;
+}
+
+int FfmpegPlayer::DecodeThreadsToUse() const
+{
+    //Frame threads of many players would oversubscribe the cores the scheduler is sized to.
+    return m_scheduler != NULL && m_decodeThreads == 0 ? 1 : m_decodeThreads;
+}
+
+int FfmpegPlayer::ConversionThreadsToUse() const
+{
+    return m_scheduler != NULL && m_conversionThreads == 0 ? 1 : m_conversionThreads;
+}
+
+void FfmpegPlayer::StartThreads()
+{
+    m_workingTask.Start(m_scheduler);
+    m_decodingThread->Start(m_scheduler);
+    m_showingThread->Start(m_scheduler);
+}
+
+void FfmpegPlayer::GetAllocationStats(PlayerAllocationStats& stats) const
+{
+    if (m_memoryPool == NULL)
+    {
+        memset(&stats, 0, sizeof(stats));
+        return;
+    }
+    m_memoryPool->GetStats(stats);
+}
+
+void FfmpegPlayer::GetInputStats(PlayerInputStats& stats) const
+{
+    if (m_decodingThread == NULL)
+    {
+        memset(&stats, 0, sizeof(stats));
+        return;
+    }
+    m_decodingThread->GetInputStats(stats);
+}
+
 void FfmpegPlayer::GetFrameSize(int& width, int& height) const
 {
     width = m_showingThread->GetCurrentFrameSize().first;
     height = m_showingThread->GetCurrentFrameSize().second;
 }
 
-void FfmpegPlayer::SendEvents()
+bool FfmpegPlayer::IsShowingPreview() const
 {
-    {
-        ScopedLock lock(m_mutex);
-        if (m_eventQueue.empty())
-            return;
-        m_sendingEventQueue.clear();
-        m_sendingEventQueue.swap(m_eventQueue);
-    }
+    return m_showingThread->IsShowingPreview();
+}
 
-    for (auto event : m_sendingEventQueue)
+void FfmpegPlayer::SendEvents()
+{
+    FfmpegPlayerEvent event(FfmpegPlayerEventType::Initialized, 0);
+    while (m_events.Pop(event))
     {
         switch (event.m_type)
         {
@@ -202,6 +385,9 @@ void FfmpegPlayer::SendEvents()
             if (!m_isLooped)
                 m_listener->SeekDone(event.m_data);
             break;
+        case FfmpegPlayerEventType::PreviewShown:
+            m_listener->PreviewShown(event.m_data);
+            break;
         case FfmpegPlayerEventType::NextFrameAvailable:
             m_listener->NextFrameAvailable();
             break;
@@ -212,6 +398,7 @@ void FfmpegPlayer::SendEvents()
                 ScopedLock lock(m_mutex);
                 m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Stop));
                 m_taskQueue.push_back(FfmpegPlayerTask(FfmpegPlayerTaskType::Play));
+                m_signal.Notify();
             }
             break;
         case FfmpegPlayerEventType::Error:
@@ -221,79 +408,89 @@ void FfmpegPlayer::SendEvents()
     }
 }
 
+intptr_t FfmpegPlayer::GetEventHandle() const
+{
+    return m_events.GetWakeHandle();
+}
+
+void FfmpegPlayer::PushEvent(FfmpegPlayerEventType type, int64_t data)
+{
+    //Nothing to wake for an event coalesced into one still waiting.
+    if (m_events.Push(type, data) && m_sendAsyncCallbacks)
+        m_signal.Notify();
+}
+
 
 //Internal working function
-void FfmpegPlayer::WorkingThread()
+StepResult FfmpegPlayer::WorkingStep(int64_t& delay)
 {
-    while (1)
+    m_mutex.lock();
+    if (m_destroying)
+    {
+        m_mutex.unlock();
+        return StepResult::finished;
+    }
+    if (m_sendAsyncCallbacks)
     {
+        m_mutex.unlock();
+        SendEvents();
         m_mutex.lock();
-        if (m_destroying)
-        {
-            m_mutex.unlock();
-            return;
-        }
-        if (m_sendAsyncCallbacks)
-        {
-            m_mutex.unlock();
-            SendEvents();
-            m_mutex.lock();
-        }
+    }
 
-        if (m_currentTask.m_type == FfmpegPlayerTaskType::None || m_currentTask.IsDone())
+    if (m_currentTask.m_type == FfmpegPlayerTaskType::None || m_currentTask.IsDone())
+    {
+        if (!m_currentTask.m_reported)
         {
-            if (!m_currentTask.m_reported)
+            switch (m_currentTask.m_type)
             {
-                switch (m_currentTask.m_type)
-                {
-                case FfmpegPlayerTaskType::Initialize:
-                    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Initialized, 0));
-                    //m_listener->Initialized();
-                    break;
-                case FfmpegPlayerTaskType::Play:
-                    //m_listener->Playing();
-                    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Playing, 0));
-                    break;
-                case FfmpegPlayerTaskType::Pause:
-                    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Paused, 0));
-                    //m_listener->Paused();
-                    break;
-                case FfmpegPlayerTaskType::Stop:
-                    //m_listener->Stopped();
-                    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Paused, 0));
-                    break;
-                case FfmpegPlayerTaskType::Seek:
-                    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::SeekDone, m_showingThread->GetPlayBackTime()));
-                    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Paused, 0));
-                    //m_listener->SeekDone(m_currentTask.m_time);
-                    break;
-                }
-                m_currentTask.m_reported = true;
+            case FfmpegPlayerTaskType::Initialize:
+                PushEvent(FfmpegPlayerEventType::Initialized, 0);
+                //m_listener->Initialized();
+                break;
+            case FfmpegPlayerTaskType::Play:
+                //m_listener->Playing();
+                PushEvent(FfmpegPlayerEventType::Playing, 0);
+                break;
+            case FfmpegPlayerTaskType::Pause:
+                PushEvent(FfmpegPlayerEventType::Paused, 0);
+                //m_listener->Paused();
+                break;
+            case FfmpegPlayerTaskType::Stop:
+                //m_listener->Stopped();
+                PushEvent(FfmpegPlayerEventType::Paused, 0);
+                break;
+            case FfmpegPlayerTaskType::Seek:
+                PushEvent(FfmpegPlayerEventType::SeekDone, m_showingThread->GetPlayBackTime());
+                PushEvent(FfmpegPlayerEventType::Paused, 0);
+                //m_listener->SeekDone(m_currentTask.m_time);
+                break;
             }
-            if (!m_taskQueue.empty())
+            m_currentTask.m_reported = true;
+        }
+        if (!m_taskQueue.empty())
+        {
+            m_currentTask = m_taskQueue.front();
+            m_taskQueue.pop_front();
+            m_playConfirmPending = m_currentTask.m_type == FfmpegPlayerTaskType::Play;
+            switch (m_currentTask.m_type)
             {
-                m_currentTask = m_taskQueue.front();
-                m_taskQueue.pop_front();
-                switch (m_currentTask.m_type)
-                {
-                case FfmpegPlayerTaskType::Play:
-                    m_decodingThread->Play();
-                    break;
-                case FfmpegPlayerTaskType::Pause:
-                    m_decodingThread->Pause();
-                    break;
-                case FfmpegPlayerTaskType::Stop:
-                    m_decodingThread->Stop();
-                    break;
-                case FfmpegPlayerTaskType::Seek:
-                    m_decodingThread->Seek(m_currentTask.m_time);
-                    break;
-                }
+            case FfmpegPlayerTaskType::Play:
+                m_decodingThread->Play();
+                break;
+            case FfmpegPlayerTaskType::Pause:
+                m_decodingThread->Pause();
+                break;
+            case FfmpegPlayerTaskType::Stop:
+                m_decodingThread->Stop();
+                break;
+            case FfmpegPlayerTaskType::Seek:
+                m_decodingThread->Seek(m_currentTask.m_time, m_currentTask.m_preview);
+                break;
             }
         }
-        m_mutex.unlock();
-        std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(WORKING_THREAD_WAIT_TIME));
     }
+    m_mutex.unlock();
+    return StepResult::wait;
 }
 
 bool FfmpegPlayer::GetAvailableFrame(uint8_t** buffer, int32_t& bufferSize)
@@ -301,6 +498,37 @@ bool FfmpegPlayer::GetAvailableFrame(uint8_t** buffer, int32_t& bufferSize)
     return m_showingThread->GetCurrentFrame(buffer, bufferSize);
 }
 
+bool FfmpegPlayer::GetAvailableFrame(uint8_t* const data[4], const int linesize[4], int width, int height)
+{
+    return m_showingThread->GetCurrentFrame(data, linesize, width, height);
+}
+
+bool FfmpegPlayer::AcquireFrame(PlayerFramePlanes& planes)
+{
+    InternalFrame* frame = m_showingThread->AcquireCurrentFrame();
+    if (frame == NULL)
+    {
+        memset(&planes, 0, sizeof(planes));
+        planes.format = AV_PIX_FMT_NONE;
+        return false;
+    }
+    planes.preview = frame->IsPreview();
+    frame->GetPlanes(planes.data, planes.linesize, planes.format);
+    planes.width = frame->GetFrameSize().first;
+    planes.height = frame->GetFrameSize().second;
+    planes.presentationTime = frame->GetPresentationTime();
+    planes.frame = frame;
+    return true;
+}
+
+void FfmpegPlayer::ReleaseFrame(PlayerFramePlanes& planes)
+{
+    if (planes.frame == NULL)
+        return;
+    m_showingThread->ReleaseFrame(planes.frame);
+    planes.frame = NULL;
+}
+
 void FfmpegPlayer::GetSound(uint8_t* buffer, int32_t bufferSize)
 {
     m_showingThread->GetSound(buffer,bufferSize);
@@ -318,7 +546,8 @@ void FfmpegPlayer::OnError(DecodingThreadErrorCode error)
     ScopedLock lock(m_mutex);
     m_decodingThreadPlaying = false;
     m_Ok = false;
-    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Error, DecodingThreadErrorCodeToInt(error)));
+    PushEvent(FfmpegPlayerEventType::Error, DecodingThreadErrorCodeToInt(error));
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnFrameReady()
@@ -327,6 +556,7 @@ void FfmpegPlayer::OnFrameReady()
     m_decodingThreadPlaying = true;
     if (m_currentTask.m_type == FfmpegPlayerTaskType::Play)
         m_currentTask.m_decodingThreadConfirmation = true;
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnPaused()
@@ -337,6 +567,7 @@ void FfmpegPlayer::OnPaused()
         m_currentTask.m_decodingThreadConfirmation = true;
         m_currentTask.m_showingThreadConfirmation = !m_showingThread->IsPlaying();
     }
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnStopped()
@@ -350,6 +581,7 @@ void FfmpegPlayer::OnStopped()
         if (!m_showingThread->IsPlaying())
             m_currentTask.m_showingThreadConfirmation = true;
     }
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnSeekStart()
@@ -357,6 +589,14 @@ void FfmpegPlayer::OnSeekStart()
     ScopedLock lock(m_mutex);
     m_fileEnded = false;
     m_decodingThreadPlaying = false;
+    //A retargeted seek that the decoding thread had finished already starts over,
+    //the first frame of the old target must not confirm it.
+    if (m_currentTask.m_type == FfmpegPlayerTaskType::Seek)
+    {
+        m_currentTask.m_decodingThreadConfirmation = false;
+        m_currentTask.m_showingThreadConfirmation = false;
+    }
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnSeekDone()
@@ -366,6 +606,7 @@ void FfmpegPlayer::OnSeekDone()
     m_fileEnded = false;
     if (m_currentTask.m_type == FfmpegPlayerTaskType::Seek)
         m_currentTask.m_decodingThreadConfirmation = true;
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnVideoEnd()
@@ -378,7 +619,7 @@ void FfmpegPlayer::OnVideoEnd()
         if (m_currentTask.IsDone() && !m_currentTask.m_reported)
         {
             //m_listener->Playing();
-            m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Playing, 0));
+            PushEvent(FfmpegPlayerEventType::Playing, 0);
             m_currentTask.m_reported = true;
         }
     }
@@ -386,9 +627,10 @@ void FfmpegPlayer::OnVideoEnd()
     m_decodingThreadReachedEOF = true;
     m_fileEnded = true;
     if (!m_showingThread->IsPlaying()){
-        m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::FileEnded, 0));
+        PushEvent(FfmpegPlayerEventType::FileEnded, 0);
         m_decodingThreadReachedEOF = false;
     }
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnFirstFrameDone()
@@ -399,6 +641,12 @@ void FfmpegPlayer::OnFirstFrameDone()
     {
         m_currentTask.m_decodingThreadConfirmation = true;
     }
+    m_signal.Notify();
+}
+
+void FfmpegPlayer::OnPreviewReady()
+{
+    //The showing thread puts it on screen, the seek stays unconfirmed until the exact frame.
 }
 
 //ShowingThreadListener interface
@@ -411,8 +659,8 @@ void FfmpegPlayer::OnFirstFrameShown()
         if (m_currentTask.IsDone() && !m_currentTask.m_reported)
         {
             //m_listener->SeekDone(m_currentTask.m_time);
-            m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::SeekDone, m_showingThread->GetPlayBackTime()));
-            m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Paused, 0));
+            PushEvent(FfmpegPlayerEventType::SeekDone, m_showingThread->GetPlayBackTime());
+            PushEvent(FfmpegPlayerEventType::Paused, 0);
             m_currentTask.m_reported = true;
         }
     }
@@ -422,19 +670,20 @@ void FfmpegPlayer::OnFirstFrameShown()
         if (m_currentTask.IsDone() && !m_currentTask.m_reported)
         {
             //m_listener->Initialized();
-            m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Initialized,0));
+            PushEvent(FfmpegPlayerEventType::Initialized,0);
             m_currentTask.m_reported = true;
         }
     }
     //m_listener->NextFrameAvailable();
-    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::NextFrameAvailable, 0));
+    PushEvent(FfmpegPlayerEventType::NextFrameAvailable, 0);
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnNoMoreFrames()
 {
     ScopedLock lock(m_mutex);
     if (m_decodingThreadReachedEOF){
-        m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::FileEnded, 0));
+        PushEvent(FfmpegPlayerEventType::FileEnded, 0);
         m_decodingThreadReachedEOF = false;
     }
     if (m_currentTask.m_type == FfmpegPlayerTaskType::Pause || m_currentTask.m_type == FfmpegPlayerTaskType::Stop)
@@ -443,24 +692,31 @@ void FfmpegPlayer::OnNoMoreFrames()
     }
     else if (!m_decodingThreadPlaying)
     {
-        m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Paused, 0));
+        PushEvent(FfmpegPlayerEventType::Paused, 0);
     }
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnFrameShown()
 {
-    ScopedLock lock(m_mutex);
-    if (m_currentTask.m_type == FfmpegPlayerTaskType::Play)
+    if (m_playConfirmPending)
     {
-        m_currentTask.m_showingThreadConfirmation = true;
-        if (m_currentTask.IsDone() && !m_currentTask.m_reported)
+        ScopedLock lock(m_mutex);
+        m_playConfirmPending = false;
+        if (m_currentTask.m_type == FfmpegPlayerTaskType::Play)
         {
-            //m_listener->Playing();
-            m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Playing, 0));
-            m_currentTask.m_reported = true;
+            m_currentTask.m_showingThreadConfirmation = true;
+            if (m_currentTask.IsDone() && !m_currentTask.m_reported)
+            {
+                //m_listener->Playing();
+                PushEvent(FfmpegPlayerEventType::Playing, 0);
+                m_currentTask.m_reported = true;
+            }
+            m_signal.Notify();
         }
     }
-    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::NextFrameAvailable, 0));
+    //Per frame, so it neither locks nor wakes the working thread while the last one is unread.
+    PushEvent(FfmpegPlayerEventType::NextFrameAvailable, 0);
     //m_listener->NextFrameAvailable();
 }
 
@@ -469,10 +725,17 @@ void FfmpegPlayer::OnShowingError()
     ScopedLock lock(m_mutex);
     m_decodingThread->Pause();
     m_Ok = false;
-    m_eventQueue.push_back(FfmpegPlayerEvent(FfmpegPlayerEventType::Error, -3));
+    PushEvent(FfmpegPlayerEventType::Error, -3);
+    m_signal.Notify();
 }
 
 void FfmpegPlayer::OnStartPlaying()
 {
 
 }
+
+void FfmpegPlayer::OnPreviewShown()
+{
+    PushEvent(FfmpegPlayerEventType::PreviewShown, m_showingThread->GetPlayBackTime());
+    PushEvent(FfmpegPlayerEventType::NextFrameAvailable, 0);
+}
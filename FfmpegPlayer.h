@@ -3,6 +3,7 @@
 
 #include "DecodingThreadListener.h"
 #include "ShowingThreadListener.h"
+#include "PlayerEventRing.h"
 
 class FfmpegPlayerListener
 {
@@ -15,6 +16,15 @@ public:
     virtual void NextFrameAvailable() = 0;
     virtual void FileEnded() = 0;
     virtual void Error(int64_t errorCode) = 0;
+    //The keyframe near the target of a FfmpegPlayerSeekMode::Preview seek is on screen,
+    //SeekDone follows once the exact frame replaced it.
+    virtual void PreviewShown(int64_t timeMilliceconds) {}
+};
+
+enum class FfmpegPlayerSeekMode
+{
+    Exact,  //the frame at the target is the first one shown
+    Preview //the nearest keyframe is shown at once, the exact frame when the target held still
 };
 
 enum class FfmpegPlayerTaskType
@@ -34,18 +44,21 @@ public:
     bool m_decodingThreadConfirmation;
     bool m_showingThreadConfirmation;
     bool m_reported;
+    bool m_preview;
     int64_t m_time;
 
     FfmpegPlayerTask(FfmpegPlayerTaskType type) : m_type(type),
         m_decodingThreadConfirmation(false),
         m_showingThreadConfirmation(false),
         m_reported(false),
+        m_preview(false),
         m_time(0){}
 
     FfmpegPlayerTask(const FfmpegPlayerTask & task) : m_type(task.m_type),
         m_decodingThreadConfirmation(task.m_decodingThreadConfirmation),
         m_showingThreadConfirmation(task.m_showingThreadConfirmation),
         m_reported(task.m_reported),
+        m_preview(task.m_preview),
         m_time(task.m_time){}
 
     ~FfmpegPlayerTask(){}
@@ -53,26 +66,19 @@ public:
     bool IsDone(){ return m_decodingThreadConfirmation && m_showingThreadConfirmation; }
 };
 
-enum class FfmpegPlayerEventType
-{
-    Initialized,
-    Playing,
-    Paused,
-    Stopped,
-    SeekDone,
-    NextFrameAvailable,
-    FileEnded,
-    Error
-};
+class InternalFrame;
 
-class FfmpegPlayerEvent
+//Planes of a frame pinned by FfmpegPlayer::AcquireFrame.
+struct PlayerFramePlanes
 {
-public:
-    FfmpegPlayerEventType m_type;
-    int64_t m_data;
-    FfmpegPlayerEvent(FfmpegPlayerEventType type, int64_t data) : m_type(type), m_data(data) {}
-    FfmpegPlayerEvent(const FfmpegPlayerEvent & event) : m_type(event.m_type), m_data(event.m_data) {}
-    ~FfmpegPlayerEvent(){}
+    uint8_t* data[4];
+    int linesize[4];
+    AVPixelFormat format;
+    int width;
+    int height;
+    int64_t presentationTime;
+    bool preview; //keyframe of a preview seek, not yet the frame at the target
+    InternalFrame* frame; //pinned frame, handed back by FfmpegPlayer::ReleaseFrame
 };
 
 class FrameQueueManager;
@@ -80,24 +86,31 @@ class DecodingThread;
 class ShowingThread;
 class AudioDecoder;
 class AVPacketQueue;
+class PlayerMemoryPool;
+class PushInput;
+class PlayerScheduler;
+struct PlayerAllocationStats;
+struct PlayerInputStats;
 
 class FfmpegPlayer : public DecodingThreadListener, public ShowingThreadListener
 {
 
     static std::recursive_mutex s_globalContextGuard;
     static bool s_commonInitialized;
-    std::thread m_workingThread;
+    ThreadSignal m_signal;
+    ScheduledTask m_workingTask;
+    PlayerScheduler *m_scheduler;
     std::recursive_mutex m_mutex;
     DecodingThread *m_decodingThread;
     ShowingThread *m_showingThread;
     AVPacketQueue *m_audioPacketQueue;
     AVPacketQueue *m_videoPacketQueue;
     FrameQueueManager *m_frameQueueManager;
+    PlayerMemoryPool *m_memoryPool;
     FfmpegPlayerListener *m_listener;
     FfmpegPlayerTask m_currentTask;
     std::list<FfmpegPlayerTask> m_taskQueue;
-    std::list<FfmpegPlayerEvent> m_eventQueue;
-    std::list<FfmpegPlayerEvent> m_sendingEventQueue;
+    PlayerEventRing m_events;
     bool m_Ok;
     bool m_decodingThreadPlaying;
     bool m_destroying;
@@ -106,27 +119,104 @@ class FfmpegPlayer : public DecodingThreadListener, public ShowingThreadListener
     bool m_decodingThreadReachedEOF;
     bool m_reportPlay;
     bool m_fileEnded;
-
+    //The current task is a Play the showing thread has not confirmed yet, lets OnFrameShown
+    //skip m_mutex for every other frame.
+    std::atomic<bool> m_playConfirmPending;
+    int m_decodeThreads;
+    int m_conversionThreads;
+    int m_outputWidth;
+    int m_outputHeight;
+    int m_minFrameQueueDepth;
+    int m_maxFrameQueueDepth;
+    bool m_mapInputFile;
+    int m_inputBufferSize;
+    int m_readAheadBytes;
+    std::string m_seekIndexCacheDirectory;
+
+    void PushEvent(FfmpegPlayerEventType type, int64_t data);
+    //Internal working function
+    StepResult WorkingStep(int64_t& delay);
+    //A player on a scheduler decodes and converts on the thread its task runs on, unless told otherwise.
+    int DecodeThreadsToUse() const;
+    int ConversionThreadsToUse() const;
+    void StartThreads();
 public:
     //External Interface to interact with player.
+    //Without sendAsyncCallbacks the listener is only called from SendEvents.
     FfmpegPlayer(bool sendAsyncCallbacks = true);
     ~FfmpegPlayer();
+    //Video decoder threads, takes effect on Initialize. 0 picks frame or slice threading
+    //automatically within the cores left by the other players of the process.
+    void SetDecodeThreads(int threads);
+    //Slices each frame is converted in at once on the shared worker pool, 0 uses every core.
+    void SetConversionThreads(int threads);
+    //Size frames are scaled to during conversion, e.g. for a small viewport. Can be changed
+    //while playing, GetFrameSize reports the new size once a frame of that size is shown.
+    //0x0 keeps the size of the video. Not applied to AV_PIX_FMT_NONE output.
+    void SetOutputSize(int width, int height);
+    //Decoded frames queued ahead, takes effect on Initialize. The queue starts minFrames
+    //deep and grows up to maxFrames when decode times jitter or playback runs dry.
+    void SetFrameQueueDepth(int minFrames, int maxFrames);
+    //Directory to keep keyframe indexes of opened inputs in, takes effect on Initialize.
+    //Without it the index is rebuilt in the background every time an input is opened.
+    void SetSeekIndexCacheDirectory(const char* directory);
+    //Memory maps the file given to Initialize instead of reading it through ffmpeg, takes effect
+    //on Initialize. Nothing is read up front and players of the same file share its pages, so
+    //there is no reason to load a file into a buffer for the buffer Initialize.
+    void SetMappedFileInput(bool mapped);
+    //Bytes read in the background ahead of the demuxer from a file given to Initialize, so slow
+    //disks and network shares do not stall decoding. Takes effect on Initialize, 0 leaves reading
+    //to ffmpeg. Not used for mapped files.
+    void SetReadAhead(int bytes);
+    //Bytes the demuxer reads at once from a file, a caller's buffer or a PushInput,
+    //takes effect on Initialize. 0 uses the default.
+    void SetInputBufferSize(int bytes);
+    //Runs the player's demuxing, decoding, presenting and events as tasks on a scheduler
+    //shared with other players instead of on threads of its own, takes effect on Initialize.
+    //Decoding and conversion then use one thread each unless SetDecodeThreads and
+    //SetConversionThreads ask for more. The scheduler has to outlive the player.
+    void SetScheduler(PlayerScheduler* scheduler);
+    //AV_PIX_FMT_NONE as format skips conversion, frames keep the decoder's format and size,
+    //e.g. yuv420p for an SDL IYUV texture.
     bool Initialize(const char* filePath, FfmpegPlayerListener* listener, AVPixelFormat format = PIX_FMT_RGBA);
     bool Initialize(uint8_t* buffer, int64_t bufferSize, FfmpegPlayerListener* listener, AVPixelFormat format = PIX_FMT_RGBA);
+    //Plays an input the application pushes from another thread while it arrives. Returns once
+    //its start is in, the input has to outlive the player and is aborted by its destruction.
+    bool Initialize(PushInput* input, FfmpegPlayerListener* listener, AVPixelFormat format = PIX_FMT_RGBA);
     void Stop();
     void Pause();
     void Play(bool loop = false);
-    void Seek(int64_t timeMilliceconds);
+    //Can be called for every move of a timeline drag: a newer target replaces the seek that
+    //waits or runs, and SeekDone is reported for the last one. A Preview seek answers a drag
+    //with the keyframe next to each target, see FfmpegPlayerSeekMode.
+    void Seek(int64_t timeMilliceconds, FfmpegPlayerSeekMode mode = FfmpegPlayerSeekMode::Exact);
     int64_t GetDuration() const;
     int64_t GetPlaybackTime() const;
     void GetFrameSize(int& width, int& height) const;
+    //The frame on screen is a preview, the seek is still refined to its target.
+    bool IsShowingPreview() const;
+    //Heap allocation counters of this player, steady playback should not move them.
+    void GetAllocationStats(PlayerAllocationStats& stats) const;
+    //Read ahead counters, see SetReadAhead.
+    void GetInputStats(PlayerInputStats& stats) const;
     bool GetAvailableFrame(uint8_t** buffer, int32_t& bufferSize);
+    //Writes the current frame, in the format given to Initialize, straight into planes the
+    //caller owns such as a locked texture. Fails without writing when width and height are
+    //not the current frame size, see GetFrameSize.
+    bool GetAvailableFrame(uint8_t* const data[4], const int linesize[4], int width, int height);
+    //Exposes the planes of the current frame without copying them. The frame stays valid,
+    //also across seeks and newer frames, until it is given back with ReleaseFrame, which has
+    //to happen before the player is destroyed.
+    bool AcquireFrame(PlayerFramePlanes& planes);
+    void ReleaseFrame(PlayerFramePlanes& planes);
     void GetSound(uint8_t* buffer, int32_t bufferSize);
     void GetAudioParams(int & channels, int & sampleRate, AVSampleFormat & format);
+    //Calls the listener for the events that arrived since the last call. Only for players made
+    //without sendAsyncCallbacks, from one thread at a time.
     void SendEvents();
-
-    //Internal working function
-    void WorkingThread();
+    //Readable eventfd, or on Windows a signaled event HANDLE, while events wait for SendEvents,
+    //e.g. to add the player to the application's epoll loop. -1 with sendAsyncCallbacks.
+    intptr_t GetEventHandle() const;
 
     //DecodingThreadListener interface
     void OnError(DecodingThreadErrorCode error);
@@ -137,12 +227,14 @@ public:
     void OnSeekDone();
     void OnVideoEnd();
     void OnFirstFrameDone();
+    void OnPreviewReady();
     //ShowingThreadListener interface
     void OnFirstFrameShown();
     void OnNoMoreFrames();
     void OnFrameShown();
     void OnShowingError();
     void OnStartPlaying();
+    void OnPreviewShown();
 };
 
 #endif//FFMPEGPLAYER_H
@@ -5,21 +5,40 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <functional>
 #include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 }
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PlayerMemoryPool.h"
+#include "ColorKernels.h"
+#include "SlicedConverter.h"
 #include "FrameQueueManager.h"
 
-InternalFrame::InternalFrame(AVPixelFormat format) : 
+InternalFrame::InternalFrame(AVPixelFormat format, PlayerMemoryPool *memoryPool) : 
     m_frame(NULL),
     m_presentationTime(0),
     m_buffer(NULL),
     m_frameSize(0,0),
     m_bufferSize(0),
-    m_format(format)
+    m_format(format),
+    m_convertedBuffer(NULL),
+    m_convertedBufferSize(0),
+    m_convertedBufferCapacity(0),
+    m_memoryPool(memoryPool),
+    m_pins(0),
+    m_preview(false)
 {
 
 }
@@ -33,41 +52,102 @@ void InternalFrame::FreeStuff()
 {
     if (m_buffer != NULL)
     {
-        av_free(m_buffer);
-        m_buffer = NULL;
+        m_memoryPool->FreeScratch(&m_buffer);
         m_bufferSize = 0;
     }
+    if (m_convertedBuffer != NULL)
+    {
+        m_memoryPool->FreeScratch(&m_convertedBuffer);
+        m_convertedBufferSize = 0;
+        m_convertedBufferCapacity = 0;
+    }
     if (m_frame != NULL)
     {
-        av_free(m_frame);
-        m_frame = NULL;
+        m_memoryPool->FreeFrame(&m_frame);
         m_frameSize =  FrameSize(0,0);
     }
 }
 
-void InternalFrame::SaveFrame(AVFrame *frame, SwsContext* ctx, double timeBase)
+void InternalFrame::SaveFrame(AVFrame *frame, double timeBase)
 {
-    if (m_frame == NULL){
-        m_frame = av_frame_alloc();
+    m_preview = false;
+    if (m_frame == NULL)
+        m_frame = m_memoryPool->AllocFrame();
+    if (frame->buf[0] != NULL){
+        //Reference counted decoder output is shared, the buffers go back to the decoder in Release().
+        av_frame_unref(m_frame);
+        av_frame_ref(m_frame, frame);
+        m_presentationTime = av_frame_get_best_effort_timestamp(frame) * (timeBase * 1000);
+        m_frameSize = FrameSize(m_frame->width, m_frame->height);
+        return;
+    }
+    //Decoders without reference counting reuse their buffers, so the picture has to be copied.
+    if (m_frame->buf[0] != NULL)
+        av_frame_unref(m_frame);
+    if (m_frame->width != frame->width || m_frame->height != frame->height || m_frame->format != frame->format){
+        //The picture buffer is kept between frames and only reallocated when the stream changes.
         int buff_size = avpicture_get_size((AVPixelFormat)frame->format, frame->width, frame->height);
         if (m_bufferSize != buff_size){
             if (m_buffer != NULL)
-                av_free(m_buffer);
-            m_buffer = (uint8_t *)av_malloc(buff_size);
+                m_memoryPool->FreeScratch(&m_buffer);
+            m_buffer = m_memoryPool->AllocScratch(buff_size);
             m_bufferSize = buff_size;
-            for (int i = 0; i < 8; ++i){
-                m_frame->linesize[i] = frame->linesize[i];
-            }
-            avpicture_fill((AVPicture *)m_frame, m_buffer, (AVPixelFormat)frame->format, frame->width, frame->height);
-            m_frame->format = frame->format;
-            m_frame->width = frame->width;
-            m_frame->height = frame->height;
         }
+        avpicture_fill((AVPicture *)m_frame, m_buffer, (AVPixelFormat)frame->format, frame->width, frame->height);
+        m_frame->format = frame->format;
+        m_frame->width = frame->width;
+        m_frame->height = frame->height;
     }
     int err = av_frame_copy(m_frame, frame);
     m_presentationTime = av_frame_get_best_effort_timestamp(frame) * (timeBase * 1000);
     m_frameSize = FrameSize(m_frame->width, m_frame->height);
-    m_context = ctx;
+}
+
+void InternalFrame::Convert(SlicedConverter *converter, FrameSize outputSize)
+{
+    if (m_format == AV_PIX_FMT_NONE)
+    {
+        //Passthrough, the decoded planes are shown as they are and released in Release().
+        m_frameSize = FrameSize(m_frame->width, m_frame->height);
+        return;
+    }
+    int width = m_frame->width;
+    int height = m_frame->height;
+    if (outputSize.first > 0 && outputSize.second > 0)
+    {
+        width = outputSize.first;
+        height = outputSize.second;
+    }
+    int buff_size = avpicture_get_size(m_format, width, height);
+    if (m_convertedBufferCapacity < buff_size)
+    {
+        if (m_convertedBuffer != NULL)
+            m_memoryPool->FreeScratch(&m_convertedBuffer);
+        m_convertedBuffer = m_memoryPool->AllocScratch(buff_size);
+        m_convertedBufferCapacity = buff_size;
+    }
+    m_convertedBufferSize = buff_size;
+    AVPicture picture;
+    avpicture_fill(&picture, m_convertedBuffer, m_format, width, height);
+    converter->Convert(m_frame, m_format, width, height, picture.data, picture.linesize);
+    m_frameSize = FrameSize(width, height);
+    Release();
+}
+
+void InternalFrame::Release()
+{
+    if (m_frame != NULL && m_frame->buf[0] != NULL)
+        av_frame_unref(m_frame);
+}
+
+void InternalFrame::Reserve(int32_t convertedSize)
+{
+    if (convertedSize <= m_convertedBufferCapacity)
+        return;
+    if (m_convertedBuffer != NULL)
+        m_memoryPool->FreeScratch(&m_convertedBuffer);
+    m_convertedBuffer = m_memoryPool->AllocScratch(convertedSize);
+    m_convertedBufferCapacity = convertedSize;
 }
 
 /*void InternalFrame::SaveFrame(AVFrame *frame, SwsContext* ctx, double timeBase)
@@ -93,58 +173,273 @@ void InternalFrame::SaveFrame(AVFrame *frame, SwsContext* ctx, double timeBase)
 
 void InternalFrame::CopyFrame(uint8_t** buffer, int32_t & bufferSize) const
 {
-    int buff_Size = avpicture_get_size(m_format, m_frame->width, m_frame->height);   
-
-    if (bufferSize != buff_Size)
+    int32_t size = m_convertedBufferSize;
+    if (m_format == AV_PIX_FMT_NONE)
+        size = avpicture_get_size((AVPixelFormat)m_frame->format, m_frame->width, m_frame->height);
+    if (bufferSize != size)
     {
         if (*buffer != NULL)
             delete[](*buffer);
-        *buffer = new uint8_t[buff_Size];
-        bufferSize = buff_Size;
+        *buffer = new uint8_t[size];
+        bufferSize = size;
     }
-    AVFrame *frame = av_frame_alloc();
-    avpicture_fill((AVPicture *)frame, *buffer, PIX_FMT_RGBA, m_frame->width, m_frame->height);
-    sws_scale(m_context, (uint8_t const * const *)m_frame->data,
-        m_frame->linesize, 0, m_frame->height,
-        frame->data, frame->linesize);
-    av_frame_free(&frame);
+    if (m_format == AV_PIX_FMT_NONE)
+        avpicture_layout((const AVPicture*)m_frame, (AVPixelFormat)m_frame->format, m_frame->width, m_frame->height, *buffer, size);
+    else
+        memcpy(*buffer, m_convertedBuffer, size);
 }
 
-FrameQueueManager::FrameQueueManager(int frameNumberLimit, AVPixelFormat format) : 
-    m_swsCtx(NULL),
-    m_frameSize(0,0),
-    m_format(format)
+void InternalFrame::CopyFrame(uint8_t* const data[4], const int linesize[4]) const
 {
-    for (int i = 0; i < frameNumberLimit; ++i)
+    uint8_t* planes[4];
+    int planeLinesize[4];
+    AVPixelFormat format;
+    GetPlanes(planes, planeLinesize, format);
+    av_image_copy((uint8_t**)data, (int*)linesize, (const uint8_t**)planes, planeLinesize,
+        format, m_frameSize.first, m_frameSize.second);
+}
+
+void InternalFrame::GetPlanes(uint8_t* data[4], int linesize[4], AVPixelFormat& format) const
+{
+    if (m_format == AV_PIX_FMT_NONE)
     {
-        InternalFrame * frame = new InternalFrame(m_format);
-        m_FullFrameList.push_back(frame);
-        m_FreeFrames.push_back(frame);
+        for (int plane = 0; plane < 4; ++plane)
+        {
+            data[plane] = m_frame->data[plane];
+            linesize[plane] = m_frame->linesize[plane];
+        }
+        format = (AVPixelFormat)m_frame->format;
+        return;
     }
+    AVPicture picture;
+    avpicture_fill(&picture, m_convertedBuffer, m_format, m_frameSize.first, m_frameSize.second);
+    for (int plane = 0; plane < 4; ++plane)
+    {
+        data[plane] = picture.data[plane];
+        linesize[plane] = picture.linesize[plane];
+    }
+    format = m_format;
 }
 
-FrameQueueManager::~FrameQueueManager()
+FrameLease::FrameLease() :
+    m_owner(NULL),
+    m_frame(NULL),
+    m_index(0)
 {
-    m_mutex.lock();
-    if (m_swsCtx != NULL)
+
+}
+
+FrameLease::FrameLease(FrameQueueManager *owner, InternalFrame *frame, unsigned index) :
+    m_owner(owner),
+    m_frame(frame),
+    m_index(index)
+{
+
+}
+
+FrameLease::FrameLease(FrameLease&& other) :
+    m_owner(other.m_owner),
+    m_frame(other.m_frame),
+    m_index(other.m_index)
+{
+    other.m_owner = NULL;
+    other.m_frame = NULL;
+}
+
+FrameLease& FrameLease::operator=(FrameLease&& other)
+{
+    if (this != &other)
     {
-        sws_freeContext(m_swsCtx);
-        m_swsCtx = NULL;
+        Reset();
+        m_owner = other.m_owner;
+        m_frame = other.m_frame;
+        m_index = other.m_index;
+        other.m_owner = NULL;
+        other.m_frame = NULL;
     }
-    for (auto frame : m_FullFrameList)
+    return *this;
+}
+
+FrameLease::~FrameLease()
+{
+    Reset();
+}
+
+void FrameLease::Reset()
+{
+    if (m_owner != NULL && m_frame != NULL)
+        m_owner->ReturnFrame(m_index, m_frame);
+    m_owner = NULL;
+    m_frame = NULL;
+}
+
+FrameQueueManager::FrameQueueManager(int minDepth, int maxDepth, AVPixelFormat format, PlayerMemoryPool *memoryPool, PlayerScheduler *scheduler /*= NULL*/) : 
+    m_minDepth(minDepth),
+    m_maxDepth(maxDepth),
+    m_limit(minDepth),
+    m_written(0),
+    m_converted(0),
+    m_taken(0),
+    m_released(0),
+    m_discardBefore(0),
+    m_freePushed(0),
+    m_freePopped(0),
+    m_decodeTimeMean(0),
+    m_decodeTimeVariance(0),
+    m_frameInterval(0),
+    m_lastPresentationTime(AV_NOPTS_VALUE),
+    m_wantedDepth(minDepth),
+    m_underruns(0),
+    m_seenUnderruns(0),
+    m_convertedSize(0),
+    m_lastDepthChange(std::chrono::steady_clock::now()),
+    m_converter(new SlicedConverter()),
+    m_outputSize(0, 0),
+    m_format(format),
+    m_memoryPool(memoryPool),
+    m_freeFrameSignal(NULL),
+    m_readyFrameSignal(NULL),
+    m_destroying(false),
+    m_conversionTask(m_conversionSignal, [this](int64_t& delay) { return this->ConversionStep(delay); })
+{
+    //Power of two capacity, so positions map to slots with a mask and may wrap around.
+    unsigned capacity = 1;
+    while (capacity < (unsigned)maxDepth)
+        capacity <<= 1;
+    m_mask = capacity - 1;
+    m_slots.resize(capacity);
+    for (auto& slot : m_slots)
+    {
+        slot.frame = NULL;
+        slot.converted = false;
+        slot.returned = false;
+    }
+    //Frames pinned or detached by callers come on top of the depth.
+    m_freeFrames.resize(capacity * 2);
+    m_freeMask = capacity * 2 - 1;
+    for (int i = 0; i < minDepth; ++i)
+    {
+        InternalFrame* frame = new InternalFrame(m_format, memoryPool);
+        m_allFrames.push_back(frame);
+        PushFreeFrame(frame);
+    }
+    m_conversionTask.Start(scheduler);
+}
+
+FrameQueueManager::~FrameQueueManager()
+{
+    m_destroying = true;
+    m_conversionSignal.Notify();
+    m_conversionTask.Stop();
+    delete m_converter;
+    m_converter = NULL;
+    for (auto frame : m_allFrames)
     {
         delete frame;
     }
-    m_FullFrameList.clear();
-    m_FreeFrames.clear();
-    m_ReadyFrames.clear();
-    m_mutex.unlock();
+    m_allFrames.clear();
+    m_pinnedFrames.clear();
+    m_detachedFrames.clear();
+    m_retiredFrames.clear();
+    m_slots.clear();
+}
+
+void FrameQueueManager::SetFreeFrameSignal(ThreadSignal *signal)
+{
+    m_freeFrameSignal = signal;
+}
+
+void FrameQueueManager::SetReadyFrameSignal(ThreadSignal *signal)
+{
+    m_readyFrameSignal = signal;
+}
+
+void FrameQueueManager::ConvertFrame(InternalFrame *frame)
+{
+    std::lock_guard<std::mutex> lock(m_conversionMutex);
+    frame->Convert(m_converter, m_outputSize);
+    m_convertedSize = frame->m_convertedBufferSize;
+}
+
+void FrameQueueManager::SetConversionThreads(int threads)
+{
+    std::lock_guard<std::mutex> lock(m_conversionMutex);
+    m_converter->SetThreads(threads);
+}
+
+void FrameQueueManager::SetOutputSize(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        width = height = 0;
+    std::lock_guard<std::mutex> lock(m_conversionMutex);
+    m_outputSize = FrameSize(width, height);
+}
+
+StepResult FrameQueueManager::ConversionStep(int64_t& delay)
+{
+    if (m_destroying)
+        return StepResult::finished;
+    AdjustDepth();
+    unsigned index = m_converted;
+    if ((int)(m_written - index) <= 0)
+        return StepResult::wait;
+    //Slots between the converted and the written position belong to this thread alone.
+    Slot& slot = m_slots[index & m_mask];
+    bool stale = (int)(index - m_discardBefore) < 0;
+    if (!stale && !slot.converted)
+        ConvertFrame(slot.frame);
+    m_converted = index + 1;
+    if (stale)
+    {
+        DiscardStale();
+    }
+    else
+    {
+        ThreadSignal* readySignal = m_readyFrameSignal;
+        if (readySignal != NULL)
+            readySignal->Notify();
+    }
+    m_progressSignal.Notify();
+    return StepResult::again;
 }
 
-void FrameQueueManager::SaveFirstFrame(AVFrame *frame, double timeBase)
+bool FrameQueueManager::WaitForProgress()
+{
+    //The conversion may be queued on the scheduler behind the decoder waiting here,
+    //possibly with no thread left to run it, so it is run right here then.
+    if (m_conversionTask.RunPending())
+        return true;
+    return m_progressSignal.WaitFor(FIRST_FRAME_WAIT_MS);
+}
+
+bool FrameQueueManager::SaveFirstFrame(AVFrame *frame, double timeBase, bool preview /*= false*/)
 {
     ResetFrames();
-    SaveFrame(frame, timeBase);
+    //Frames still converting or on screen give their slots back shortly.
+    while (GetFreeFramesCount() <= 0)
+    {
+        if (m_destroying || !WaitForProgress())
+            return false;
+        DiscardStale();
+    }
+    //The first frame after a seek is shown at once, so it does not queue behind the converter.
+    unsigned index = m_written;
+    Slot& slot = m_slots[index & m_mask];
+    slot.frame = PopFreeFrame();
+    slot.frame->SaveFrame(frame, timeBase);
+    slot.frame->m_preview = preview;
+    m_lastPresentationTime = slot.frame->GetPresentationTime();
+    ConvertFrame(slot.frame);
+    slot.converted = true;
+    m_written = index + 1;
+    m_conversionSignal.Notify();
+    //The presenter expects it ready when the decoder reports the seek done.
+    while ((int)(m_converted - index) <= 0)
+    {
+        if (m_destroying || !WaitForProgress())
+            return false;
+    }
+    return true;
 }
 
 /*void FrameQueueManager::SaveFrame(AVFrame *frame, double timeBase)
@@ -181,82 +476,320 @@ void FrameQueueManager::SaveFirstFrame(AVFrame *frame, double timeBase)
 
 void FrameQueueManager::SaveFrame(AVFrame *frame, double timeBase)
 {
-    ScopedLock lock(m_mutex);
-    if (!m_FreeFrames.empty())
+    if (GetFreeFramesCount() <= 0)
+        return;
+    unsigned index = m_written;
+    Slot& slot = m_slots[index & m_mask];
+    slot.frame = PopFreeFrame();
+    slot.frame->SaveFrame(frame, timeBase);
+    slot.converted = false;
+    int64_t presentationTime = slot.frame->GetPresentationTime();
+    if (m_lastPresentationTime != AV_NOPTS_VALUE && presentationTime > m_lastPresentationTime)
     {
-        if (m_frameSize.first != frame->width || m_frameSize.second != frame->height || m_swsCtx == NULL)
+        double interval = (double)(presentationTime - m_lastPresentationTime);
+        m_frameInterval = m_frameInterval > 0 ? m_frameInterval + (interval - m_frameInterval) / 16 : interval;
+    }
+    m_lastPresentationTime = presentationTime;
+    m_written = index + 1;
+    m_conversionSignal.Notify();
+}
+
+void FrameQueueManager::ResetFrames()
+{
+    //Everything written so far is dropped.
+    m_discardBefore = (unsigned)m_written;
+    DiscardStale();
+    {
+        //Frames still leased leave the ring, so the decoder does not wait for the presenter.
+        std::lock_guard<std::mutex> lock(m_releaseMutex);
+        unsigned taken = m_taken;
+        for (unsigned index = m_released; index != taken; ++index)
+        {
+            Slot& slot = m_slots[index & m_mask];
+            if (slot.returned)
+                continue;
+            m_detachedFrames.push_back(slot.frame);
+            slot.frame = NULL;
+            slot.returned = true;
+        }
+        ReleaseSlots(taken);
+    }
+    ThreadSignal* freeSignal = m_freeFrameSignal;
+    if (freeSignal != NULL)
+        freeSignal->Notify();
+    m_conversionSignal.Notify();
+}
+
+int FrameQueueManager::GetFreeFramesCount()const
+{
+    return std::min(m_limit - (int)(m_written - m_released), GetFreeListSize());
+}
+
+int FrameQueueManager::GetDepth() const
+{
+    return m_limit;
+}
+
+void FrameQueueManager::ReportDecodeTime(int64_t microseconds)
+{
+    double time = microseconds / 1000.0;
+    if (m_decodeTimeMean <= 0)
+    {
+        m_decodeTimeMean = time;
+        return;
+    }
+    //Exponentially weighted mean and variance, over roughly the last 16 frames.
+    double delta = time - m_decodeTimeMean;
+    m_decodeTimeMean += delta / 16;
+    m_decodeTimeVariance = (m_decodeTimeVariance + delta * delta / 16) * 15 / 16;
+    if (m_frameInterval <= 0)
+        return;
+    //Enough queued frames to cover a decode four standard deviations slower than usual.
+    double worstCase = m_decodeTimeMean + 4 * sqrt(m_decodeTimeVariance);
+    m_wantedDepth = (int)ceil(worstCase / m_frameInterval) + FRAME_QUEUE_HEADROOM;
+}
+
+void FrameQueueManager::ReportUnderrun()
+{
+    ++m_underruns;
+    m_conversionSignal.Notify();
+}
+
+void FrameQueueManager::AdjustDepth()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int limit = m_limit;
+    int wanted = std::max(m_minDepth, std::min(m_maxDepth, (int)m_wantedDepth));
+    int underruns = m_underruns;
+    if (underruns != m_seenUnderruns)
+    {
+        //The presenter ran dry although the statistics said the queue was deep enough.
+        m_seenUnderruns = underruns;
+        wanted = std::max(wanted, std::min(m_maxDepth, limit + 1));
+    }
+    if (wanted > limit)
+    {
+        limit = wanted;
+        m_lastDepthChange = now;
+    }
+    else if (wanted < limit && now - m_lastDepthChange >= std::chrono::milliseconds(FRAME_QUEUE_SHRINK_DELAY_MS))
+    {
+        --limit;
+        m_lastDepthChange = now;
+    }
+    m_limit = limit;
+    //Frames are created here rather than when the decoder needs them.
+    int missing = limit - (int)(m_written - m_released) - GetFreeListSize();
+    if (missing > 0)
+    {
+        int32_t convertedSize = 0;
         {
-            if (m_swsCtx != NULL)
+            std::lock_guard<std::mutex> lock(m_conversionMutex);
+            convertedSize = m_convertedSize;
+        }
+        bool added = false;
+        for (; missing > 0; --missing)
+        {
+            InternalFrame* frame = new InternalFrame(m_format, m_memoryPool);
+            frame->Reserve(convertedSize);
+            std::lock_guard<std::mutex> lock(m_releaseMutex);
+            if (!PushFreeFrame(frame))
             {
-                sws_freeContext(m_swsCtx);
-                m_swsCtx = NULL;
+                delete frame;
+                break;
             }
-            m_swsCtx = sws_getContext(frame->width,
-                frame->height,
-                (AVPixelFormat)frame->format,
-                frame->width,
-                frame->height,
-                m_format,
-                SWS_BILINEAR,
-                NULL,
-                NULL,
-                NULL
-                );
-            m_frameSize = FrameSize(frame->width, frame->height);
+            m_allFrames.push_back(frame);
+            added = true;
         }
-        InternalFrame* fr = m_FreeFrames.front();
-        m_FreeFrames.pop_front();
-        fr->SaveFrame(frame, m_swsCtx, timeBase);
-        m_ReadyFrames.push_back(fr);
+        ThreadSignal* freeSignal = m_freeFrameSignal;
+        if (added && freeSignal != NULL)
+            freeSignal->Notify();
     }
+    std::vector<InternalFrame*> retired;
+    {
+        std::lock_guard<std::mutex> lock(m_releaseMutex);
+        if (m_retiredFrames.empty())
+            return;
+        retired.swap(m_retiredFrames);
+        for (auto frame : retired)
+            m_allFrames.erase(std::find(m_allFrames.begin(), m_allFrames.end(), frame));
+    }
+    for (auto frame : retired)
+        delete frame;
 }
 
-InternalFrame* FrameQueueManager::RequestReadyFrame()
+bool FrameQueueManager::PushFreeFrame(InternalFrame *frame)
 {
-    InternalFrame* ret = NULL;
-    ScopedLock lock(m_mutex);
-    if (!m_ReadyFrames.empty())
+    unsigned pushed = m_freePushed;
+    if (pushed - m_freePopped > m_freeMask)
+        return false;
+    m_freeFrames[pushed & m_freeMask] = frame;
+    m_freePushed = pushed + 1;
+    return true;
+}
+
+InternalFrame* FrameQueueManager::PopFreeFrame()
+{
+    unsigned popped = m_freePopped;
+    if (popped == m_freePushed)
+        return NULL;
+    InternalFrame* frame = m_freeFrames[popped & m_freeMask];
+    m_freePopped = popped + 1;
+    return frame;
+}
+
+int FrameQueueManager::GetFreeListSize() const
+{
+    return (int)(m_freePushed - m_freePopped);
+}
+
+unsigned FrameQueueManager::FirstReadyIndex() const
+{
+    unsigned taken = m_taken;
+    unsigned discardBefore = m_discardBefore;
+    return (int)(discardBefore - taken) > 0 ? discardBefore : taken;
+}
+
+void FrameQueueManager::DiscardStale()
+{
+    unsigned discardBefore = m_discardBefore;
+    unsigned taken = m_taken;
+    while ((int)(discardBefore - taken) > 0 && taken != m_converted)
     {
-        ret = m_ReadyFrames.front();
-        m_ReadyFrames.pop_front();
+        //The presenter may take at the same time, whoever moves the position owns the frame.
+        if (m_taken.compare_exchange_weak(taken, taken + 1))
+        {
+            ReturnFrame(taken, m_slots[taken & m_mask].frame);
+            ++taken;
+        }
     }
-    return ret;
 }
 
-InternalFrame* FrameQueueManager::GetFirstFrame()
+FrameLease FrameQueueManager::RequestReadyFrame()
 {
-    InternalFrame* ret = NULL;
-    ScopedLock lock(m_mutex);
-    if (!m_ReadyFrames.empty())
+    DiscardStale();
+    unsigned taken = m_taken;
+    while (taken != m_converted)
     {
-        ret = m_ReadyFrames.front();
+        if (!m_taken.compare_exchange_weak(taken, taken + 1))
+            continue;
+        //A reset between DiscardStale and the take made the frame stale, it goes back unseen.
+        if ((int)(taken - m_discardBefore) < 0)
+        {
+            ReturnFrame(taken, m_slots[taken & m_mask].frame);
+            taken = m_taken;
+            continue;
+        }
+        return FrameLease(this, m_slots[taken & m_mask].frame, taken);
     }
-    return ret;
+    return FrameLease();
 }
 
-void FrameQueueManager::FrameShown(InternalFrame* frame)
+InternalFrame* FrameQueueManager::GetFirstFrame() const
 {
-    if (frame == NULL)
+    unsigned index = FirstReadyIndex();
+    if ((int)(m_converted - index) <= 0)
+        return NULL;
+    return m_slots[index & m_mask].frame;
+}
+
+int FrameQueueManager::GetReadyFramesCount()const
+{
+    int count = (int)(m_converted - FirstReadyIndex());
+    return count > 0 ? count : 0;
+}
+
+//The one lock on the way of a frame, taken once per frame when its lease ends. Frames come
+//back out of order from the presenter, from a reset on the decoder and from the conversion
+//thread dropping stale ones, and a slot is only free once all before it are back, so the
+//in-order release, the pins and the producer side of the free list are kept under one mutex.
+//The decoder and the presenter never wait for each other on it: frames are written, converted
+//and taken through atomic positions, and the free list is popped without it.
+void FrameQueueManager::ReturnFrame(unsigned index, InternalFrame *frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_releaseMutex);
+        unsigned released = m_released;
+        if ((int)(index - released) < 0)
+        {
+            //Detached by a reset.
+            auto it = std::find(m_detachedFrames.begin(), m_detachedFrames.end(), frame);
+            if (it != m_detachedFrames.end())
+            {
+                m_detachedFrames.erase(it);
+                FrameLeft(frame);
+            }
+            return;
+        }
+        m_slots[index & m_mask].returned = true;
+        if (!ReleaseSlots(m_taken))
+            return;
+    }
+    ThreadSignal* freeSignal = m_freeFrameSignal;
+    if (freeSignal != NULL)
+        freeSignal->Notify();
+    m_progressSignal.Notify();
+}
+
+bool FrameQueueManager::ReleaseSlots(unsigned taken)
+{
+    unsigned released = m_released;
+    unsigned start = released;
+    while (released != taken && m_slots[released & m_mask].returned)
+    {
+        Slot& slot = m_slots[released & m_mask];
+        InternalFrame* frame = slot.frame;
+        slot.frame = NULL;
+        slot.returned = false;
+        m_released = ++released;
+        if (frame != NULL)
+            FrameLeft(frame);
+    }
+    return released != start;
+}
+
+void FrameQueueManager::FrameLeft(InternalFrame *frame)
+{
+    if (frame->m_pins > 0)
+    {
+        //A caller still reads it, the conversion thread makes up for it in the free list.
+        m_pinnedFrames.push_back(frame);
+        m_conversionSignal.Notify();
         return;
-    ScopedLock lock(m_mutex);
-    m_FreeFrames.push_back(frame);
+    }
+    RecycleFrame(frame);
 }
 
-void FrameQueueManager::ResetFrames()
+void FrameQueueManager::RecycleFrame(InternalFrame *frame)
 {
-    ScopedLock lock(m_mutex);
-    m_ReadyFrames.clear();
-    m_FreeFrames.assign(m_FullFrameList.begin(), m_FullFrameList.end());
+    frame->Release();
+    //After the queue shrank there are more frames than it may hold.
+    if (GetFreeListSize() + (int)(m_written - m_released) >= m_limit || !PushFreeFrame(frame))
+    {
+        m_retiredFrames.push_back(frame);
+        m_conversionSignal.Notify();
+    }
 }
 
-int FrameQueueManager::GetFreeFramesCount()const
+void FrameQueueManager::PinFrame(InternalFrame* frame)
 {
-    ScopedLock lock(m_mutex);
-    return m_FreeFrames.size();
+    if (frame == NULL)
+        return;
+    std::lock_guard<std::mutex> lock(m_releaseMutex);
+    ++frame->m_pins;
 }
 
-int FrameQueueManager::GetReadyFramesCount()const
+void FrameQueueManager::UnpinFrame(InternalFrame* frame)
 {
-    ScopedLock lock(m_mutex);
-    return m_ReadyFrames.size();
-}
\ No newline at end of file
+    if (frame == NULL)
+        return;
+    std::lock_guard<std::mutex> lock(m_releaseMutex);
+    if (frame->m_pins == 0 || --frame->m_pins > 0)
+        return;
+    auto it = std::find(m_pinnedFrames.begin(), m_pinnedFrames.end(), frame);
+    if (it != m_pinnedFrames.end())
+    {
+        m_pinnedFrames.erase(it);
+        FrameLeft(frame);
+    }
+}
@@ -4,6 +4,17 @@
 typedef std::lock_guard<std::recursive_mutex> ScopedLock;
 typedef std::pair<int, int> FrameSize;
 
+#define FIRST_FRAME_WAIT_MS 500 //SaveFirstFrame gives up when the queue makes no progress for this long
+#define FRAME_QUEUE_MIN_DEPTH 3
+#define FRAME_QUEUE_MAX_DEPTH 16
+#define FRAME_QUEUE_HEADROOM 2 //the frame on screen and the one being converted
+#define FRAME_QUEUE_SHRINK_DELAY_MS 3000 //steady playback needed before the depth shrinks by one
+
+class PlayerMemoryPool;
+class ThreadSignal;
+class SlicedConverter;
+class PlayerScheduler;
+
 class InternalFrame
 {
     AVFrame* m_frame;
@@ -12,13 +23,32 @@ class InternalFrame
     FrameSize m_frameSize;
     int32_t m_bufferSize;
     AVPixelFormat m_format;
-    SwsContext *m_context;
+    uint8_t * m_convertedBuffer; //picture in m_format, filled once by Convert()
+    int32_t m_convertedBufferSize;
+    int32_t m_convertedBufferCapacity; //only grows, so output size changes rarely allocate
+    PlayerMemoryPool *m_memoryPool;
+    int m_pins; //callers reading the planes, guarded by the FrameQueueManager release mutex
+    bool m_preview; //keyframe shown while a preview seek waits to refine
     void FreeStuff();
+    friend class FrameQueueManager;
 public:
-    InternalFrame(AVPixelFormat format);
+    InternalFrame(AVPixelFormat format, PlayerMemoryPool *memoryPool);
     ~InternalFrame();
-    void SaveFrame(AVFrame *frame, SwsContext* ctx, double timeBase);
+    //Takes a reference to frame when it is reference counted and copies it otherwise.
+    void SaveFrame(AVFrame *frame, double timeBase);
+    //Converts the saved picture to the output format and size and releases the decoded one.
+    //An output size of 0x0 keeps the decoded size. With AV_PIX_FMT_NONE as output format the
+    //decoded picture is kept as it is.
+    void Convert(SlicedConverter *converter, FrameSize outputSize);
+    //Hands a referenced picture back to the decoder.
+    void Release();
+    //Allocates the converted picture up front, so a new frame does not allocate when used.
+    void Reserve(int32_t convertedSize);
     void CopyFrame(uint8_t** buffer, int32_t & bufferSize) const;
+    //Copies the converted picture into planes the caller owns, any line sizes are fine.
+    void CopyFrame(uint8_t* const data[4], const int linesize[4]) const;
+    //Planes of the picture to show, valid until the frame goes back to the free list.
+    void GetPlanes(uint8_t* data[4], int linesize[4], AVPixelFormat& format) const;
     int64_t GetPresentationTime() const
     {
         return m_presentationTime;
@@ -27,29 +57,151 @@ public:
     {
         return m_frameSize;
     }
+    bool IsPreview() const
+    {
+        return m_preview;
+    }
 };
+class FrameQueueManager;
+
+//A frame taken from the ready queue. It goes back to the queue when the lease is reset,
+//assigned over or destroyed, so a consumer can hold a frame as long as it needs without
+//copying it and without having to remember to return it.
+class FrameLease
+{
+    FrameQueueManager *m_owner;
+    InternalFrame *m_frame;
+    unsigned m_index; //ring position the frame was taken from
+
+    FrameLease(const FrameLease&) = delete;
+    FrameLease& operator=(const FrameLease&) = delete;
+public:
+    FrameLease();
+    FrameLease(FrameQueueManager *owner, InternalFrame *frame, unsigned index);
+    FrameLease(FrameLease&& other);
+    FrameLease& operator=(FrameLease&& other);
+    ~FrameLease();
+    void Reset();
+    InternalFrame* Get() const
+    {
+        return m_frame;
+    }
+    InternalFrame* operator->() const
+    {
+        return m_frame;
+    }
+};
+
+//Frames pass through a fixed ring of slots. Positions in it only grow: the decoder writes
+//frames, the conversion thread converts them once to the output format and the presenter
+//takes them, each stage advancing its own atomic position, so the decoder and the presenter
+//never wait for each other on a lock. Taken frames are given back through their leases,
+//possibly out of order, and a slot is free again once every frame before it was given back.
+//That bookkeeping and pinning are the only parts that take a lock.
+//The frames themselves come from a free list, so only as many exist as the queue is deep.
+//The depth follows the decoder: it grows when decode times jitter by more than the queued
+//frames cover or the presenter runs dry, and shrinks again after steady playback. Frames
+//are created and deleted on the conversion thread between conversions.
+//The conversion thread may also be a task of a PlayerScheduler.
 class FrameQueueManager
 {
-    typedef std::list<InternalFrame*> FrameList;
-    
-    FrameList m_FullFrameList;
-    FrameList m_ReadyFrames;
-    FrameList m_FreeFrames;
-    mutable std::recursive_mutex m_mutex;
-    SwsContext *m_swsCtx;
-    FrameSize m_frameSize;
+    struct Slot
+    {
+        InternalFrame *frame;
+        bool converted; //converted by SaveFirstFrame already
+        bool returned; //lease given back, waits for the frames before it
+    };
+
+    std::vector<Slot> m_slots;
+    unsigned m_mask;
+    int m_minDepth;
+    int m_maxDepth;
+    std::atomic<int> m_limit; //frames in the ring at most, between the depth limits
+    std::atomic<unsigned> m_written;
+    std::atomic<unsigned> m_converted;
+    std::atomic<unsigned> m_taken;
+    std::atomic<unsigned> m_released;
+    std::atomic<unsigned> m_discardBefore; //frames written before the last reset are dropped
+    std::mutex m_releaseMutex; //guards Slot::returned, pins, pushing free frames and the lists below
+    std::vector<InternalFrame*> m_allFrames;
+    std::vector<InternalFrame*> m_pinnedFrames; //out of the ring, still read by a caller
+    std::vector<InternalFrame*> m_detachedFrames; //out of the ring by a reset, lease not ended yet
+    std::vector<InternalFrame*> m_retiredFrames; //not needed after shrinking, deleted by AdjustDepth
+    //Free frames, pushed under m_releaseMutex and popped by the decoder alone.
+    std::vector<InternalFrame*> m_freeFrames;
+    unsigned m_freeMask;
+    std::atomic<unsigned> m_freePushed;
+    std::atomic<unsigned> m_freePopped;
+    //Depth statistics, written by the decoder.
+    double m_decodeTimeMean;
+    double m_decodeTimeVariance;
+    double m_frameInterval;
+    int64_t m_lastPresentationTime;
+    std::atomic<int> m_wantedDepth;
+    std::atomic<int> m_underruns;
+    //Depth control, conversion thread only.
+    int m_seenUnderruns;
+    int32_t m_convertedSize; //of the latest frame, new frames reserve as much
+    std::chrono::steady_clock::time_point m_lastDepthChange;
+    std::mutex m_conversionMutex; //guards m_converter and m_outputSize
+    SlicedConverter *m_converter;
+    FrameSize m_outputSize;
     AVPixelFormat m_format;
+    PlayerMemoryPool *m_memoryPool;
+    std::atomic<ThreadSignal*> m_freeFrameSignal;
+    std::atomic<ThreadSignal*> m_readyFrameSignal;
+    ThreadSignal m_conversionSignal;
+    ThreadSignal m_progressSignal; //frames converted or given back, wakes SaveFirstFrame
+    std::atomic<bool> m_destroying;
+    ScheduledTask m_conversionTask;
+
+    StepResult ConversionStep(int64_t& delay);
+    //False if nothing happened for FIRST_FRAME_WAIT_MS.
+    bool WaitForProgress();
+    void ConvertFrame(InternalFrame *frame);
+    unsigned FirstReadyIndex() const;
+    void DiscardStale();
+    void ReturnFrame(unsigned index, InternalFrame *frame);
+    bool ReleaseSlots(unsigned taken);
+    void FrameLeft(InternalFrame *frame);
+    void RecycleFrame(InternalFrame *frame);
+    bool PushFreeFrame(InternalFrame *frame);
+    InternalFrame* PopFreeFrame();
+    int GetFreeListSize() const;
+    void AdjustDepth();
+    friend class FrameLease;
 public:
-    FrameQueueManager(int frameNumberLimit, AVPixelFormat format);
+    //The queue starts minDepth frames deep and adapts up to maxDepth. Frames are converted
+    //on a thread of their own, or by a task of scheduler if not NULL.
+    FrameQueueManager(int minDepth, int maxDepth, AVPixelFormat format, PlayerMemoryPool *memoryPool, PlayerScheduler *scheduler = NULL);
     ~FrameQueueManager();
-    void SaveFirstFrame(AVFrame *frame, double timeBase);
+    //Notified when a frame slot becomes free, i.e. the decoder may continue.
+    void SetFreeFrameSignal(ThreadSignal *signal);
+    //Notified when a decoded frame becomes ready to show.
+    void SetReadyFrameSignal(ThreadSignal *signal);
+    //Slices converted in parallel per frame, 0 uses every core of the shared worker pool.
+    void SetConversionThreads(int threads);
+    //Size frames are scaled to while they are converted, 0x0 keeps the decoded size.
+    //Frames converted before the change keep their size.
+    void SetOutputSize(int width, int height);
+    //Decoder side. preview marks the keyframe of a preview seek. SaveFirstFrame returns false
+    //without the frame ready to show if the queue made no progress for FIRST_FRAME_WAIT_MS.
+    bool SaveFirstFrame(AVFrame *frame, double timeBase, bool preview = false);
     void SaveFrame(AVFrame *frame, double timeBase);
-    InternalFrame* RequestReadyFrame();
-    InternalFrame* GetFirstFrame();
-    void FrameShown(InternalFrame* frame);
     void ResetFrames();
     int GetFreeFramesCount()const;
+    //Time the decoder took for the latest frame, including waiting for its packets.
+    void ReportDecodeTime(int64_t microseconds);
+    int GetDepth() const;
+    //Presenter side.
+    FrameLease RequestReadyFrame();
+    InternalFrame* GetFirstFrame() const;
     int GetReadyFramesCount()const;
+    //The presenter had to wait for a frame while playing.
+    void ReportUnderrun();
+    //Keeps a taken frame and its planes alive until UnpinFrame, even after its lease ended.
+    void PinFrame(InternalFrame* frame);
+    void UnpinFrame(InternalFrame* frame);
 };
 
 #endif//FRAMEQUEUEMANAGER_H
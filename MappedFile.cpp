@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "MappedFile.h"
+
+#ifdef _WIN32
+//PrefetchVirtualMemory arrived with Windows 8, it is looked up so the player still starts on 7.
+struct PrefetchRange
+{
+    void* address;
+    SIZE_T size;
+};
+typedef BOOL (WINAPI *PrefetchVirtualMemoryFunc)(HANDLE process, ULONG_PTR count, PrefetchRange* ranges, ULONG flags);
+static const PrefetchVirtualMemoryFunc s_prefetchVirtualMemory =
+    (PrefetchVirtualMemoryFunc)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+#endif
+
+MappedFile::MappedFile() :
+    m_data(NULL),
+    m_size(0)
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const char* filePath)
+{
+    Close();
+    int length = MultiByteToWideChar(CP_UTF8, 0, filePath, -1, NULL, 0);
+    if (length <= 0)
+        return false;
+    std::vector<wchar_t> widePath(length);
+    MultiByteToWideChar(CP_UTF8, 0, filePath, -1, widePath.data(), length);
+    //Sequential scan makes the cache manager read ahead further and drop pages behind the reader sooner.
+    HANDLE file = CreateFileW(widePath.data(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    //An empty file can not be mapped.
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= (SIZE_T)-1)
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    //The view keeps the mapping and the file open.
+    CloseHandle(file);
+    if (mapping == NULL)
+        return false;
+    m_data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (m_data == NULL)
+        return false;
+    m_size = size.QuadPart;
+    Prefetch(0, MAPPED_FILE_READAHEAD);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data != NULL)
+        UnmapViewOfFile(m_data);
+    m_data = NULL;
+    m_size = 0;
+}
+
+void MappedFile::Prefetch(int64_t offset, int64_t length) const
+{
+    if (s_prefetchVirtualMemory == NULL || offset < 0 || offset >= m_size)
+        return;
+    PrefetchRange range = { m_data + offset, (SIZE_T)std::min(length, m_size - offset) };
+    s_prefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+#else
+bool MappedFile::Open(const char* filePath)
+{
+    Close();
+    int file = open(filePath, O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat info;
+    void* data = MAP_FAILED;
+    //An empty file can not be mapped.
+    if (fstat(file, &info) == 0 && info.st_size > 0 && (uint64_t)info.st_size <= (size_t)-1)
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+    //The mapping keeps the file open.
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = (uint8_t*)data;
+    m_size = info.st_size;
+    //Larger read ahead, and pages behind the reader are freed first under memory pressure.
+    madvise(m_data, (size_t)m_size, MADV_SEQUENTIAL);
+    Prefetch(0, MAPPED_FILE_READAHEAD);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data != NULL)
+        munmap(m_data, (size_t)m_size);
+    m_data = NULL;
+    m_size = 0;
+}
+
+void MappedFile::Prefetch(int64_t offset, int64_t length) const
+{
+    if (offset < 0 || offset >= m_size)
+        return;
+    //madvise wants a page aligned start.
+    int64_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+    int64_t start = offset & ~pageMask;
+    int64_t end = std::min(offset + length, m_size);
+    madvise(m_data + start, (size_t)(end - start), MADV_WILLNEED);
+}
+#endif
@@ -0,0 +1,29 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#define MAPPED_FILE_READAHEAD (4 * 1024 * 1024) //bytes prefetched ahead of the reader
+
+//Read only view of a whole file. Pages are loaded on first access and come from the
+//system file cache, so every player of the same file shares them and opening does not
+//depend on the file size. A 32 bit process may not find address space for big files,
+//Open fails then and the caller reads the file another way.
+class MappedFile
+{
+    uint8_t* m_data;
+    int64_t m_size;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+public:
+    MappedFile();
+    ~MappedFile();
+    //filePath is UTF-8, like the paths ffmpeg opens.
+    bool Open(const char* filePath);
+    void Close();
+    //Asks the system to load the range in the background, it is only a hint.
+    void Prefetch(int64_t offset, int64_t length) const;
+    uint8_t* Data() const { return m_data; } //read only, writing to it faults
+    int64_t Size() const { return m_size; }
+};
+
+#endif//MAPPEDFILE_H
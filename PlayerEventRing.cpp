@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <stdint.h>
+#include <atomic>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+#include "PlayerEventRing.h"
+
+PlayerEventRing::PlayerEventRing(bool wakeHandle) :
+    m_head(0),
+    m_tail(0),
+    m_frameEventQueued(false),
+    m_seekDoneQueued(false),
+    m_seekDoneTime(0),
+    m_previewQueued(false),
+    m_previewTime(0),
+    m_wakeSignaled(false),
+    m_dropped(0),
+    m_wakeHandle(-1)
+{
+    for (unsigned i = 0; i < PLAYER_EVENT_RING_CAPACITY; ++i)
+        m_slots[i].sequence = i;
+    if (wakeHandle)
+    {
+#ifdef _WIN32
+        //Manual reset, it stays signaled for every waiter until the events are taken out.
+        HANDLE event = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (event != NULL)
+            m_wakeHandle = (intptr_t)event;
+#else
+        m_wakeHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    }
+}
+
+PlayerEventRing::~PlayerEventRing()
+{
+    if (m_wakeHandle != -1)
+    {
+#ifdef _WIN32
+        CloseHandle((HANDLE)m_wakeHandle);
+#else
+        close((int)m_wakeHandle);
+#endif
+    }
+}
+
+bool PlayerEventRing::Enqueue(FfmpegPlayerEventType type, int64_t data)
+{
+    unsigned position = m_head.load(std::memory_order_relaxed);
+    Slot* slot = NULL;
+    while (true)
+    {
+        slot = &m_slots[position & (PLAYER_EVENT_RING_CAPACITY - 1)];
+        int distance = (int)(slot->sequence.load(std::memory_order_acquire) - position);
+        //The slot still holds the event from one lap ago, the ring is full.
+        if (distance < 0)
+            return false;
+        if (distance == 0 && m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            break;
+        if (distance > 0)
+            position = m_head.load(std::memory_order_relaxed);
+    }
+    slot->type = type;
+    slot->data = data;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+void PlayerEventRing::SignalWake()
+{
+    //Once per batch, the consumer clears the flag when it has taken everything out.
+    if (m_wakeHandle == -1 || m_wakeSignaled.exchange(true))
+        return;
+#ifdef _WIN32
+    SetEvent((HANDLE)m_wakeHandle);
+#else
+    uint64_t one = 1;
+    if (write((int)m_wakeHandle, &one, sizeof(one)) < 0)
+        return;
+#endif
+}
+
+bool PlayerEventRing::Push(FfmpegPlayerEventType type, int64_t data)
+{
+    std::atomic<bool>* coalesced = NULL;
+    if (type == FfmpegPlayerEventType::NextFrameAvailable)
+    {
+        coalesced = &m_frameEventQueued;
+    }
+    else if (type == FfmpegPlayerEventType::SeekDone)
+    {
+        m_seekDoneTime = data;
+        coalesced = &m_seekDoneQueued;
+    }
+    else if (type == FfmpegPlayerEventType::PreviewShown)
+    {
+        m_previewTime = data;
+        coalesced = &m_previewQueued;
+    }
+    if (coalesced != NULL && coalesced->exchange(true))
+        return false;
+    if (!Enqueue(type, data))
+    {
+        if (coalesced != NULL)
+            *coalesced = false;
+        ++m_dropped;
+        return false;
+    }
+    SignalWake();
+    return true;
+}
+
+bool PlayerEventRing::Pop(FfmpegPlayerEvent& event)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        Slot& slot = m_slots[m_tail & (PLAYER_EVENT_RING_CAPACITY - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) == m_tail + 1)
+        {
+            event.m_type = slot.type;
+            event.m_data = slot.data;
+            slot.sequence.store(m_tail + PLAYER_EVENT_RING_CAPACITY, std::memory_order_release);
+            ++m_tail;
+            //Cleared before the listener hears of it, so a newer one queues again.
+            if (event.m_type == FfmpegPlayerEventType::NextFrameAvailable)
+            {
+                m_frameEventQueued = false;
+            }
+            else if (event.m_type == FfmpegPlayerEventType::SeekDone)
+            {
+                m_seekDoneQueued = false;
+                event.m_data = m_seekDoneTime;
+            }
+            else if (event.m_type == FfmpegPlayerEventType::PreviewShown)
+            {
+                m_previewQueued = false;
+                event.m_data = m_previewTime;
+            }
+            return true;
+        }
+        if (attempt > 0 || m_wakeHandle == -1)
+            break;
+        //Reset before looking again, an event pushed meanwhile is either seen now or signals anew.
+        m_wakeSignaled = false;
+#ifdef _WIN32
+        ResetEvent((HANDLE)m_wakeHandle);
+#else
+        uint64_t count = 0;
+        if (read((int)m_wakeHandle, &count, sizeof(count)) < 0)
+            count = 0;
+#endif
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+#ifndef PLAYEREVENTRING_H
+#define PLAYEREVENTRING_H
+
+#define PLAYER_EVENT_RING_CAPACITY 64 //power of two, events waiting for delivery at most
+
+enum class FfmpegPlayerEventType
+{
+    Initialized,
+    Playing,
+    Paused,
+    Stopped,
+    SeekDone,
+    PreviewShown,
+    NextFrameAvailable,
+    FileEnded,
+    Error
+};
+
+class FfmpegPlayerEvent
+{
+public:
+    FfmpegPlayerEventType m_type;
+    int64_t m_data;
+    FfmpegPlayerEvent(FfmpegPlayerEventType type, int64_t data) : m_type(type), m_data(data) {}
+    FfmpegPlayerEvent(const FfmpegPlayerEvent & event) : m_type(event.m_type), m_data(event.m_data) {}
+    ~FfmpegPlayerEvent(){}
+};
+
+//Events of one player on their way to its listener. Any thread pushes without a lock into a
+//fixed ring, one thread at a time takes them out. Events that only matter in their latest
+//version are coalesced: one NextFrameAvailable waits at most, and a SeekDone or PreviewShown
+//still waiting is given the newest time instead of a second one being queued.
+//With a wake handle the ring keeps an eventfd, or an event object on Windows, signaled
+//while events wait, so an application can wait for them next to its own sources.
+class PlayerEventRing
+{
+    struct Slot
+    {
+        std::atomic<unsigned> sequence; //position the slot is written for next, or that plus one once written
+        FfmpegPlayerEventType type;
+        int64_t data;
+    };
+
+    Slot m_slots[PLAYER_EVENT_RING_CAPACITY];
+    std::atomic<unsigned> m_head; //next position to write, claimed by the producers
+    unsigned m_tail; //next position to read, consumer only
+    std::atomic<bool> m_frameEventQueued;
+    std::atomic<bool> m_seekDoneQueued;
+    std::atomic<int64_t> m_seekDoneTime;
+    std::atomic<bool> m_previewQueued;
+    std::atomic<int64_t> m_previewTime;
+    std::atomic<bool> m_wakeSignaled;
+    std::atomic<int> m_dropped;
+    intptr_t m_wakeHandle; //HANDLE or eventfd, -1 without
+
+    PlayerEventRing(const PlayerEventRing&) = delete;
+    PlayerEventRing& operator=(const PlayerEventRing&) = delete;
+
+    bool Enqueue(FfmpegPlayerEventType type, int64_t data);
+    void SignalWake();
+public:
+    PlayerEventRing(bool wakeHandle);
+    ~PlayerEventRing();
+    //False if the event was coalesced into one already waiting, or dropped because the ring is full.
+    bool Push(FfmpegPlayerEventType type, int64_t data);
+    //Takes the oldest event. The wake handle is reset by the first call that finds the ring empty.
+    bool Pop(FfmpegPlayerEvent& event);
+    //-1 if the ring was made without one.
+    intptr_t GetWakeHandle() const { return m_wakeHandle; }
+    //Events lost because nobody took them out in time.
+    int GetDroppedCount() const { return m_dropped; }
+};
+
+#endif//PLAYEREVENTRING_H
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "PlayerMemoryPool.h"
+
+PlayerMemoryPool::PlayerMemoryPool() :
+    m_packetBufferAllocations(0),
+    m_packetBufferReuses(0),
+    m_frameAllocations(0),
+    m_frameReuses(0),
+    m_scratchAllocations(0)
+{
+    for (int i = 0; i < SizeClassCount; ++i)
+    {
+        m_sizeClasses[i].pool = NULL;
+    }
+}
+
+PlayerMemoryPool::~PlayerMemoryPool()
+{
+    //Buffers still referenced by packets keep their pool alive until they are released.
+    for (int i = 0; i < SizeClassCount; ++i)
+    {
+        if (m_sizeClasses[i].pool != NULL)
+            av_buffer_pool_uninit(&m_sizeClasses[i].pool);
+    }
+    for (auto frame : m_freeFrames)
+    {
+        av_frame_free(&frame);
+    }
+    m_freeFrames.clear();
+}
+
+bool PlayerMemoryPool::CopyPacket(AVPacket* dst, const AVPacket* src)
+{
+    int requiredSize = src->size + FF_INPUT_BUFFER_PADDING_SIZE;
+    int sizeClass = 0;
+    while (sizeClass < SizeClassCount && (1 << (sizeClass + MinSizeClassShift)) < requiredSize)
+        ++sizeClass;
+    if (sizeClass == SizeClassCount)
+    {
+        ++m_packetBufferAllocations;
+        return av_packet_ref(dst, src) >= 0;
+    }
+
+    SizeClass& cls = m_sizeClasses[sizeClass];
+    if (cls.pool == NULL)
+        cls.pool = av_buffer_pool_init(1 << (sizeClass + MinSizeClassShift), NULL);
+    AVBufferRef* buffer = cls.pool != NULL ? av_buffer_pool_get(cls.pool) : NULL;
+    if (buffer == NULL)
+        return false;
+    auto known = std::lower_bound(cls.knownBuffers.begin(), cls.knownBuffers.end(), buffer->data);
+    if (known != cls.knownBuffers.end() && *known == buffer->data)
+    {
+        ++m_packetBufferReuses;
+    }
+    else
+    {
+        cls.knownBuffers.insert(known, buffer->data);
+        ++m_packetBufferAllocations;
+    }
+
+    if (av_packet_copy_props(dst, src) < 0)
+    {
+        av_buffer_unref(&buffer);
+        return false;
+    }
+    memcpy(buffer->data, src->data, src->size);
+    memset(buffer->data + src->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    dst->buf = buffer;
+    dst->data = buffer->data;
+    dst->size = src->size;
+    return true;
+}
+
+AVFrame* PlayerMemoryPool::AllocFrame()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        if (!m_freeFrames.empty())
+        {
+            AVFrame* frame = m_freeFrames.back();
+            m_freeFrames.pop_back();
+            ++m_frameReuses;
+            return frame;
+        }
+    }
+    ++m_frameAllocations;
+    return av_frame_alloc();
+}
+
+void PlayerMemoryPool::FreeFrame(AVFrame** frame)
+{
+    if (*frame == NULL)
+        return;
+    av_frame_unref(*frame);
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_freeFrames.push_back(*frame);
+    *frame = NULL;
+}
+
+uint8_t* PlayerMemoryPool::AllocScratch(int size)
+{
+    ++m_scratchAllocations;
+    return (uint8_t*)av_malloc(size);
+}
+
+void PlayerMemoryPool::FreeScratch(uint8_t** buffer)
+{
+    av_freep(buffer);
+}
+
+void PlayerMemoryPool::GetStats(PlayerAllocationStats& stats) const
+{
+    stats.packetBufferAllocations = m_packetBufferAllocations;
+    stats.packetBufferReuses = m_packetBufferReuses;
+    stats.frameAllocations = m_frameAllocations;
+    stats.frameReuses = m_frameReuses;
+    stats.scratchAllocations = m_scratchAllocations;
+}
@@ -0,0 +1,49 @@
+#ifndef PLAYERMEMORYPOOL_H
+#define PLAYERMEMORYPOOL_H
+
+struct PlayerAllocationStats
+{
+    int64_t packetBufferAllocations; //packet payload buffers the pools had to create
+    int64_t packetBufferReuses;      //packet payloads served from recycled buffers
+    int64_t frameAllocations;        //AVFrame shells created with av_frame_alloc
+    int64_t frameReuses;             //AVFrame shells served from the free list
+    int64_t scratchAllocations;      //picture and conversion buffers
+};
+
+//Per player recycling of packet payloads, AVFrame shells and picture buffers.
+//Every player owns its own pool so players never contend on one allocator, and
+//the counters show whether a playing player still allocates anything.
+class PlayerMemoryPool
+{
+    enum { MinSizeClassShift = 10, SizeClassCount = 16 }; //1 KB .. 32 MB payloads
+
+    struct SizeClass
+    {
+        AVBufferPool* pool;
+        std::vector<uint8_t*> knownBuffers; //sorted, tells pool hits from fresh buffers
+    };
+
+    SizeClass m_sizeClasses[SizeClassCount];
+    std::vector<AVFrame*> m_freeFrames;
+    std::mutex m_frameMutex;
+    std::atomic<int64_t> m_packetBufferAllocations;
+    std::atomic<int64_t> m_packetBufferReuses;
+    std::atomic<int64_t> m_frameAllocations;
+    std::atomic<int64_t> m_frameReuses;
+    std::atomic<int64_t> m_scratchAllocations;
+
+    PlayerMemoryPool(const PlayerMemoryPool&) = delete;
+    PlayerMemoryPool& operator=(const PlayerMemoryPool&) = delete;
+public:
+    PlayerMemoryPool();
+    ~PlayerMemoryPool();
+    //Copies a packet the demuxer still owns into a recycled payload buffer. Demuxer thread only.
+    bool CopyPacket(AVPacket* dst, const AVPacket* src);
+    AVFrame* AllocFrame();
+    void FreeFrame(AVFrame** frame);
+    uint8_t* AllocScratch(int size);
+    void FreeScratch(uint8_t** buffer);
+    void GetStats(PlayerAllocationStats& stats) const;
+};
+
+#endif//PLAYERMEMORYPOOL_H
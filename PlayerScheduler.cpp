@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+
+ScheduledTask::ScheduledTask(ThreadSignal& signal, const std::function<StepResult(int64_t&)>& step) :
+    m_signal(signal),
+    m_step(step),
+    m_scheduler(NULL),
+    m_state(State::stopped),
+    m_urgent(false),
+    m_worker(0),
+    m_timerGeneration(0)
+{
+
+}
+
+ScheduledTask::~ScheduledTask()
+{
+    Stop();
+}
+
+void ScheduledTask::Start(PlayerScheduler* scheduler, bool urgent /*= false*/)
+{
+    m_scheduler = scheduler;
+    if (scheduler == NULL)
+    {
+        m_thread = std::thread([this] { this->ThreadFunc(); });
+        return;
+    }
+    m_urgent = urgent;
+    m_worker = scheduler->m_nextWorker++ % (int)scheduler->m_queues.size();
+    //Bound first, a notification sent before the first step must not get lost.
+    m_signal.SetTask(this);
+    m_state = State::queued;
+    scheduler->Enqueue(this);
+}
+
+void ScheduledTask::Stop()
+{
+    if (m_scheduler == NULL)
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+        return;
+    }
+    m_signal.SetTask(NULL);
+    PlayerScheduler* scheduler = m_scheduler;
+    ++scheduler->m_idleWaiters;
+    while (true)
+    {
+        State state = m_state;
+        if (state == State::stopped)
+            break;
+        if (state == State::idle)
+        {
+            if (m_state.compare_exchange_strong(state, State::stopped))
+                break;
+            continue;
+        }
+        if (state == State::queued)
+        {
+            if (scheduler->Remove(this, State::stopped))
+                break;
+            //Taken by a thread or not pushed yet by whoever queued it.
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(scheduler->m_idleMutex);
+        scheduler->m_idleCondition.wait(lock, [this]
+        {
+            State state = m_state;
+            return state != State::running && state != State::runningWoken;
+        });
+    }
+    --scheduler->m_idleWaiters;
+    scheduler->RemoveTimers(this);
+}
+
+void ScheduledTask::Wake()
+{
+    State state = m_state;
+    while (true)
+    {
+        if (state == State::idle)
+        {
+            if (m_state.compare_exchange_weak(state, State::queued))
+            {
+                m_scheduler->Enqueue(this);
+                return;
+            }
+        }
+        else if (state == State::running)
+        {
+            if (m_state.compare_exchange_weak(state, State::runningWoken))
+                return;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+bool ScheduledTask::RunPending()
+{
+    if (m_scheduler == NULL || m_state != State::queued)
+        return false;
+    if (!m_scheduler->Remove(this, State::running))
+        return false;
+    m_scheduler->Run(this, SCHEDULER_STEP_BUDGET);
+    return true;
+}
+
+void ScheduledTask::ThreadFunc()
+{
+    while (true)
+    {
+        int64_t delay = 0;
+        switch (m_step(delay))
+        {
+        case StepResult::again:
+            break;
+        case StepResult::wait:
+            m_signal.Wait();
+            break;
+        case StepResult::waitFor:
+            m_signal.WaitFor(delay);
+            break;
+        case StepResult::finished:
+            return;
+        }
+    }
+}
+
+PlayerScheduler::PlayerScheduler(int threads /*= 0*/) :
+    m_queuedCount(0),
+    m_nextDeadline(INT64_MAX),
+    m_sleepers(0),
+    m_idleWaiters(0),
+    m_nextWorker(0),
+    m_stopping(false)
+{
+    if (threads <= 0)
+        threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    for (int i = 0; i < threads; ++i)
+        m_queues.push_back(new TaskQueue());
+    for (int i = 0; i < threads; ++i)
+        m_threads.push_back(std::thread([this, i] { this->ThreadFunc(i); }));
+}
+
+PlayerScheduler::~PlayerScheduler()
+{
+    m_stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_workCondition.notify_all();
+    }
+    for (auto& thread : m_threads)
+        thread.join();
+    for (auto queue : m_queues)
+        delete queue;
+}
+
+void PlayerScheduler::Enqueue(ScheduledTask* task)
+{
+    TaskQueue* queue = task->m_urgent ? &m_urgentQueue : m_queues[task->m_worker];
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->tasks.push_back(task);
+        ++queue->size;
+        ++m_queuedCount;
+    }
+    WakeSleeper();
+}
+
+void PlayerScheduler::WakeSleeper()
+{
+    //A thread about to sleep counts itself first and then looks for work, so either it sees
+    //the new work or it is counted here.
+    if (m_sleepers == 0)
+        return;
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_workCondition.notify_one();
+}
+
+bool PlayerScheduler::Remove(ScheduledTask* task, ScheduledTask::State newState)
+{
+    TaskQueue* queue = task->m_urgent ? &m_urgentQueue : m_queues[task->m_worker];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    auto it = std::find(queue->tasks.begin(), queue->tasks.end(), task);
+    if (it == queue->tasks.end())
+        return false;
+    queue->tasks.erase(it);
+    --queue->size;
+    --m_queuedCount;
+    task->m_state = newState;
+    return true;
+}
+
+void PlayerScheduler::RemoveTimers(ScheduledTask* task)
+{
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    size_t count = m_timers.size();
+    m_timers.erase(std::remove_if(m_timers.begin(), m_timers.end(),
+        [task](const Timer& timer) { return timer.task == task; }), m_timers.end());
+    if (m_timers.size() != count)
+        std::make_heap(m_timers.begin(), m_timers.end());
+    m_nextDeadline = m_timers.empty() ? INT64_MAX : m_timers.front().deadline.time_since_epoch().count();
+}
+
+void PlayerScheduler::AddTimer(ScheduledTask* task, int64_t delay)
+{
+    Timer timer = { std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), task, task->m_timerGeneration };
+    bool earliest = false;
+    {
+        std::lock_guard<std::mutex> lock(m_timerMutex);
+        m_timers.push_back(timer);
+        std::push_heap(m_timers.begin(), m_timers.end());
+        int64_t deadline = timer.deadline.time_since_epoch().count();
+        if (deadline < m_nextDeadline)
+        {
+            m_nextDeadline = deadline;
+            earliest = true;
+        }
+    }
+    //Sleeping threads wait for the previous earliest deadline, one of them has to wait for this one.
+    if (earliest)
+        WakeSleeper();
+}
+
+ScheduledTask* PlayerScheduler::TakeFront(TaskQueue* queue)
+{
+    if (queue->size == 0)
+        return NULL;
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tasks.empty())
+        return NULL;
+    ScheduledTask* task = queue->tasks.front();
+    queue->tasks.pop_front();
+    --queue->size;
+    --m_queuedCount;
+    task->m_state = ScheduledTask::State::running;
+    return task;
+}
+
+ScheduledTask* PlayerScheduler::TakeTask(int worker)
+{
+    ScheduledTask* task = TakeFront(&m_urgentQueue);
+    if (task != NULL)
+        return task;
+    task = TakeFront(m_queues[worker]);
+    if (task != NULL)
+        return task;
+    //Stolen from the back, where the tasks least likely to still be in the other core's cache wait.
+    for (size_t i = 1; i < m_queues.size() && m_queuedCount > 0; ++i)
+    {
+        TaskQueue* queue = m_queues[(worker + i) % m_queues.size()];
+        if (queue->size == 0)
+            continue;
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (queue->tasks.empty())
+            continue;
+        task = queue->tasks.back();
+        queue->tasks.pop_back();
+        --queue->size;
+        --m_queuedCount;
+        task->m_state = ScheduledTask::State::running;
+        task->m_worker = worker;
+        return task;
+    }
+    return NULL;
+}
+
+void PlayerScheduler::FireTimers()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now.time_since_epoch().count() < m_nextDeadline)
+        return;
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    while (!m_timers.empty() && m_timers.front().deadline <= now)
+    {
+        Timer timer = m_timers.front();
+        std::pop_heap(m_timers.begin(), m_timers.end());
+        m_timers.pop_back();
+        //A task run since the timer was armed does not need it anymore. One still finishing
+        //the run that armed it is told to run again, as if it was woken.
+        if (timer.task->m_timerGeneration != timer.generation)
+            continue;
+        ScheduledTask::State state = ScheduledTask::State::idle;
+        if (timer.task->m_state.compare_exchange_strong(state, ScheduledTask::State::queued))
+        {
+            Enqueue(timer.task);
+        }
+        else if (state == ScheduledTask::State::running)
+        {
+            timer.task->m_state.compare_exchange_strong(state, ScheduledTask::State::runningWoken);
+        }
+    }
+    m_nextDeadline = m_timers.empty() ? INT64_MAX : m_timers.front().deadline.time_since_epoch().count();
+}
+
+void PlayerScheduler::Run(ScheduledTask* task, int budget)
+{
+    ++task->m_timerGeneration;
+    int64_t delay = 0;
+    StepResult result = StepResult::again;
+    for (int i = 0; i < budget && result == StepResult::again; ++i)
+        result = task->m_step(delay);
+    if (result == StepResult::finished)
+    {
+        task->m_state = ScheduledTask::State::stopped;
+    }
+    else if (result == StepResult::again)
+    {
+        //Behind the tasks already queued, a busy player does not starve the others.
+        task->m_state = ScheduledTask::State::queued;
+        Enqueue(task);
+    }
+    else
+    {
+        //Armed while still running, a timer due at once then counts as a wakeup.
+        if (result == StepResult::waitFor)
+            AddTimer(task, delay);
+        ScheduledTask::State state = ScheduledTask::State::running;
+        if (!task->m_state.compare_exchange_strong(state, ScheduledTask::State::idle))
+        {
+            task->m_state = ScheduledTask::State::queued;
+            Enqueue(task);
+        }
+    }
+    //The task may be gone once it is idle or stopped, only the scheduler is touched from here on.
+    if (m_idleWaiters > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_idleCondition.notify_all();
+    }
+}
+
+void PlayerScheduler::ThreadFunc(int worker)
+{
+    while (!m_stopping)
+    {
+        FireTimers();
+        ScheduledTask* task = TakeTask(worker);
+        if (task != NULL)
+        {
+            Run(task, SCHEDULER_STEP_BUDGET);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        ++m_sleepers;
+        if (m_queuedCount == 0 && !m_stopping)
+        {
+            int64_t deadline = m_nextDeadline;
+            if (deadline == INT64_MAX)
+                m_workCondition.wait(lock);
+            else
+                m_workCondition.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(deadline)));
+        }
+        --m_sleepers;
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef PLAYERSCHEDULER_H
+#define PLAYERSCHEDULER_H
+
+#define SCHEDULER_STEP_BUDGET 8 //steps a task runs in a row before the others get their turn
+
+class ThreadSignal;
+class PlayerScheduler;
+
+//What a task step wants next.
+enum class StepResult
+{
+    again,   //more work is ready, run the next step
+    wait,    //sleep until the task's signal is notified
+    waitFor, //sleep until notified or the delay the step gave passed
+    finished //never run again
+};
+
+//One of a player's loops, e.g. decoding or presenting, split into steps that return instead
+//of waiting. Started without a scheduler it gets a thread of its own that waits on the signal
+//between steps, started on a PlayerScheduler the signal queues it on the scheduler instead.
+class ScheduledTask
+{
+    enum class State
+    {
+        stopped, //not started or stopped, nothing refers to the task
+        idle,    //waits for its signal or a timer
+        queued,  //in a queue, or about to be pushed into one by whoever queued it
+        running,
+        runningWoken //notified while running, queued again afterwards
+    };
+
+    ThreadSignal& m_signal;
+    std::function<StepResult(int64_t&)> m_step;
+    std::thread m_thread;
+    PlayerScheduler* m_scheduler;
+    //Scheduler mode only. A state change is a compare and swap, so exactly one thread moves
+    //the task into a queue; a task only leaves a queue under that queue's lock.
+    std::atomic<State> m_state;
+    bool m_urgent;
+    std::atomic<int> m_worker; //queue the task goes back to, keeps a player's data on one core
+    std::atomic<unsigned> m_timerGeneration; //timers armed before the latest run are stale
+
+    ScheduledTask(const ScheduledTask&) = delete;
+    ScheduledTask& operator=(const ScheduledTask&) = delete;
+
+    void ThreadFunc();
+    friend class PlayerScheduler;
+public:
+    //step is called with a delay to fill in when it returns StepResult::waitFor, in milliseconds.
+    ScheduledTask(ThreadSignal& signal, const std::function<StepResult(int64_t&)>& step);
+    ~ScheduledTask();
+    //scheduler NULL runs the task on its own thread. Urgent tasks run before all others.
+    void Start(PlayerScheduler* scheduler, bool urgent = false);
+    //Returns once no step runs and none will, the owner has to make the step see it is destroying
+    //and notify the signal first so that a task on its own thread ends.
+    void Stop();
+    //Called through the signal.
+    void Wake();
+    //Runs the task on the calling thread if it is queued on a scheduler, so a step of another task
+    //that waits for it cannot deadlock the pool. Returns false if there was nothing to run.
+    bool RunPending();
+};
+
+//Fixed set of threads, one per core, running the tasks of any number of players. Each thread
+//has a queue of its own behind a lock of its own and takes work from the back of the others'
+//queues when it runs out, tasks woken again go back to the queue they ran from. Presenting
+//tasks are urgent and run before everything else, a late frame is worse than a late decode.
+//Threads with nothing to do sleep until work is queued or the earliest timer is due.
+//Every player started on the scheduler has to be destroyed before it.
+class PlayerScheduler
+{
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point deadline;
+        ScheduledTask* task;
+        unsigned generation;
+        bool operator<(const Timer& other) const { return deadline > other.deadline; }
+    };
+
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<ScheduledTask*> tasks;
+        std::atomic<int> size; //of tasks, read without the lock to skip empty queues
+        TaskQueue() : size(0) {}
+    };
+
+    std::vector<std::thread> m_threads;
+    std::vector<TaskQueue*> m_queues; //one per thread
+    TaskQueue m_urgentQueue;
+    std::atomic<int> m_queuedCount; //tasks in all queues, lets sleeping threads check without locking
+    std::mutex m_timerMutex;
+    std::vector<Timer> m_timers; //heap, earliest deadline first
+    std::atomic<int64_t> m_nextDeadline; //of the heap top in steady clock ticks, max when none
+    std::mutex m_sleepMutex;
+    std::condition_variable m_workCondition;
+    std::atomic<int> m_sleepers;
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCondition; //a task stopped running, for Stop
+    std::atomic<int> m_idleWaiters;
+    std::atomic<int> m_nextWorker; //spreads started tasks over the queues
+    std::atomic<bool> m_stopping;
+
+    PlayerScheduler(const PlayerScheduler&) = delete;
+    PlayerScheduler& operator=(const PlayerScheduler&) = delete;
+
+    void ThreadFunc(int worker);
+    //Pushes a task the caller moved to State::queued.
+    void Enqueue(ScheduledTask* task);
+    //Takes a queued task out of its queue unless a thread took it already, true if it was removed.
+    bool Remove(ScheduledTask* task, ScheduledTask::State newState);
+    void RemoveTimers(ScheduledTask* task);
+    void AddTimer(ScheduledTask* task, int64_t delay);
+    ScheduledTask* TakeTask(int worker);
+    ScheduledTask* TakeFront(TaskQueue* queue);
+    void FireTimers();
+    void WakeSleeper();
+    //Runs steps of a task taken from a queue and queues it again or leaves it idle.
+    void Run(ScheduledTask* task, int budget);
+    friend class ScheduledTask;
+public:
+    //0 threads uses one per core.
+    PlayerScheduler(int threads = 0);
+    ~PlayerScheduler();
+    int GetThreadCount() const { return (int)m_threads.size(); }
+};
+
+#endif//PLAYERSCHEDULER_H
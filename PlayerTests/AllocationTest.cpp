@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PlayerMemoryPool.h"
+#include "TestPlayer.h"
+#include "PlayerTests.h"
+
+#define ALLOCATION_TEST_CLIP_SECONDS 10
+#define ALLOCATION_TEST_WARMUP_MS 2000 //queues filled and every buffer seen once
+#define ALLOCATION_TEST_MEASURE_MS 4000
+#define ALLOCATION_TEST_QUEUE_DEPTH 8
+
+static void CheckSteadyPlayback(std::vector<uint8_t>& clip, PlayerScheduler* scheduler)
+{
+    TestPlayerListener listener;
+    FfmpegPlayer player;
+    listener.m_player = &player;
+    player.SetScheduler(scheduler);
+    //A frame queue that grows allocates its new frames on purpose, a fixed depth leaves only
+    //the steady state to measure.
+    player.SetFrameQueueDepth(ALLOCATION_TEST_QUEUE_DEPTH, ALLOCATION_TEST_QUEUE_DEPTH);
+    if (!TEST_CHECK(player.Initialize(clip.data(), clip.size(), &listener)))
+        return;
+    if (!TEST_CHECK(PlayerTestWaitFor([&] { return listener.m_initialized.load(); }, TEST_CLIP_WAIT_MS)))
+        return;
+    player.Play();
+    std::this_thread::sleep_for(std::chrono::milliseconds(ALLOCATION_TEST_WARMUP_MS));
+    PlayerAllocationStats before;
+    player.GetAllocationStats(before);
+    int framesBefore = listener.m_frames;
+    std::this_thread::sleep_for(std::chrono::milliseconds(ALLOCATION_TEST_MEASURE_MS));
+    PlayerAllocationStats after;
+    player.GetAllocationStats(after);
+    int frames = listener.m_frames - framesBefore;
+    printf("  %s: %d frames shown, allocations packets %lld -> %lld, frames %lld -> %lld, scratch %lld -> %lld\n",
+        scheduler != NULL ? "scheduler" : "own threads", frames,
+        (long long)before.packetBufferAllocations, (long long)after.packetBufferAllocations,
+        (long long)before.frameAllocations, (long long)after.frameAllocations,
+        (long long)before.scratchAllocations, (long long)after.scratchAllocations);
+    //Half the frame rate at least, a player that stalled would allocate nothing either.
+    TEST_CHECK(frames >= ALLOCATION_TEST_MEASURE_MS * TEST_CLIP_FRAME_RATE / 2000);
+    TEST_CHECK(!listener.m_ended);
+    TEST_CHECK(listener.m_errors == 0);
+    TEST_CHECK(after.packetBufferAllocations == before.packetBufferAllocations);
+    TEST_CHECK(after.frameAllocations == before.frameAllocations);
+    TEST_CHECK(after.scratchAllocations == before.scratchAllocations);
+}
+
+//Plays a clip and checks that the counters of FfmpegPlayer::GetAllocationStats stand still
+//once playback is steady, on threads of the player's own and on a scheduler.
+void RunAllocationTest()
+{
+    std::vector<uint8_t> clip;
+    if (!TEST_CHECK(MakeTestClip(clip, ALLOCATION_TEST_CLIP_SECONDS)))
+        return;
+    CheckSteadyPlayback(clip, NULL);
+    PlayerScheduler scheduler;
+    CheckSteadyPlayback(clip, &scheduler);
+}
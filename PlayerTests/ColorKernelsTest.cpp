@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <stdlib.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+#include "ColorKernels.h"
+#include "PlayerTests.h"
+
+#define KERNEL_TEST_MAX_WIDTH 67 //every remainder of the widest kernel's 64 pixel loop
+#define KERNEL_TEST_WIDTH 1920
+#define KERNEL_TEST_HEIGHT 1080
+#define KERNEL_TEST_GUARD 64 //bytes behind a row that no kernel may write
+#define KERNEL_TEST_MIN_PSNR 40.0 //dB against sws_scale, an RMS error of 2.5 levels
+#define KERNEL_BENCHMARK_FRAMES 50
+
+struct KernelLevel
+{
+    const char* name;
+    ColorKernelLevel level;
+};
+
+static const KernelLevel s_levels[] =
+{
+    { "scalar", ColorKernelLevel::scalar },
+    { "sse2", ColorKernelLevel::sse2 },
+    { "avx2", ColorKernelLevel::avx2 },
+    { "avx-512", ColorKernelLevel::avx512 }
+};
+
+struct KernelFormats
+{
+    const char* name;
+    AVPixelFormat srcFormat;
+    AVPixelFormat dstFormat;
+};
+
+static const KernelFormats s_formats[] =
+{
+    { "yuv420p to rgba", AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA },
+    { "yuv420p to bgra", AV_PIX_FMT_YUV420P, AV_PIX_FMT_BGRA },
+    { "nv12 to rgba", AV_PIX_FMT_NV12, AV_PIX_FMT_RGBA },
+    { "nv12 to bgra", AV_PIX_FMT_NV12, AV_PIX_FMT_BGRA }
+};
+
+//The SIMD kernels promise the scalar kernel's output bit for bit, for every width and
+//without writing past the row.
+static void CheckRowsMatchScalar(const KernelFormats& formats, const KernelLevel& level, ColorRowKernel kernel)
+{
+    ColorRowKernel scalar = FindColorRowKernel(formats.srcFormat, AVCOL_RANGE_MPEG, formats.dstFormat, ColorKernelLevel::scalar);
+    std::vector<uint8_t> y(KERNEL_TEST_MAX_WIDTH);
+    std::vector<uint8_t> u(KERNEL_TEST_MAX_WIDTH + 1);
+    std::vector<uint8_t> v(KERNEL_TEST_MAX_WIDTH + 1);
+    std::vector<uint8_t> expected(KERNEL_TEST_MAX_WIDTH * 4);
+    std::vector<uint8_t> row(KERNEL_TEST_MAX_WIDTH * 4 + KERNEL_TEST_GUARD);
+    srand(1);
+    bool matches = true;
+    bool inRow = true;
+    for (int width = 1; width <= KERNEL_TEST_MAX_WIDTH; ++width)
+    {
+        for (auto& value : y)
+            value = (uint8_t)rand();
+        for (auto& value : u)
+            value = (uint8_t)rand();
+        for (auto& value : v)
+            value = (uint8_t)rand();
+        scalar(y.data(), u.data(), v.data(), expected.data(), width);
+        memset(row.data(), 0xCD, row.size());
+        kernel(y.data(), u.data(), v.data(), row.data(), width);
+        matches = matches && memcmp(row.data(), expected.data(), width * 4) == 0;
+        for (int i = width * 4; i < width * 4 + KERNEL_TEST_GUARD; ++i)
+            inRow = inRow && row[i] == 0xCD;
+    }
+    if (!matches || !inRow)
+        printf("  %s %s differs from scalar\n", formats.name, level.name);
+    TEST_CHECK(matches);
+    TEST_CHECK(inRow);
+}
+
+//Smooth chroma: swscale interpolates nv12 chroma where the kernels repeat it, which only
+//differs noticeably at sharp chroma edges.
+static void FillPicture(AVFrame* frame)
+{
+    bool nv12 = frame->format == AV_PIX_FMT_NV12;
+    for (int y = 0; y < frame->height; ++y)
+    {
+        uint8_t* row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; ++x)
+            row[x] = (uint8_t)(x * 7 + y * 3);
+    }
+    for (int y = 0; y < frame->height / 2; ++y)
+    {
+        for (int x = 0; x < frame->width / 2; ++x)
+        {
+            uint8_t u = (uint8_t)(16 + 224 * y / (frame->height / 2));
+            uint8_t v = (uint8_t)(16 + 224 * x / (frame->width / 2));
+            if (nv12)
+            {
+                frame->data[1][y * frame->linesize[1] + x * 2] = u;
+                frame->data[1][y * frame->linesize[1] + x * 2 + 1] = v;
+            }
+            else
+            {
+                frame->data[1][y * frame->linesize[1] + x] = u;
+                frame->data[2][y * frame->linesize[2] + x] = v;
+            }
+        }
+    }
+}
+
+static void ConvertPicture(ColorRowKernel kernel, const AVFrame* src, uint8_t* dst, int dstLinesize)
+{
+    bool nv12 = src->format == AV_PIX_FMT_NV12;
+    for (int y = 0; y < src->height; ++y)
+    {
+        const uint8_t* u = src->data[1] + (y / 2) * src->linesize[1];
+        const uint8_t* v = nv12 ? NULL : src->data[2] + (y / 2) * src->linesize[2];
+        kernel(src->data[0] + y * src->linesize[0], u, v, dst + y * dstLinesize, src->width);
+    }
+}
+
+//Colour channels only, both write opaque alpha.
+static double PictureSnr(const uint8_t* a, const uint8_t* b, int pixels, int& maxError)
+{
+    double squares = 0;
+    maxError = 0;
+    for (int i = 0; i < pixels * 4; ++i)
+    {
+        if (i % 4 == 3)
+            continue;
+        int error = abs(a[i] - b[i]);
+        squares += error * error;
+        maxError = std::max(maxError, error);
+    }
+    double mse = squares / (pixels * 3.0);
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static void CheckFormats(const KernelFormats& formats)
+{
+    AVFrame* src = av_frame_alloc();
+    src->format = formats.srcFormat;
+    src->width = KERNEL_TEST_WIDTH;
+    src->height = KERNEL_TEST_HEIGHT;
+    uint8_t* reference[4] = { NULL };
+    int referenceLinesize[4] = { 0 };
+    uint8_t* dst[4] = { NULL };
+    int dstLinesize[4] = { 0 };
+    int size = av_image_alloc(reference, referenceLinesize, KERNEL_TEST_WIDTH, KERNEL_TEST_HEIGHT, formats.dstFormat, 1);
+    SwsContext* context = sws_getContext(KERNEL_TEST_WIDTH, KERNEL_TEST_HEIGHT, formats.srcFormat,
+        KERNEL_TEST_WIDTH, KERNEL_TEST_HEIGHT, formats.dstFormat, SWS_BILINEAR, NULL, NULL, NULL);
+    if (TEST_CHECK(av_frame_get_buffer(src, 32) >= 0 && size > 0 && context != NULL &&
+        av_image_alloc(dst, dstLinesize, KERNEL_TEST_WIDTH, KERNEL_TEST_HEIGHT, formats.dstFormat, 1) == size))
+    {
+        FillPicture(src);
+        double start = PlayerTestSeconds();
+        for (int i = 0; i < KERNEL_BENCHMARK_FRAMES; ++i)
+            sws_scale(context, src->data, src->linesize, 0, KERNEL_TEST_HEIGHT, reference, referenceLinesize);
+        double swsSeconds = (PlayerTestSeconds() - start) / KERNEL_BENCHMARK_FRAMES;
+        printf("  %s: sws_scale %.2f ms/frame\n", formats.name, swsSeconds * 1000);
+        double scalarSeconds = 0;
+        for (const KernelLevel& level : s_levels)
+        {
+            ColorRowKernel kernel = FindColorRowKernel(formats.srcFormat, AVCOL_RANGE_MPEG, formats.dstFormat, level.level);
+            if (kernel == NULL)
+            {
+                printf("    %-8s not supported here\n", level.name);
+                continue;
+            }
+            if (level.level != ColorKernelLevel::scalar)
+                CheckRowsMatchScalar(formats, level, kernel);
+            ConvertPicture(kernel, src, dst[0], dstLinesize[0]);
+            int maxError = 0;
+            double snr = PictureSnr(dst[0], reference[0], KERNEL_TEST_WIDTH * KERNEL_TEST_HEIGHT, maxError);
+            TEST_CHECK(snr >= KERNEL_TEST_MIN_PSNR);
+            start = PlayerTestSeconds();
+            for (int i = 0; i < KERNEL_BENCHMARK_FRAMES; ++i)
+                ConvertPicture(kernel, src, dst[0], dstLinesize[0]);
+            double seconds = (PlayerTestSeconds() - start) / KERNEL_BENCHMARK_FRAMES;
+            if (level.level == ColorKernelLevel::scalar)
+                scalarSeconds = seconds;
+            printf("    %-8s %.2f ms/frame, %.1fx scalar, %.1fx sws_scale, %.1f dB against sws_scale, max error %d\n",
+                level.name, seconds * 1000, scalarSeconds / seconds, swsSeconds / seconds, snr, maxError);
+        }
+    }
+    sws_freeContext(context);
+    av_freep(&reference[0]);
+    av_freep(&dst[0]);
+    av_frame_free(&src);
+}
+
+//The row kernels of every SIMD level the CPU has: bit exact with the scalar kernel, within
+//KERNEL_TEST_MIN_PSNR of swscale on a 1080p picture, and their speed on it.
+void RunColorKernelsTest()
+{
+    for (const KernelFormats& formats : s_formats)
+        CheckFormats(formats);
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "WorkerPool.h"
+#include "ColorKernels.h"
+#include "SlicedConverter.h"
+#include "TestPlayer.h"
+#include "PlayerTests.h"
+
+#define CONVERTER_BENCHMARK_SECONDS 0.5 //least time measured per case, so 8K gets more than one frame
+
+struct SourceResolution
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+//Slicing pays off with the picture size, 4K and 8K are the pictures one thread can't keep up with.
+static const SourceResolution s_sourceResolutions[] =
+{
+    { "1080p", 1920, 1080 },
+    { "2160p", 3840, 2160 },
+    { "4320p", 7680, 4320 }
+};
+
+struct ConversionCase
+{
+    const char* name;
+    AVPixelFormat dstFormat;
+    int dstWidth; //0 keeps the source size
+    int dstHeight;
+};
+
+//Row kernels, scaling before the slices, and swscale per slice.
+static const ConversionCase s_conversionCases[] =
+{
+    { "yuv420p to rgba", AV_PIX_FMT_RGBA, 0, 0 },
+    { "yuv420p to rgba 720p", AV_PIX_FMT_RGBA, 1280, 720 },
+    { "yuv420p to rgb24", AV_PIX_FMT_RGB24, 0, 0 }
+};
+
+//Slices converted at once, 0 is one per core.
+static const int s_sliceThreads[] = { 1, 2, 4, 0 };
+
+//Repeats a conversion for at least CONVERTER_BENCHMARK_SECONDS, returns frames per second.
+static double MeasureFps(const std::function<void()>& convert)
+{
+    int frames = 0;
+    double start = PlayerTestSeconds();
+    double seconds = 0;
+    do
+    {
+        convert();
+        ++frames;
+        seconds = PlayerTestSeconds() - start;
+    } while (seconds < CONVERTER_BENCHMARK_SECONDS);
+    return frames / seconds;
+}
+
+//Frames per second and the megabytes per second of source picture they take in.
+static void PrintRate(double fps, int srcSize)
+{
+    printf(" %7.1f fps %8.0f MB/s\n", fps, fps * srcSize / 1000000);
+}
+
+static void MeasureCase(const AVFrame* src, int srcSize, const ConversionCase& conversion)
+{
+    int dstWidth = conversion.dstWidth > 0 ? conversion.dstWidth : src->width;
+    int dstHeight = conversion.dstHeight > 0 ? conversion.dstHeight : src->height;
+    uint8_t* reference[4] = { NULL };
+    int referenceLinesize[4] = { 0 };
+    uint8_t* dst[4] = { NULL };
+    int dstLinesize[4] = { 0 };
+    int size = av_image_alloc(reference, referenceLinesize, dstWidth, dstHeight, conversion.dstFormat, 1);
+    if (!TEST_CHECK(size > 0 && av_image_alloc(dst, dstLinesize, dstWidth, dstHeight, conversion.dstFormat, 1) == size))
+    {
+        av_freep(&reference[0]);
+        return;
+    }
+    printf("    %s:\n", conversion.name);
+    SwsContext* context = sws_getContext(src->width, src->height, (AVPixelFormat)src->format,
+        dstWidth, dstHeight, conversion.dstFormat, SWS_BILINEAR, NULL, NULL, NULL);
+    if (TEST_CHECK(context != NULL))
+    {
+        printf("      sws_scale     ");
+        PrintRate(MeasureFps([&]
+        {
+            sws_scale(context, src->data, src->linesize, 0, src->height, dst, dstLinesize);
+        }), srcSize);
+        sws_freeContext(context);
+    }
+    SlicedConverter converter;
+    converter.SetThreads(1);
+    converter.Convert(src, conversion.dstFormat, dstWidth, dstHeight, reference, referenceLinesize);
+    for (int threads : s_sliceThreads)
+    {
+        converter.SetThreads(threads);
+        memset(dst[0], 0, size);
+        converter.Convert(src, conversion.dstFormat, dstWidth, dstHeight, dst, dstLinesize);
+        //However it is sliced the picture is the same, slices must not leave seams.
+        TEST_CHECK(memcmp(dst[0], reference[0], size) == 0);
+        double fps = MeasureFps([&]
+        {
+            converter.Convert(src, conversion.dstFormat, dstWidth, dstHeight, dst, dstLinesize);
+        });
+        if (threads > 0)
+            printf("      %2d slices     ", threads);
+        else
+            printf("      one per core  ");
+        PrintRate(fps, srcSize);
+    }
+    av_freep(&reference[0]);
+    av_freep(&dst[0]);
+}
+
+//Throughput of SlicedConverter by source resolution and by the number of slices converted at
+//once, next to one sws_scale over the whole frame. Every slicing has to give the picture of
+//one slice.
+void RunConverterBenchmark()
+{
+    printf("  %d threads with the worker pool\n", WorkerPool::Shared()->GetThreadCount() + 1);
+    for (const SourceResolution& resolution : s_sourceResolutions)
+    {
+        AVFrame* src = av_frame_alloc();
+        src->format = AV_PIX_FMT_YUV420P;
+        src->width = resolution.width;
+        src->height = resolution.height;
+        src->color_range = AVCOL_RANGE_MPEG;
+        if (TEST_CHECK(av_frame_get_buffer(src, 32) >= 0))
+        {
+            DrawTestPattern(src, 0);
+            int srcSize = avpicture_get_size(AV_PIX_FMT_YUV420P, resolution.width, resolution.height);
+            printf("  %s source, %.1f MB a frame\n", resolution.name, srcSize / 1000000.0);
+            for (const ConversionCase& conversion : s_conversionCases)
+                MeasureCase(src, srcSize, conversion);
+        }
+        av_frame_free(&src);
+    }
+}
@@ -0,0 +1,89 @@
+// PlayerTests.cpp : Checks and benchmarks of the player's parts, next to the demo application.
+// Runs every test without arguments, otherwise the ones named, e.g. "PlayerTests ring".
+// Returns the number of failed tests.
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "PlayerTests.h"
+
+struct PlayerTest
+{
+    const _TCHAR* name;
+    void (*run)();
+};
+
+static const PlayerTest s_tests[] =
+{
+    { _T("ring"), RunRingBenchmark },
+    { _T("allocations"), RunAllocationTest },
+    { _T("converter"), RunConverterBenchmark },
+    { _T("kernels"), RunColorKernelsTest },
+    { _T("push"), RunPushInputTest },
+    { _T("scheduler"), RunSchedulerTest }
+};
+
+static int s_failedChecks = 0;
+
+bool PlayerTestCheck(bool passed, const char* expression, const char* file, int line)
+{
+    if (!passed)
+    {
+        ++s_failedChecks;
+        printf("  FAILED %s (%s:%d)\n", expression, file, line);
+    }
+    return passed;
+}
+
+double PlayerTestSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool PlayerTestWaitFor(const std::function<bool()>& condition, int64_t milliseconds)
+{
+    double deadline = PlayerTestSeconds() + milliseconds / 1000.0;
+    while (!condition())
+    {
+        if (PlayerTestSeconds() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+    av_register_all();
+    int failedTests = 0;
+    for (const PlayerTest& test : s_tests)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            selected = selected || _tcscmp(argv[i], test.name) == 0;
+        if (!selected)
+            continue;
+        _tprintf(_T("%s\n"), test.name);
+        int failedChecks = s_failedChecks;
+        test.run();
+        if (s_failedChecks != failedChecks)
+            ++failedTests;
+    }
+    printf(failedTests == 0 ? "passed\n" : "%d failed\n", failedTests);
+    return failedTests;
+}
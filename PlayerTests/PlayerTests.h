@@ -0,0 +1,21 @@
+#ifndef PLAYERTESTS_H
+#define PLAYERTESTS_H
+
+//Reports a failed check with where it is. The test goes on, so one run lists every failure.
+#define TEST_CHECK(condition) PlayerTestCheck((condition), #condition, __FILE__, __LINE__)
+
+bool PlayerTestCheck(bool passed, const char* expression, const char* file, int line);
+//Steady clock seconds, for the benchmarks.
+double PlayerTestSeconds();
+//Polls condition until it holds, false if it did not within milliseconds.
+bool PlayerTestWaitFor(const std::function<bool()>& condition, int64_t milliseconds);
+
+//Checks and benchmarks, run by name from PlayerTests.cpp.
+void RunRingBenchmark();
+void RunAllocationTest();
+void RunConverterBenchmark();
+void RunColorKernelsTest();
+void RunPushInputTest();
+void RunSchedulerTest();
+
+#endif//PLAYERTESTS_H
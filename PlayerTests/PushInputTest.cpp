@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "PushInput.h"
+#include "TestPlayer.h"
+#include "PlayerTests.h"
+
+#define PUSH_TEST_CLIP_SECONDS 12
+#define PUSH_TEST_FEED_MS 6000 //the whole clip arrives at twice the playback speed
+#define PUSH_TEST_CHUNK_MS 50
+
+//Plays a clip through a PushInput while a thread feeds it in like a download of unknown size.
+//The first frame has to be on screen while most of the clip is still missing, and playback
+//has to run to the end of the clip once it is complete.
+void RunPushInputTest()
+{
+    std::vector<uint8_t> clip;
+    if (!TEST_CHECK(MakeTestClip(clip, PUSH_TEST_CLIP_SECONDS)))
+        return;
+    PushInput input;
+    std::thread feeder([&]
+    {
+        size_t chunk = clip.size() / (PUSH_TEST_FEED_MS / PUSH_TEST_CHUNK_MS) + 1;
+        for (size_t offset = 0; offset < clip.size(); offset += chunk)
+        {
+            if (!input.Push(clip.data() + offset, (int)std::min(chunk, clip.size() - offset)))
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(PUSH_TEST_CHUNK_MS));
+        }
+        input.Finish();
+    });
+    {
+        TestPlayerListener listener;
+        FfmpegPlayer player;
+        listener.m_player = &player;
+        double start = PlayerTestSeconds();
+        if (TEST_CHECK(player.Initialize(&input, &listener)) &&
+            TEST_CHECK(PlayerTestWaitFor([&] { return listener.m_initialized.load(); }, TEST_CLIP_WAIT_MS)))
+        {
+            player.Play();
+            if (TEST_CHECK(PlayerTestWaitFor([&] { return listener.m_frames > 0; }, TEST_CLIP_WAIT_MS)))
+            {
+                int64_t received = input.Received();
+                printf("  first frame after %.0f ms with %lld of %lld bytes in\n",
+                    (PlayerTestSeconds() - start) * 1000, (long long)received, (long long)clip.size());
+                TEST_CHECK(received < (int64_t)clip.size() / 2);
+            }
+            TEST_CHECK(PlayerTestWaitFor([&] { return listener.m_ended.load(); },
+                PUSH_TEST_CLIP_SECONDS * 1000 + TEST_CLIP_WAIT_MS));
+            printf("  %d frames shown, the last at %lld ms\n", listener.m_frames.load(), (long long)listener.m_lastFrameTime.load());
+            TEST_CHECK(listener.m_lastFrameTime >= (PUSH_TEST_CLIP_SECONDS - 1) * 1000);
+            TEST_CHECK(listener.m_frames >= PUSH_TEST_CLIP_SECONDS * TEST_CLIP_FRAME_RATE / 2);
+            TEST_CHECK(listener.m_errors == 0);
+        }
+    }
+    //Destroying the player aborted the input, which ends a feed still running.
+    feeder.join();
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerMemoryPool.h"
+#include "AVPacketQueue.h"
+#include "PlayerTests.h"
+
+#define RING_BENCHMARK_PACKETS 200000
+#define RING_BENCHMARK_SLOTS 256
+#define RING_BENCHMARK_PAYLOAD 4096 //bytes, about a packet of a small video frame
+#define RING_BENCHMARK_RUNS 3 //the best run is reported
+#define RING_BENCHMARK_STALL_MS 1000 //a side that sleeps this long missed a wakeup
+
+//The list queue the ring replaced, as the baseline the ring is measured against: every put
+//allocates a SmartAvPacket holding a deep copy of the packet, under a recursive mutex, and
+//every get frees it again. The old queue dropped its oldest packet when full; this one waits
+//for space instead, so both queues carry every packet.
+class ListPacketQueue
+{
+public:
+    struct SmartAvPacket
+    {
+        AVPacket m_packet;
+        int m_error;
+        SmartAvPacket(const AVPacket* packet) : m_error(av_copy_packet(&m_packet, packet)) {}
+        ~SmartAvPacket()
+        {
+            if (!m_error)
+                av_free_packet(&m_packet);
+        }
+    };
+private:
+    std::list<SmartAvPacket*> m_queue;
+    size_t m_sizeLimit;
+    std::recursive_mutex m_mutex;
+    std::condition_variable_any m_dataArrived;
+    std::condition_variable_any m_spaceFreed;
+public:
+    ListPacketQueue(size_t sizeLimit) : m_sizeLimit(sizeLimit) {}
+    ~ListPacketQueue()
+    {
+        for (auto pack : m_queue)
+            delete pack;
+    }
+    bool PutPacket(const AVPacket* packet)
+    {
+        SmartAvPacket* newPack = new SmartAvPacket(packet);
+        if (newPack->m_error)
+        {
+            delete newPack;
+            return false;
+        }
+        std::unique_lock<std::recursive_mutex> lock(m_mutex);
+        while (m_queue.size() >= m_sizeLimit)
+            m_spaceFreed.wait(lock);
+        m_queue.push_back(newPack);
+        m_dataArrived.notify_one();
+        return true;
+    }
+    //The caller deletes the packet once decoded.
+    SmartAvPacket* GetPacket()
+    {
+        std::unique_lock<std::recursive_mutex> lock(m_mutex);
+        while (m_queue.empty())
+            m_dataArrived.wait(lock);
+        SmartAvPacket* pack = m_queue.front();
+        m_queue.pop_front();
+        m_spaceFreed.notify_one();
+        return pack;
+    }
+};
+
+static void MakePacket(AVPacket* packet, const AVPacket* payload, int64_t number)
+{
+    av_init_packet(packet);
+    packet->data = NULL;
+    packet->size = 0;
+    av_packet_ref(packet, payload);
+    packet->pts = number;
+    packet->dts = number;
+}
+
+//Demuxer and decoder on two threads, each sleeping on its signal while the ring is full or
+//empty as the player's do. Returns nanoseconds per packet.
+static double MeasureRing(const AVPacket* payload)
+{
+    AVPacketQueue queue(NULL, INT64_MAX, INT64_MAX, RING_BENCHMARK_SLOTS);
+    ThreadSignal dataSignal;
+    ThreadSignal spaceSignal;
+    queue.SetSignals(&dataSignal, &spaceSignal);
+    int consumerStalls = 0;
+    int producerStalls = 0;
+    int64_t received = 0;
+    bool ordered = true;
+    double start = PlayerTestSeconds();
+    std::thread consumer([&]
+    {
+        AVPacket packet;
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        while (received < RING_BENCHMARK_PACKETS)
+        {
+            if (!queue.GetPacket(&packet))
+            {
+                if (!dataSignal.WaitFor(RING_BENCHMARK_STALL_MS))
+                    ++consumerStalls;
+                continue;
+            }
+            ordered = ordered && packet.pts == received;
+            ++received;
+            av_free_packet(&packet);
+        }
+    });
+    AVPacket packet;
+    for (int64_t i = 0; i < RING_BENCHMARK_PACKETS; ++i)
+    {
+        MakePacket(&packet, payload, i);
+        while (!queue.PutPacket(&packet))
+        {
+            if (!spaceSignal.WaitFor(RING_BENCHMARK_STALL_MS))
+                ++producerStalls;
+        }
+    }
+    consumer.join();
+    double seconds = PlayerTestSeconds() - start;
+    TEST_CHECK(received == RING_BENCHMARK_PACKETS);
+    TEST_CHECK(ordered);
+    TEST_CHECK(consumerStalls == 0);
+    TEST_CHECK(producerStalls == 0);
+    TEST_CHECK(queue.IsEmpty() && queue.GetBytes() == 0);
+    return seconds * 1e9 / RING_BENCHMARK_PACKETS;
+}
+
+static double MeasureListQueue(const AVPacket* payload)
+{
+    ListPacketQueue queue(RING_BENCHMARK_SLOTS);
+    bool ordered = true;
+    double start = PlayerTestSeconds();
+    std::thread consumer([&]
+    {
+        for (int64_t i = 0; i < RING_BENCHMARK_PACKETS; ++i)
+        {
+            ListPacketQueue::SmartAvPacket* pack = queue.GetPacket();
+            ordered = ordered && pack->m_packet.pts == i;
+            delete pack;
+        }
+    });
+    AVPacket packet;
+    bool copied = true;
+    for (int64_t i = 0; i < RING_BENCHMARK_PACKETS; ++i)
+    {
+        MakePacket(&packet, payload, i);
+        copied = copied && queue.PutPacket(&packet);
+        av_free_packet(&packet);
+    }
+    consumer.join();
+    double seconds = PlayerTestSeconds() - start;
+    TEST_CHECK(copied);
+    TEST_CHECK(ordered);
+    return seconds * 1e9 / RING_BENCHMARK_PACKETS;
+}
+
+//The packet ring between demuxer and decoders, see AVPacketQueue. Checks that every packet
+//arrives in order and that neither side ever sleeps through a wakeup, then reports the cost
+//per packet next to the list queue it replaced, which allocated and deep copied every packet.
+void RunRingBenchmark()
+{
+    AVPacket payload;
+    av_init_packet(&payload);
+    if (!TEST_CHECK(av_new_packet(&payload, RING_BENCHMARK_PAYLOAD) == 0))
+        return;
+    double ring = 0;
+    double list = 0;
+    for (int run = 0; run < RING_BENCHMARK_RUNS; ++run)
+    {
+        double ringRun = MeasureRing(&payload);
+        double listRun = MeasureListQueue(&payload);
+        ring = run == 0 ? ringRun : std::min(ring, ringRun);
+        list = run == 0 ? listRun : std::min(list, listRun);
+    }
+    printf("  %d packets through %d slots: ring %.0f ns/packet, list queue %.0f ns/packet\n",
+        RING_BENCHMARK_PACKETS, RING_BENCHMARK_SLOTS, ring, list);
+    av_free_packet(&payload);
+}
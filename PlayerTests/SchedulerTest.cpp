@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "TestPlayer.h"
+#include "PlayerTests.h"
+
+#define SCHEDULER_TEST_THREADS 2 //fewer than players, so they have to share
+#define SCHEDULER_TEST_PLAYERS 4
+#define SCHEDULER_TEST_CLIP_SECONDS 6
+#define SCHEDULER_TEST_WAKEUPS 10 //per timer task
+#define SCHEDULER_TEST_MAX_LATENESS_MS 25 //95th percentile, the 15.6 ms Windows timer tick and some headroom
+
+//Sleeps a fixed delay between steps, as a presenting task waits for the next frame's time,
+//and records how late each step ran.
+class TimerTask
+{
+    ThreadSignal m_signal;
+    int64_t m_delay;
+    int m_wakeups;
+    std::chrono::steady_clock::time_point m_due;
+
+    StepResult Step(int64_t& delay)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (m_wakeups > 0)
+            m_lateness.push_back(std::chrono::duration<double, std::milli>(now - m_due).count());
+        if (++m_wakeups > SCHEDULER_TEST_WAKEUPS)
+        {
+            m_done = true;
+            return StepResult::finished;
+        }
+        m_due = now + std::chrono::milliseconds(m_delay);
+        delay = m_delay;
+        return StepResult::waitFor;
+    }
+public:
+    ScheduledTask m_task;
+    std::vector<double> m_lateness; //milliseconds, read once m_done is set
+    std::atomic<bool> m_done;
+
+    TimerTask(int64_t delay) :
+        m_delay(delay),
+        m_wakeups(0),
+        m_task(m_signal, [this](int64_t& delay) { return Step(delay); }),
+        m_done(false)
+    {
+
+    }
+};
+
+//Timers armed while every thread sleeps toward a later deadline have to wake one of them.
+//The long delays start first, so the short ones always arrive while the threads sleep.
+static void CheckTimerLatency()
+{
+    static const int64_t delays[] = { 300, 100, 20, 5 };
+    PlayerScheduler scheduler(SCHEDULER_TEST_THREADS);
+    std::vector<TimerTask*> tasks;
+    for (int64_t delay : delays)
+    {
+        TimerTask* task = new TimerTask(delay);
+        task->m_task.Start(&scheduler);
+        tasks.push_back(task);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_CHECK(PlayerTestWaitFor([&]
+    {
+        return std::all_of(tasks.begin(), tasks.end(), [](TimerTask* task) { return task->m_done.load(); });
+    }, delays[0] * (SCHEDULER_TEST_WAKEUPS + 1) + TEST_CLIP_WAIT_MS));
+    std::vector<double> lateness;
+    for (TimerTask* task : tasks)
+    {
+        task->m_task.Stop();
+        lateness.insert(lateness.end(), task->m_lateness.begin(), task->m_lateness.end());
+        delete task;
+    }
+    if (!TEST_CHECK(!lateness.empty()))
+        return;
+    std::sort(lateness.begin(), lateness.end());
+    double percentile = lateness[lateness.size() * 95 / 100];
+    printf("  %d timers on %d sleeping threads: late by %.2f ms median, %.2f ms 95th percentile, %.2f ms at most\n",
+        (int)lateness.size(), SCHEDULER_TEST_THREADS, lateness[lateness.size() / 2], percentile, lateness.back());
+    TEST_CHECK(lateness.front() >= 0);
+    TEST_CHECK(percentile <= SCHEDULER_TEST_MAX_LATENESS_MS);
+}
+
+//More players than threads on one scheduler, every one of them has to play at its frame rate.
+static void CheckPlayers()
+{
+    std::vector<uint8_t> clip;
+    if (!TEST_CHECK(MakeTestClip(clip, SCHEDULER_TEST_CLIP_SECONDS)))
+        return;
+    PlayerScheduler scheduler(SCHEDULER_TEST_THREADS);
+    TestPlayerListener listeners[SCHEDULER_TEST_PLAYERS];
+    FfmpegPlayer players[SCHEDULER_TEST_PLAYERS];
+    for (int i = 0; i < SCHEDULER_TEST_PLAYERS; ++i)
+    {
+        listeners[i].m_player = &players[i];
+        players[i].SetScheduler(&scheduler);
+        TEST_CHECK(players[i].Initialize(clip.data(), clip.size(), &listeners[i]));
+    }
+    for (int i = 0; i < SCHEDULER_TEST_PLAYERS; ++i)
+    {
+        if (TEST_CHECK(PlayerTestWaitFor([&] { return listeners[i].m_initialized.load(); }, TEST_CLIP_WAIT_MS)))
+            players[i].Play();
+    }
+    for (int i = 0; i < SCHEDULER_TEST_PLAYERS; ++i)
+    {
+        TEST_CHECK(PlayerTestWaitFor([&] { return listeners[i].m_ended.load(); },
+            SCHEDULER_TEST_CLIP_SECONDS * 1000 + TEST_CLIP_WAIT_MS));
+        printf("  player %d: %d frames shown, the last at %lld ms\n", i, listeners[i].m_frames.load(),
+            (long long)listeners[i].m_lastFrameTime.load());
+        TEST_CHECK(listeners[i].m_frames >= SCHEDULER_TEST_CLIP_SECONDS * TEST_CLIP_FRAME_RATE / 2);
+        TEST_CHECK(listeners[i].m_errors == 0);
+    }
+}
+
+//PlayerScheduler: timers fire on time while its threads sleep, and several players share
+//its threads without any of them falling behind.
+void RunSchedulerTest()
+{
+    CheckTimerLatency();
+    CheckPlayers();
+}
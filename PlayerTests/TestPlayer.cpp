@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "TestPlayer.h"
+
+void DrawTestPattern(AVFrame* frame, int number)
+{
+    //A gradient scrolling right and a bar moving down, enough motion for P frames to matter.
+    int bar = (number * 4) % frame->height;
+    for (int y = 0; y < frame->height; ++y)
+    {
+        uint8_t* row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; ++x)
+            row[x] = y >= bar && y < bar + 16 ? 235 : (uint8_t)(16 + (x + number * 2) % 220);
+    }
+    for (int y = 0; y < frame->height / 2; ++y)
+    {
+        uint8_t* u = frame->data[1] + y * frame->linesize[1];
+        uint8_t* v = frame->data[2] + y * frame->linesize[2];
+        for (int x = 0; x < frame->width / 2; ++x)
+        {
+            u[x] = (uint8_t)(64 + (y + number) % 128);
+            v[x] = (uint8_t)(64 + (x + number) % 128);
+        }
+    }
+}
+
+static bool WritePacket(AVFormatContext* formatCtx, AVStream* stream, AVPacket* packet)
+{
+    av_packet_rescale_ts(packet, stream->codec->time_base, stream->time_base);
+    packet->stream_index = stream->index;
+    return av_interleaved_write_frame(formatCtx, packet) >= 0;
+}
+
+bool MakeTestClip(std::vector<uint8_t>& clip, int seconds)
+{
+    AVFormatContext* formatCtx = NULL;
+    AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    if (codec == NULL || avformat_alloc_output_context2(&formatCtx, NULL, "avi", NULL) < 0)
+        return false;
+    AVStream* stream = avformat_new_stream(formatCtx, codec);
+    AVFrame* frame = av_frame_alloc();
+    bool ok = stream != NULL && frame != NULL;
+    if (ok)
+    {
+        AVCodecContext* codecCtx = stream->codec;
+        codecCtx->width = TEST_CLIP_WIDTH;
+        codecCtx->height = TEST_CLIP_HEIGHT;
+        codecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+        codecCtx->time_base.num = 1;
+        codecCtx->time_base.den = TEST_CLIP_FRAME_RATE;
+        codecCtx->gop_size = TEST_CLIP_FRAME_RATE;
+        codecCtx->bit_rate = 2000000;
+        stream->time_base = codecCtx->time_base;
+        if (formatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+            codecCtx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+        frame->format = codecCtx->pix_fmt;
+        frame->width = codecCtx->width;
+        frame->height = codecCtx->height;
+        ok = avcodec_open2(codecCtx, codec, NULL) >= 0 &&
+            av_frame_get_buffer(frame, 32) >= 0 &&
+            avio_open_dyn_buf(&formatCtx->pb) >= 0 &&
+            avformat_write_header(formatCtx, NULL) >= 0;
+    }
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    int gotPacket = 0;
+    for (int i = 0; ok && i < seconds * TEST_CLIP_FRAME_RATE; ++i)
+    {
+        ok = av_frame_make_writable(frame) >= 0;
+        if (!ok)
+            break;
+        DrawTestPattern(frame, i);
+        frame->pts = i;
+        ok = avcodec_encode_video2(stream->codec, &packet, frame, &gotPacket) >= 0 &&
+            (!gotPacket || WritePacket(formatCtx, stream, &packet));
+    }
+    //Drains the frames the encoder still holds.
+    while (ok)
+    {
+        gotPacket = 0;
+        ok = avcodec_encode_video2(stream->codec, &packet, NULL, &gotPacket) >= 0 &&
+            (!gotPacket || WritePacket(formatCtx, stream, &packet));
+        if (!gotPacket)
+            break;
+    }
+    ok = ok && av_write_trailer(formatCtx) >= 0;
+    if (formatCtx->pb != NULL)
+    {
+        uint8_t* data = NULL;
+        int size = avio_close_dyn_buf(formatCtx->pb, &data);
+        formatCtx->pb = NULL;
+        if (ok)
+            clip.assign(data, data + size);
+        av_free(data);
+    }
+    if (stream != NULL)
+        avcodec_close(stream->codec);
+    av_frame_free(&frame);
+    avformat_free_context(formatCtx);
+    return ok;
+}
+
+TestPlayerListener::TestPlayerListener() :
+    m_player(NULL),
+    m_initialized(false),
+    m_ended(false),
+    m_frames(0),
+    m_errors(0),
+    m_lastFrameTime(-1)
+{
+
+}
+
+void TestPlayerListener::NextFrameAvailable()
+{
+    PlayerFramePlanes planes;
+    if (m_player->AcquireFrame(planes))
+    {
+        m_lastFrameTime = planes.presentationTime;
+        m_player->ReleaseFrame(planes);
+    }
+    ++m_frames;
+}
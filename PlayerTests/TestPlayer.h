@@ -0,0 +1,40 @@
+#ifndef TESTPLAYER_H
+#define TESTPLAYER_H
+
+#include "FfmpegPlayer.h"
+
+#define TEST_CLIP_WIDTH 640
+#define TEST_CLIP_HEIGHT 360
+#define TEST_CLIP_FRAME_RATE 25
+#define TEST_CLIP_WAIT_MS 5000 //longest a test waits for a player to report something
+
+//Fills a yuv420p frame with picture number of a moving test pattern.
+void DrawTestPattern(AVFrame* frame, int number);
+//Encodes a moving test pattern to an MPEG-4 AVI in memory, a keyframe every second, so the
+//playback tests need no sample file.
+bool MakeTestClip(std::vector<uint8_t>& clip, int seconds);
+
+//Counts what a player reports. Every frame announced is pinned and released again, as an
+//application drawing it would.
+class TestPlayerListener : public FfmpegPlayerListener
+{
+public:
+    FfmpegPlayer* m_player;
+    std::atomic<bool> m_initialized;
+    std::atomic<bool> m_ended;
+    std::atomic<int> m_frames;
+    std::atomic<int> m_errors;
+    std::atomic<int64_t> m_lastFrameTime; //presentation time of the latest frame, milliseconds
+
+    TestPlayerListener();
+    void Stopped() {}
+    void Paused() {}
+    void Playing() {}
+    void Initialized() { m_initialized = true; }
+    void SeekDone(int64_t timeMilliceconds) {}
+    void NextFrameAvailable();
+    void FileEnded() { m_ended = true; }
+    void Error(int64_t errorCode) { ++m_errors; }
+};
+
+#endif//TESTPLAYER_H
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#include "PushInput.h"
+
+PushInput::PushInput(int64_t totalSize, int readTimeoutMilliseconds) :
+    m_received(0),
+    m_totalSize(totalSize > 0 ? totalSize : -1),
+    m_readTimeout(readTimeoutMilliseconds > 0 ? readTimeoutMilliseconds : PUSH_INPUT_READ_TIMEOUT_MS),
+    m_finished(false),
+    m_aborted(false)
+{
+
+}
+
+PushInput::~PushInput()
+{
+    for (auto block : m_blocks)
+        delete[] block;
+}
+
+bool PushInput::Push(const uint8_t* data, int size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_finished || m_aborted)
+        return false;
+    while (size > 0)
+    {
+        int64_t blockOffset = m_received % PUSH_INPUT_BLOCK_SIZE;
+        //Fixed blocks, a growing input is never copied to a bigger buffer.
+        if (blockOffset == 0)
+            m_blocks.push_back(new uint8_t[PUSH_INPUT_BLOCK_SIZE]);
+        int chunk = (int)std::min<int64_t>(size, PUSH_INPUT_BLOCK_SIZE - blockOffset);
+        memcpy(m_blocks.back() + blockOffset, data, chunk);
+        m_received += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    m_dataArrived.notify_all();
+    return true;
+}
+
+void PushInput::Finish()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished = true;
+    m_totalSize = m_received;
+    m_dataArrived.notify_all();
+}
+
+void PushInput::Abort()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_aborted = true;
+    m_dataArrived.notify_all();
+}
+
+int64_t PushInput::Received() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_received;
+}
+
+int64_t PushInput::Size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_totalSize;
+}
+
+int PushInput::Read(int64_t position, uint8_t* buffer, int size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    //A stalled input fails the read after the timeout instead of hanging the demuxer.
+    bool arrived = m_dataArrived.wait_for(lock, std::chrono::milliseconds(m_readTimeout),
+        [this, position] { return m_received > position || m_finished || m_aborted; });
+    if (m_aborted)
+        return AVERROR_EXIT;
+    if (!arrived)
+        return AVERROR(ETIMEDOUT);
+    if (position >= m_received)
+        return AVERROR_EOF;
+    int copied = 0;
+    size = (int)std::min<int64_t>(size, m_received - position);
+    while (copied < size)
+    {
+        int64_t blockOffset = (position + copied) % PUSH_INPUT_BLOCK_SIZE;
+        int chunk = (int)std::min<int64_t>(size - copied, PUSH_INPUT_BLOCK_SIZE - blockOffset);
+        memcpy(buffer + copied, m_blocks[(size_t)((position + copied) / PUSH_INPUT_BLOCK_SIZE)] + blockOffset, chunk);
+        copied += chunk;
+    }
+    return copied;
+}
+
+int push_input_read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    PushInputReader* reader = (PushInputReader*)opaque;
+    int read = reader->input->Read(reader->position, buf, buf_size);
+    if (read > 0)
+        reader->position += read;
+    return read;
+}
+
+int64_t push_input_seek(void *opaque, int64_t offset, int whence)
+{
+    PushInputReader* reader = (PushInputReader*)opaque;
+    int64_t size = reader->input->Size();
+    int64_t position = -1;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case SEEK_SET:
+        position = offset;
+        break;
+    case SEEK_CUR:
+        position = reader->position + offset;
+        break;
+    case SEEK_END:
+        if (size < 0)
+            return -1;
+        position = size + offset;
+        break;
+    case AVSEEK_SIZE:
+        return size;
+    }
+    //Unknown sizes allow any position, the reads wait for it.
+    if (position < 0 || (size >= 0 && position > size))
+        return -1;
+    reader->position = position;
+    return position;
+}
@@ -0,0 +1,56 @@
+#ifndef PUSHINPUT_H
+#define PUSHINPUT_H
+
+#define PUSH_INPUT_BLOCK_SIZE (1024 * 1024) //bytes per storage block
+#define PUSH_INPUT_READ_TIMEOUT_MS 10000 //a read waiting longer for data fails
+#define PUSH_INPUT_PROBE_SIZE (1024 * 1024) //bytes read to find the streams before playback starts
+#define PUSH_INPUT_ANALYZE_DURATION 1000 //milliseconds of streams read before playback starts
+
+//Input the application feeds while its bytes arrive, e.g. from a download or a pipe.
+//Reads wait until the bytes they need are pushed, so the player starts as soon as the
+//header and the first frames are in. Everything pushed is kept, the player can seek back
+//at once while a seek ahead waits for the data to get there.
+//One player reads an input, which aborts it when the player is destroyed.
+class PushInput
+{
+    std::vector<uint8_t*> m_blocks;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_dataArrived;
+    int64_t m_received;
+    int64_t m_totalSize; //-1 while unknown
+    int m_readTimeout;
+    bool m_finished;
+    bool m_aborted;
+
+    PushInput(const PushInput&) = delete;
+    PushInput& operator=(const PushInput&) = delete;
+public:
+    //totalSize, e.g. a download's content length, lets the demuxer seek to the end of the input
+    //before it arrives, -1 if unknown.
+    PushInput(int64_t totalSize = -1, int readTimeoutMilliseconds = PUSH_INPUT_READ_TIMEOUT_MS);
+    ~PushInput();
+    //Appends the next bytes of the input, false once it was finished or aborted.
+    bool Push(const uint8_t* data, int size);
+    //No more bytes will come, reads past the end return end of file instead of waiting.
+    void Finish();
+    //Fails every waiting and later read.
+    void Abort();
+    int64_t Received() const;
+    //Total size if known or finished, -1 otherwise.
+    int64_t Size() const;
+    //Copies up to size bytes at position, waiting for at least one of them to arrive.
+    //Returns the bytes copied or an AVERROR code.
+    int Read(int64_t position, uint8_t* buffer, int size);
+};
+
+//Read position of one demuxer on a PushInput, the opaque of the AVIOContext callbacks below.
+struct PushInputReader
+{
+    PushInput* input;
+    int64_t position;
+};
+
+int push_input_read_packet(void *opaque, uint8_t *buf, int buf_size);
+int64_t push_input_seek(void *opaque, int64_t offset, int whence);
+
+#endif//PUSHINPUT_H
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <stdint.h>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#include "ReadAheadFile.h"
+
+#ifndef _WIN32
+#define READ_AHEAD_WAKE_TAG UINT64_MAX //user_data of the eventfd read that wakes the ring thread
+
+//io_uring through its system calls, so liburing is not needed. The ring has an entry per block
+//and one for a read of the wake eventfd, which is always pending: writing the eventfd makes
+//io_uring_enter return when blocks were queued while the ring thread waited for completions.
+struct ReadAheadUring
+{
+    int ring;
+    int wake;
+    bool waiting; //the ring thread is in io_uring_enter, guarded by m_mutex
+    int inFlight; //block reads submitted and not completed
+    uint64_t wakeCount;
+    iovec wakeVector;
+    std::vector<iovec> vectors; //per block, the part still to be read
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+};
+
+static void CloseUring(ReadAheadUring* uring)
+{
+    if (uring->sqes != MAP_FAILED)
+        munmap(uring->sqes, uring->sqesSize);
+    if (uring->cqRing != MAP_FAILED)
+        munmap(uring->cqRing, uring->cqRingSize);
+    if (uring->sqRing != MAP_FAILED)
+        munmap(uring->sqRing, uring->sqRingSize);
+    if (uring->wake >= 0)
+        close(uring->wake);
+    close(uring->ring);
+    delete uring;
+}
+
+//NULL when the kernel has no io_uring (before 5.1, or turned off), reads then run on threads.
+static ReadAheadUring* OpenUring(int blocks)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring = (int)syscall(__NR_io_uring_setup, blocks + 1, &params);
+    if (ring < 0)
+        return NULL;
+    ReadAheadUring* uring = new ReadAheadUring();
+    uring->ring = ring;
+    uring->wake = eventfd(0, EFD_CLOEXEC);
+    uring->waiting = false;
+    uring->inFlight = 0;
+    uring->wakeCount = 0;
+    uring->wakeVector.iov_base = &uring->wakeCount;
+    uring->wakeVector.iov_len = sizeof(uring->wakeCount);
+    uring->vectors.resize(blocks);
+    uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    uring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    uring->cqRing = mmap(NULL, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    uring->sqes = (io_uring_sqe*)mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (uring->wake < 0 || uring->sqRing == MAP_FAILED || uring->cqRing == MAP_FAILED || uring->sqes == MAP_FAILED)
+    {
+        CloseUring(uring);
+        return NULL;
+    }
+    uint8_t* sq = (uint8_t*)uring->sqRing;
+    uring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    uring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    uring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    uring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    uint8_t* cq = (uint8_t*)uring->cqRing;
+    uring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    uring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    uring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    uring->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return uring;
+}
+
+//Queues a read for the next io_uring_enter. There is an entry for every block and the wake
+//read, and each has one read at most, so the ring never overflows.
+static void PrepareRead(ReadAheadUring* uring, int file, const iovec* vector, int64_t offset, uint64_t tag)
+{
+    unsigned tail = *uring->sqTail;
+    unsigned index = tail & uring->sqMask;
+    io_uring_sqe& sqe = uring->sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = file;
+    sqe.addr = (uint64_t)(uintptr_t)vector;
+    sqe.len = 1;
+    sqe.off = (uint64_t)offset;
+    sqe.user_data = tag;
+    uring->sqArray[index] = index;
+    __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//Called with m_mutex held, only the first wake while the ring thread waits writes the eventfd.
+static void WakeUring(ReadAheadUring* uring)
+{
+    if (!uring->waiting)
+        return;
+    uring->waiting = false;
+    uint64_t one = 1;
+    if (write(uring->wake, &one, sizeof(one)) < 0)
+        uring->waiting = true;
+}
+#endif
+
+ReadAheadFile::ReadAheadFile() :
+    m_file(-1),
+    m_uring(NULL),
+    m_readerFailed(false),
+    m_size(0),
+    m_position(0),
+    m_closing(false)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+ReadAheadFile::~ReadAheadFile()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+#ifndef _WIN32
+        if (m_uring != NULL)
+            WakeUring(m_uring);
+#endif
+    }
+    m_requestCondition.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+#ifndef _WIN32
+    if (m_uring != NULL)
+        CloseUring(m_uring);
+#endif
+    for (auto& block : m_blocks)
+        delete[] block.data;
+    if (m_file != -1)
+    {
+#ifdef _WIN32
+        CloseHandle((HANDLE)m_file);
+#else
+        close((int)m_file);
+#endif
+    }
+}
+
+bool ReadAheadFile::Open(const char* filePath, int windowBytes)
+{
+#ifdef _WIN32
+    int length = MultiByteToWideChar(CP_UTF8, 0, filePath, -1, NULL, 0);
+    if (length <= 0)
+        return false;
+    std::vector<wchar_t> widePath(length);
+    MultiByteToWideChar(CP_UTF8, 0, filePath, -1, widePath.data(), length);
+    //Overlapped so the reading threads are not serialized on the handle.
+    HANDLE file = CreateFileW(widePath.data(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    m_file = (intptr_t)file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+        return false;
+    m_size = size.QuadPart;
+#else
+    int file = open(filePath, O_RDONLY);
+    if (file < 0)
+        return false;
+    m_file = file;
+    struct stat info;
+    if (fstat(file, &info) != 0)
+        return false;
+    m_size = info.st_size;
+    posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    int count = std::max(1, (windowBytes + READ_AHEAD_BLOCK_SIZE - 1) / READ_AHEAD_BLOCK_SIZE);
+    m_blocks.resize(count);
+    for (auto& block : m_blocks)
+    {
+        block.index = -1;
+        block.state = BlockState::empty;
+        block.size = 0;
+        block.data = new uint8_t[READ_AHEAD_BLOCK_SIZE];
+    }
+#ifndef _WIN32
+    m_uring = OpenUring(count);
+    if (m_uring != NULL)
+        m_threads.push_back(std::thread([this] { this->UringThreadFunc(); }));
+#endif
+    if (m_threads.empty())
+    {
+        for (int i = 0; i < std::min(count, READ_AHEAD_THREADS); ++i)
+            m_threads.push_back(std::thread([this] { this->ThreadFunc(); }));
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    FillWindow();
+    return true;
+}
+
+void ReadAheadFile::FillWindow()
+{
+    int64_t count = (int64_t)m_blocks.size();
+    int64_t first = m_position / READ_AHEAD_BLOCK_SIZE;
+    int64_t last = std::min(first + count, (m_size + READ_AHEAD_BLOCK_SIZE - 1) / READ_AHEAD_BLOCK_SIZE);
+    bool queued = false;
+    for (int64_t index = first; index < last; ++index)
+    {
+        int slot = (int)(index % count);
+        Block& block = m_blocks[slot];
+        //A block still loading for an old position is queued again once its read finishes.
+        if (block.state == BlockState::loading || (block.index == index && block.state == BlockState::ready))
+            continue;
+        block.index = index;
+        if (m_readerFailed)
+        {
+            block.state = BlockState::failed;
+            continue;
+        }
+        block.state = BlockState::loading;
+        m_requests.push(slot);
+        m_requestCondition.notify_one();
+        queued = true;
+    }
+#ifndef _WIN32
+    if (queued && m_uring != NULL)
+        WakeUring(m_uring);
+#endif
+}
+
+int ReadAheadFile::ReadAt(int64_t offset, uint8_t* buffer, int size, void* event)
+{
+    int done = 0;
+    while (done < size)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)(offset + done);
+        overlapped.OffsetHigh = (DWORD)((offset + done) >> 32);
+        overlapped.hEvent = (HANDLE)event;
+        DWORD read = 0;
+        if (!ReadFile((HANDLE)m_file, buffer + done, size - done, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+            return -1;
+        if (!GetOverlappedResult((HANDLE)m_file, &overlapped, &read, TRUE) || read == 0)
+            return -1;
+#else
+        ssize_t read = pread((int)m_file, buffer + done, size - done, offset + done);
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read <= 0)
+            return -1;
+#endif
+        done += (int)read;
+    }
+    return done;
+}
+
+void ReadAheadFile::ThreadFunc()
+{
+    void* event = NULL;
+#ifdef _WIN32
+    event = CreateEventW(NULL, TRUE, FALSE, NULL);
+#endif
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_requestCondition.wait(lock, [this] { return m_closing || !m_requests.empty(); });
+        if (m_closing)
+            break;
+        Block& block = m_blocks[m_requests.front()];
+        m_requests.pop();
+        int64_t offset = block.index * READ_AHEAD_BLOCK_SIZE;
+        int size = (int)std::min<int64_t>(READ_AHEAD_BLOCK_SIZE, m_size - offset);
+        //Nothing else touches a loading block, its data is filled without the lock.
+        lock.unlock();
+        int read = ReadAt(offset, block.data, size, event);
+        lock.lock();
+        block.size = read;
+        block.state = read == size ? BlockState::ready : BlockState::failed;
+        if (read > 0)
+            m_stats.bytesReadAhead += read;
+        m_loadedCondition.notify_all();
+        FillWindow();
+    }
+#ifdef _WIN32
+    CloseHandle((HANDLE)event);
+#endif
+}
+
+#ifndef _WIN32
+void ReadAheadFile::UringThreadFunc()
+{
+    ReadAheadUring* uring = m_uring;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    PrepareRead(uring, uring->wake, &uring->wakeVector, 0, READ_AHEAD_WAKE_TAG);
+    //Reads in flight write into the blocks, they are waited for before the blocks are freed.
+    while (!m_closing || uring->inFlight > 0)
+    {
+        while (!m_closing && !m_requests.empty())
+        {
+            int slot = m_requests.front();
+            m_requests.pop();
+            Block& block = m_blocks[slot];
+            int64_t offset = block.index * READ_AHEAD_BLOCK_SIZE;
+            block.size = 0; //bytes read so far while loading
+            uring->vectors[slot].iov_base = block.data;
+            uring->vectors[slot].iov_len = (size_t)std::min<int64_t>(READ_AHEAD_BLOCK_SIZE, m_size - offset);
+            PrepareRead(uring, (int)m_file, &uring->vectors[slot], offset, slot);
+            ++uring->inFlight;
+        }
+        unsigned submit = *uring->sqTail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE);
+        uring->waiting = true;
+        lock.unlock();
+        int result = (int)syscall(__NR_io_uring_enter, uring->ring, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        int error = errno;
+        lock.lock();
+        uring->waiting = false;
+        if (result < 0 && error != EINTR && error != EAGAIN && error != EBUSY)
+        {
+            //Only a broken ring gets here. Nothing is read any more, the demuxer gets errors.
+            m_readerFailed = true;
+            for (auto& block : m_blocks)
+            {
+                if (block.state == BlockState::loading)
+                    block.state = BlockState::failed;
+            }
+            m_loadedCondition.notify_all();
+            break;
+        }
+        bool loaded = false;
+        unsigned head = *uring->cqHead;
+        unsigned tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe = uring->cqes[head & uring->cqMask];
+            if (cqe.user_data == READ_AHEAD_WAKE_TAG)
+            {
+                if (!m_closing)
+                    PrepareRead(uring, uring->wake, &uring->wakeVector, 0, READ_AHEAD_WAKE_TAG);
+                continue;
+            }
+            int slot = (int)cqe.user_data;
+            Block& block = m_blocks[slot];
+            iovec& vector = uring->vectors[slot];
+            if (cqe.res > 0)
+            {
+                block.size += cqe.res;
+                m_stats.bytesReadAhead += cqe.res;
+                vector.iov_base = (uint8_t*)vector.iov_base + cqe.res;
+                vector.iov_len -= cqe.res;
+            }
+            //Short reads continue where they stopped.
+            if ((cqe.res > 0 || cqe.res == -EINTR || cqe.res == -EAGAIN) && vector.iov_len > 0 && !m_closing)
+            {
+                PrepareRead(uring, (int)m_file, &vector, block.index * READ_AHEAD_BLOCK_SIZE + block.size, slot);
+                continue;
+            }
+            --uring->inFlight;
+            block.state = vector.iov_len == 0 ? BlockState::ready : BlockState::failed;
+            loaded = true;
+        }
+        __atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+        if (loaded)
+        {
+            m_loadedCondition.notify_all();
+            FillWindow();
+        }
+    }
+}
+#endif
+
+int ReadAheadFile::Read(uint8_t* buffer, int size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_position >= m_size)
+        return AVERROR_EOF;
+    FillWindow();
+    int64_t index = m_position / READ_AHEAD_BLOCK_SIZE;
+    Block& block = m_blocks[(size_t)(index % (int64_t)m_blocks.size())];
+    if (block.index != index || block.state != BlockState::ready)
+    {
+        auto waitStart = std::chrono::steady_clock::now();
+        m_loadedCondition.wait(lock, [&block, index]
+        {
+            return block.index == index && (block.state == BlockState::ready || block.state == BlockState::failed);
+        });
+        ++m_stats.waits;
+        m_stats.waitMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - waitStart).count();
+    }
+    if (block.state == BlockState::failed)
+    {
+        //Loaded again when the demuxer retries.
+        block.index = -1;
+        block.state = BlockState::empty;
+        return AVERROR(EIO);
+    }
+    int64_t blockOffset = m_position - index * READ_AHEAD_BLOCK_SIZE;
+    size = (int)std::min<int64_t>(size, block.size - blockOffset);
+    memcpy(buffer, block.data + blockOffset, size);
+    m_position += size;
+    m_stats.bytesRead += size;
+    return size;
+}
+
+int64_t ReadAheadFile::Seek(int64_t offset, int whence)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int64_t position = -1;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case SEEK_SET:
+        position = offset;
+        break;
+    case SEEK_CUR:
+        position = m_position + offset;
+        break;
+    case SEEK_END:
+        position = m_size + offset;
+        break;
+    case AVSEEK_SIZE:
+        return m_size;
+    }
+    if (position < 0 || position > m_size)
+        return -1;
+    //The window moves along on the next read.
+    m_position = position;
+    return position;
+}
+
+void ReadAheadFile::GetStats(PlayerInputStats& stats)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats = m_stats;
+}
+
+int read_ahead_read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    return ((ReadAheadFile*)opaque)->Read(buf, buf_size);
+}
+
+int64_t read_ahead_seek(void *opaque, int64_t offset, int whence)
+{
+    return ((ReadAheadFile*)opaque)->Seek(offset, whence);
+}
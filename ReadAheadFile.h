@@ -0,0 +1,78 @@
+#ifndef READAHEADFILE_H
+#define READAHEADFILE_H
+
+#define READ_AHEAD_BLOCK_SIZE (256 * 1024) //bytes per read kept in flight
+#define READ_AHEAD_DEFAULT_WINDOW (4 * 1024 * 1024) //bytes read ahead of the demuxer
+#define READ_AHEAD_THREADS 2 //reads in flight at once
+
+struct PlayerInputStats
+{
+    int64_t bytesRead;        //bytes handed to the demuxer
+    int64_t bytesReadAhead;   //bytes read from disk by the read ahead
+    int64_t waits;            //demuxer reads that found their block still loading
+    int64_t waitMicroseconds; //time the demuxer spent in those waits
+};
+
+struct ReadAheadUring; //io_uring state, see ReadAheadFile.cpp
+
+//File read by background threads a window ahead of the demuxer, so a cold disk or a
+//network share stalls them instead of the decoding thread. The window follows seeks,
+//reads still in flight for the old position are finished and then reused. On Linux one
+//thread keeps the whole window in flight through io_uring; without it, and on Windows,
+//READ_AHEAD_THREADS threads read a block each.
+class ReadAheadFile
+{
+    enum class BlockState
+    {
+        empty,
+        loading,
+        ready,
+        failed
+    };
+
+    struct Block
+    {
+        int64_t index; //offset / READ_AHEAD_BLOCK_SIZE, -1 if none
+        BlockState state;
+        int size;
+        uint8_t* data;
+    };
+
+    std::vector<Block> m_blocks; //block index modulo the window
+    std::vector<std::thread> m_threads;
+    std::queue<int> m_requests; //blocks to load
+    std::mutex m_mutex;
+    std::condition_variable m_requestCondition;
+    std::condition_variable m_loadedCondition;
+    intptr_t m_file; //HANDLE or file descriptor, -1 when closed
+    ReadAheadUring* m_uring; //NULL when the blocks are read on threads
+    bool m_readerFailed; //reading stopped for good, every block fails
+    int64_t m_size;
+    int64_t m_position; //demuxer position
+    bool m_closing;
+    PlayerInputStats m_stats;
+
+    ReadAheadFile(const ReadAheadFile&) = delete;
+    ReadAheadFile& operator=(const ReadAheadFile&) = delete;
+
+    void ThreadFunc();
+    void UringThreadFunc();
+    //Queues the blocks of the window starting at the block of m_position, m_mutex must be held.
+    void FillWindow();
+    int ReadAt(int64_t offset, uint8_t* buffer, int size, void* event);
+public:
+    ReadAheadFile();
+    ~ReadAheadFile();
+    //filePath is UTF-8, windowBytes is rounded up to whole blocks.
+    bool Open(const char* filePath, int windowBytes);
+    //Returns the bytes copied or an AVERROR code.
+    int Read(uint8_t* buffer, int size);
+    int64_t Seek(int64_t offset, int whence);
+    void GetStats(PlayerInputStats& stats);
+};
+
+//AVIOContext callbacks with a ReadAheadFile as opaque.
+int read_ahead_read_packet(void *opaque, uint8_t *buf, int buf_size);
+int64_t read_ahead_seek(void *opaque, int64_t offset, int whence);
+
+#endif//READAHEADFILE_H
@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+#include "FrameQueueManager.h"
+#include "DecodingThread.h"
+#include "SeekIndex.h"
+#include "PushInput.h"
+
+SeekIndex::SeekIndex() :
+    m_complete(false),
+    m_cancel(false),
+    m_scannedPts(AV_NOPTS_VALUE),
+    m_endPts(AV_NOPTS_VALUE),
+    m_frameCount(0),
+    m_deferScan(false),
+    m_lastInputUse(std::chrono::steady_clock::now().time_since_epoch().count()),
+    m_streamIndex(-1),
+    m_hash(0),
+    m_modifiedTime(0),
+    m_formatCtx(NULL),
+    m_avioCtx(NULL),
+    m_bufferData(NULL),
+    m_pushReader(NULL)
+{
+    //The player's demuxer reads from the start unless it seeks.
+    m_playerCursor.contiguous = true;
+    m_playerCursor.frameNumber = 0;
+}
+
+SeekIndex::~SeekIndex()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_cancel = true;
+    }
+    m_idleCondition.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+    CloseInput();
+}
+
+uint64_t SeekIndex::HashBytes(uint64_t hash, const uint8_t* data, int64_t size)
+{
+    //FNV-1a, only used to tell inputs apart in the cache.
+    for (int64_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+int64_t SeekIndex::GetFileModifiedTime(const char* filePath)
+{
+#ifdef _WIN32
+    int length = MultiByteToWideChar(CP_UTF8, 0, filePath, -1, NULL, 0);
+    if (length <= 0)
+        return 0;
+    std::vector<wchar_t> widePath(length);
+    MultiByteToWideChar(CP_UTF8, 0, filePath, -1, widePath.data(), length);
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(widePath.data(), GetFileExInfoStandard, &attributes))
+        return 0;
+    return ((int64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat info;
+    if (stat(filePath, &info) != 0)
+        return 0;
+    return (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+}
+
+void SeekIndex::SetCachePath(const char* cacheDirectory)
+{
+    if (cacheDirectory == NULL || cacheDirectory[0] == 0)
+        return;
+    static const char digits[] = "0123456789abcdef";
+    char name[17];
+    for (int i = 0; i < 16; ++i)
+        name[i] = digits[(m_hash >> (60 - i * 4)) & 0xF];
+    name[16] = 0;
+    m_cachePath = cacheDirectory;
+    if (m_cachePath.back() != '/' && m_cachePath.back() != '\\')
+        m_cachePath += '/';
+    m_cachePath += name;
+    m_cachePath += ".seekindex";
+}
+
+void SeekIndex::Start(const char* filePath, int streamIndex, const char* cacheDirectory)
+{
+    m_streamIndex = streamIndex;
+    m_deferScan = true;
+    std::string path(filePath);
+    std::string directory(cacheDirectory != NULL ? cacheDirectory : "");
+    m_thread = std::thread([this, path, directory]
+    {
+        //The input is hashed by its size and both ends, reading all of it would cost as much as indexing.
+        AVIOContext* file = NULL;
+        if (!directory.empty() && avio_open(&file, path.c_str(), AVIO_FLAG_READ) >= 0)
+        {
+            std::vector<uint8_t> span(SEEK_INDEX_HASH_SPAN);
+            int64_t size = avio_size(file);
+            m_hash = HashBytes(0xCBF29CE484222325ULL, (const uint8_t*)&size, sizeof(size));
+            int read = avio_read(file, span.data(), SEEK_INDEX_HASH_SPAN);
+            if (read > 0)
+                m_hash = HashBytes(m_hash, span.data(), read);
+            if (size > SEEK_INDEX_HASH_SPAN && avio_seek(file, size - SEEK_INDEX_HASH_SPAN, SEEK_SET) >= 0)
+            {
+                read = avio_read(file, span.data(), SEEK_INDEX_HASH_SPAN);
+                if (read > 0)
+                    m_hash = HashBytes(m_hash, span.data(), read);
+            }
+            avio_closep(&file);
+            m_modifiedTime = GetFileModifiedTime(path.c_str());
+            SetCachePath(directory.c_str());
+        }
+        bool cached = LoadCache([this, &path]
+        {
+            return avformat_open_input(&m_formatCtx, path.c_str(), NULL, NULL) == 0 &&
+                avformat_find_stream_info(m_formatCtx, NULL) >= 0;
+        });
+        CloseInput();
+        if (cached)
+            return;
+        //Often the player reaches the end first and the file is never opened a second time.
+        if (WaitForIdleInput() && avformat_open_input(&m_formatCtx, path.c_str(), NULL, NULL) == 0)
+        {
+            if (avformat_find_stream_info(m_formatCtx, NULL) >= 0)
+                Build();
+            CloseInput();
+        }
+        if (m_complete)
+            SaveCache();
+    });
+}
+
+void SeekIndex::Start(uint8_t* buffer, int64_t bufferSize, int streamIndex, const char* cacheDirectory, int64_t modifiedTime)
+{
+    m_streamIndex = streamIndex;
+    m_modifiedTime = modifiedTime;
+    m_hash = HashBytes(0xCBF29CE484222325ULL, (const uint8_t*)&bufferSize, sizeof(bufferSize));
+    m_hash = HashBytes(m_hash, buffer, std::min<int64_t>(bufferSize, SEEK_INDEX_HASH_SPAN));
+    if (bufferSize > SEEK_INDEX_HASH_SPAN)
+        m_hash = HashBytes(m_hash, buffer + bufferSize - SEEK_INDEX_HASH_SPAN, SEEK_INDEX_HASH_SPAN);
+    SetCachePath(cacheDirectory);
+    m_thread = std::thread([this, buffer, bufferSize]
+    {
+        //A second reader over the same memory, the player's own one keeps its position.
+        auto openInput = [this, buffer, bufferSize]
+        {
+            int avioBufferSize = DEFAULT_IO_BUFFER_SIZE;
+            m_bufferData = new buffer_data{ buffer, bufferSize, 0, buffer, NULL, 0 };
+            m_avioCtx = avio_alloc_context((uint8_t*)av_malloc(avioBufferSize), avioBufferSize,
+                0, m_bufferData, &read_packet, NULL, &seek);
+            m_formatCtx = avformat_alloc_context();
+            m_formatCtx->pb = m_avioCtx;
+            return avformat_open_input(&m_formatCtx, NULL, NULL, NULL) == 0 &&
+                avformat_find_stream_info(m_formatCtx, NULL) >= 0;
+        };
+        bool cached = LoadCache(openInput);
+        CloseInput();
+        if (cached)
+            return;
+        if (openInput())
+            Build();
+        CloseInput();
+        if (m_complete)
+            SaveCache();
+    });
+}
+
+void SeekIndex::Start(PushInput* input, int streamIndex)
+{
+    m_streamIndex = streamIndex;
+    m_thread = std::thread([this, input]
+    {
+        //A reader of its own, the player's one keeps its position.
+        int avioBufferSize = DEFAULT_IO_BUFFER_SIZE;
+        m_pushReader = new PushInputReader{ input, 0 };
+        m_avioCtx = avio_alloc_context((uint8_t*)av_malloc(avioBufferSize), avioBufferSize,
+            0, m_pushReader, &push_input_read_packet, NULL, &push_input_seek);
+        m_formatCtx = avformat_alloc_context();
+        m_formatCtx->pb = m_avioCtx;
+        if (avformat_open_input(&m_formatCtx, NULL, NULL, NULL) != 0)
+        {
+            CloseInput();
+            return;
+        }
+        if (avformat_find_stream_info(m_formatCtx, NULL) >= 0)
+            Build();
+        CloseInput();
+    });
+}
+
+void SeekIndex::CloseInput()
+{
+    if (m_formatCtx != NULL)
+        avformat_close_input(&m_formatCtx);
+    if (m_avioCtx != NULL)
+    {
+        av_freep(&m_avioCtx->buffer);
+        av_freep(&m_avioCtx);
+    }
+    if (m_bufferData != NULL)
+    {
+        delete m_bufferData;
+        m_bufferData = NULL;
+    }
+    if (m_pushReader != NULL)
+    {
+        delete m_pushReader;
+        m_pushReader = NULL;
+    }
+}
+
+void SeekIndex::AddEntry(const SeekIndexEntry& entry)
+{
+    //Keyframes come in pts order for nearly every file, so this is an append.
+    auto position = std::upper_bound(m_entries.begin(), m_entries.end(), entry.pts,
+        [](int64_t pts, const SeekIndexEntry& other) { return pts < other.pts; });
+    //Both readers pass the same keyframes where they overlap.
+    if (position != m_entries.begin() && (position - 1)->pts == entry.pts)
+    {
+        if ((position - 1)->frameNumber < 0)
+            (position - 1)->frameNumber = entry.frameNumber;
+        return;
+    }
+    m_entries.insert(position, entry);
+}
+
+void SeekIndex::IndexPacket(const AVPacket& packet, Cursor& cursor)
+{
+    if (packet.stream_index != m_streamIndex || m_complete)
+        return;
+    int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+    int64_t dts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+    if (!cursor.contiguous)
+    {
+        if (dts == AV_NOPTS_VALUE || m_scannedPts == AV_NOPTS_VALUE || dts > m_scannedPts)
+            return;
+        cursor.contiguous = true;
+    }
+    if (pts != AV_NOPTS_VALUE)
+    {
+        if (packet.flags & AV_PKT_FLAG_KEY)
+        {
+            SeekIndexEntry entry = { pts, packet.pos, cursor.frameNumber };
+            AddEntry(entry);
+        }
+        if (m_endPts == AV_NOPTS_VALUE || pts + packet.duration > m_endPts)
+            m_endPts = pts + packet.duration;
+        //Keyframes still ahead in decoding order can not have a pts below this dts.
+        if (m_scannedPts == AV_NOPTS_VALUE || dts > m_scannedPts)
+            m_scannedPts = dts;
+    }
+    if (cursor.frameNumber >= 0)
+    {
+        ++cursor.frameNumber;
+        m_frameCount = std::max(m_frameCount, cursor.frameNumber);
+    }
+}
+
+void SeekIndex::AddPlayerPacket(const AVPacket& packet)
+{
+    m_lastInputUse = std::chrono::steady_clock::now().time_since_epoch().count();
+    if (packet.stream_index != m_streamIndex || m_complete)
+        return;
+    ScopedLock lock(m_mutex);
+    IndexPacket(packet, m_playerCursor);
+}
+
+void SeekIndex::PlayerSeeked()
+{
+    m_lastInputUse = std::chrono::steady_clock::now().time_since_epoch().count();
+    ScopedLock lock(m_mutex);
+    m_playerCursor.contiguous = false;
+    m_playerCursor.frameNumber = -1;
+}
+
+void SeekIndex::PlayerInputEnded()
+{
+    {
+        ScopedLock lock(m_mutex);
+        if (!m_playerCursor.contiguous || m_scannedPts == AV_NOPTS_VALUE)
+            return;
+    }
+    //The scan thread saves the cache, the demuxer must not wait for the disk.
+    Complete();
+}
+
+void SeekIndex::Complete()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_complete = true;
+    }
+    m_idleCondition.notify_all();
+}
+
+bool SeekIndex::WaitForIdleInput()
+{
+    std::unique_lock<std::mutex> lock(m_idleMutex);
+    while (!m_cancel && !m_complete)
+    {
+        if (!m_deferScan)
+            return true;
+        std::chrono::steady_clock::duration idle = std::chrono::steady_clock::now().time_since_epoch() -
+            std::chrono::steady_clock::duration(m_lastInputUse.load());
+        if (idle >= std::chrono::milliseconds(SEEK_INDEX_IDLE_MS))
+            return true;
+        m_idleCondition.wait_for(lock, std::chrono::milliseconds(SEEK_INDEX_IDLE_MS) - idle);
+    }
+    return false;
+}
+
+void SeekIndex::Build()
+{
+    if (m_streamIndex < 0 || m_streamIndex >= (int)m_formatCtx->nb_streams)
+        return;
+    AVStream* stream = m_formatCtx->streams[m_streamIndex];
+    int64_t startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    Cursor cursor = { true, 0 };
+    int64_t resumePts = AV_NOPTS_VALUE;
+    {
+        ScopedLock lock(m_mutex);
+        resumePts = m_scannedPts;
+    }
+    //Picks up behind what the player indexed. Should the seek land past it, the first video
+    //packet tells and the scan starts over from the beginning.
+    bool rewound = resumePts == AV_NOPTS_VALUE;
+    if (!rewound)
+    {
+        cursor.contiguous = false;
+        cursor.frameNumber = -1;
+        if (av_seek_frame(m_formatCtx, m_streamIndex, resumePts, AVSEEK_FLAG_BACKWARD) < 0)
+        {
+            rewound = true;
+            if (av_seek_frame(m_formatCtx, m_streamIndex, startPts, AVSEEK_FLAG_BACKWARD) < 0)
+                return;
+        }
+    }
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    int ret = 0;
+    while (WaitForIdleInput() && (ret = av_read_frame(m_formatCtx, &packet)) >= 0)
+    {
+        bool lost = false;
+        if (packet.stream_index == m_streamIndex)
+        {
+            ScopedLock lock(m_mutex);
+            IndexPacket(packet, cursor);
+            lost = !cursor.contiguous;
+        }
+        av_free_packet(&packet);
+        if (lost)
+        {
+            if (rewound)
+                return;
+            rewound = true;
+            if (av_seek_frame(m_formatCtx, m_streamIndex, startPts, AVSEEK_FLAG_BACKWARD) < 0)
+                return;
+        }
+    }
+    //An input that stalled or was aborted did not end, the index only covers what arrived.
+    if (ret >= 0 || ret == AVERROR(ETIMEDOUT) || ret == AVERROR_EXIT)
+        return;
+    Complete();
+}
+
+bool SeekIndex::LoadCache(const std::function<bool()>& openInput)
+{
+    if (m_cachePath.empty())
+        return false;
+    AVIOContext* file = NULL;
+    if (avio_open(&file, m_cachePath.c_str(), AVIO_FLAG_READ) < 0)
+        return false;
+    bool valid = avio_rl32(file) == SEEK_INDEX_CACHE_MAGIC &&
+        avio_rl32(file) == SEEK_INDEX_CACHE_VERSION &&
+        avio_rl64(file) == m_hash &&
+        (int64_t)avio_rl64(file) == m_modifiedTime &&
+        (int)avio_rl32(file) == m_streamIndex;
+    int64_t endPts = avio_rl64(file);
+    int64_t frameCount = avio_rl64(file);
+    int64_t count = avio_rl64(file);
+    //A truncated file must not make us reserve a huge vector.
+    valid = valid && count >= 0 && count * 3 * 8 <= avio_size(file);
+    std::vector<SeekIndexEntry> entries;
+    if (valid)
+    {
+        entries.resize((size_t)count);
+        for (auto& entry : entries)
+        {
+            entry.pts = avio_rl64(file);
+            entry.position = avio_rl64(file);
+            entry.frameNumber = avio_rl64(file);
+        }
+        valid = file->eof_reached == 0 && file->error == 0;
+    }
+    avio_closep(&file);
+    //Inputs of the same size and ends still differ in between, a cache of another one would
+    //send seeks to the wrong place.
+    if (!valid || !openInput() || !CheckKeyframes(entries))
+        return false;
+    ScopedLock lock(m_mutex);
+    m_entries.swap(entries);
+    m_endPts = endPts;
+    m_frameCount = frameCount;
+    m_scannedPts = endPts;
+    m_complete = true;
+    return true;
+}
+
+bool SeekIndex::CheckKeyframes(const std::vector<SeekIndexEntry>& entries)
+{
+    if (m_streamIndex < 0 || m_streamIndex >= (int)m_formatCtx->nb_streams)
+        return false;
+    size_t count = std::min<size_t>(entries.size(), SEEK_INDEX_CHECKED_ENTRIES);
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        //Spread over the whole input, the first and the last keyframe included.
+        const SeekIndexEntry& entry = entries[count > 1 ? i * (entries.size() - 1) / (count - 1) : 0];
+        if (av_seek_frame(m_formatCtx, m_streamIndex, entry.pts, AVSEEK_FLAG_BACKWARD) < 0)
+            return false;
+        bool found = false;
+        bool passed = false;
+        while (!found && !passed && av_read_frame(m_formatCtx, &packet) >= 0)
+        {
+            if (packet.stream_index == m_streamIndex)
+            {
+                int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+                int64_t dts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+                found = pts == entry.pts && (packet.flags & AV_PKT_FLAG_KEY) &&
+                    (entry.position < 0 || packet.pos < 0 || packet.pos == entry.position);
+                //No later packet can have the keyframe's pts.
+                passed = pts == entry.pts || (dts != AV_NOPTS_VALUE && dts > entry.pts);
+            }
+            av_free_packet(&packet);
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+void SeekIndex::SaveCache() const
+{
+    if (m_cachePath.empty())
+        return;
+    AVIOContext* file = NULL;
+    if (avio_open(&file, m_cachePath.c_str(), AVIO_FLAG_WRITE) < 0)
+        return;
+    ScopedLock lock(m_mutex);
+    avio_wl32(file, SEEK_INDEX_CACHE_MAGIC);
+    avio_wl32(file, SEEK_INDEX_CACHE_VERSION);
+    avio_wl64(file, m_hash);
+    avio_wl64(file, m_modifiedTime);
+    avio_wl32(file, m_streamIndex);
+    avio_wl64(file, m_endPts);
+    avio_wl64(file, m_frameCount);
+    avio_wl64(file, m_entries.size());
+    for (auto& entry : m_entries)
+    {
+        avio_wl64(file, entry.pts);
+        avio_wl64(file, entry.position);
+        avio_wl64(file, entry.frameNumber);
+    }
+    avio_closep(&file);
+}
+
+bool SeekIndex::FindKeyframe(int64_t timestamp, SeekIndexEntry& entry) const
+{
+    ScopedLock lock(m_mutex);
+    if (!m_complete && (m_scannedPts == AV_NOPTS_VALUE || timestamp > m_scannedPts))
+        return false;
+    auto position = std::upper_bound(m_entries.begin(), m_entries.end(), timestamp,
+        [](int64_t pts, const SeekIndexEntry& other) { return pts < other.pts; });
+    if (position == m_entries.begin())
+        return false;
+    entry = *(position - 1);
+    return true;
+}
+
+int64_t SeekIndex::GetEndTimestamp() const
+{
+    if (!m_complete)
+        return AV_NOPTS_VALUE;
+    ScopedLock lock(m_mutex);
+    return m_endPts;
+}
@@ -0,0 +1,99 @@
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+#define SEEK_INDEX_CACHE_MAGIC 0x58494B53 //"SKIX"
+#define SEEK_INDEX_CACHE_VERSION 2 //2 added the modification time
+#define SEEK_INDEX_HASH_SPAN (64 * 1024) //bytes hashed at each end of the input
+#define SEEK_INDEX_CHECKED_ENTRIES 4 //cached keyframes looked up in the input before the cache is used
+#define SEEK_INDEX_IDLE_MS 2000 //a file is only scanned once its player read nothing for this long
+
+struct buffer_data;
+struct PushInputReader;
+class PushInput;
+
+struct SeekIndexEntry
+{
+    int64_t pts; //video stream time base
+    int64_t position; //byte offset of the keyframe packet, -1 if unknown
+    int64_t frameNumber; //packet number in decoding order, -1 if unknown
+};
+
+//Keyframe index of one video stream. The packets the player demuxes are indexed as they pass,
+//and a demuxer of its own scans the rest in the background, so lookups only cover the part
+//read so far until IsComplete(). A file opened by path is only scanned while its player is
+//idle, reading it a second time next to playback would double the I/O of a slow share; the
+//scan picks up where the indexed part ends.
+class SeekIndex
+{
+    //One reader of the input, the player's demuxer or the scan. Once it seeked its packets only
+    //extend the index after it reached the indexed part again, keyframes it skipped would be missing.
+    struct Cursor
+    {
+        bool contiguous;
+        int64_t frameNumber; //of the next packet, -1 once the reader seeked
+    };
+
+    std::vector<SeekIndexEntry> m_entries; //sorted by pts
+    mutable std::recursive_mutex m_mutex;
+    std::thread m_thread;
+    std::atomic<bool> m_complete;
+    std::atomic<bool> m_cancel;
+    int64_t m_scannedPts; //every keyframe before it is indexed
+    int64_t m_endPts; //end of the last video frame
+    int64_t m_frameCount;
+    Cursor m_playerCursor; //guarded by m_mutex like the index
+    bool m_deferScan; //waits for the player to go idle before each read
+    std::atomic<int64_t> m_lastInputUse; //steady clock ticks of the player's latest read
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCondition; //cancel or completion, wakes the deferred scan
+    int m_streamIndex;
+    uint64_t m_hash;
+    int64_t m_modifiedTime; //of the input file, 0 for memory that is no file
+    std::string m_cachePath;
+    AVFormatContext* m_formatCtx;
+    AVIOContext* m_avioCtx;
+    buffer_data* m_bufferData;
+    PushInputReader* m_pushReader;
+
+    SeekIndex(const SeekIndex&) = delete;
+    SeekIndex& operator=(const SeekIndex&) = delete;
+
+    void SetCachePath(const char* cacheDirectory);
+    void Build();
+    //Under m_mutex.
+    void IndexPacket(const AVPacket& packet, Cursor& cursor);
+    void Complete();
+    //False once cancelled or complete.
+    bool WaitForIdleInput();
+    void AddEntry(const SeekIndexEntry& entry);
+    //openInput opens m_formatCtx, the cached keyframes are checked against the input before
+    //they are used. The input is left open either way.
+    bool LoadCache(const std::function<bool()>& openInput);
+    bool CheckKeyframes(const std::vector<SeekIndexEntry>& entries);
+    void SaveCache() const;
+    void CloseInput();
+    static uint64_t HashBytes(uint64_t hash, const uint8_t* data, int64_t size);
+public:
+    SeekIndex();
+    ~SeekIndex();
+    //cacheDirectory may be NULL, otherwise the index is kept there in a file named by the input hash.
+    void Start(const char* filePath, int streamIndex, const char* cacheDirectory);
+    //modifiedTime is the one of the file the buffer maps, 0 when it is no file.
+    void Start(uint8_t* buffer, int64_t bufferSize, int streamIndex, const char* cacheDirectory, int64_t modifiedTime = 0);
+    //Reads along while the input arrives. Not cached, the input can not be hashed before all of it is in.
+    void Start(PushInput* input, int streamIndex);
+    //Called by the player's demuxer for every packet it reads, for the end of the input and
+    //after it seeked.
+    void AddPlayerPacket(const AVPacket& packet);
+    void PlayerInputEnded();
+    void PlayerSeeked();
+    //Last keyframe at or before timestamp, false while the index does not reach that far.
+    bool FindKeyframe(int64_t timestamp, SeekIndexEntry& entry) const;
+    bool IsComplete() const { return m_complete; }
+    //End of the stream in its time base, AV_NOPTS_VALUE until the index is complete.
+    int64_t GetEndTimestamp() const;
+    //Last write time of a file, filePath is UTF-8. 0 if it can not be read.
+    static int64_t GetFileModifiedTime(const char* filePath);
+};
+
+#endif//SEEKINDEX_H
@@ -6,19 +6,25 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <algorithm>
 #include <chrono>
+#include <atomic>
 extern "C"{
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 }
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
 #include "FrameQueueManager.h"
 #include "AudioDecoder.h"
 #include "DecodingThread.h"
 #include "ShowingThread.h"
 
-#define STANDARD_DELAY 40
-
 ShowingThread::ShowingThread(DecodingThread* decodingThread, FrameQueueManager *frameQueueManager, AudioDecoder* audioDecoder) :
     m_currentFrameSize(0,0),
     m_isPlaying(false),
@@ -27,129 +33,168 @@ ShowingThread::ShowingThread(DecodingThread* decodingThread, FrameQueueManager *
     m_destroying(false),
     m_showFirstFrame(false),
     m_isSeeking(false),
+    m_showPreview(false),
+    m_previewShown(false),
+    m_underrunReported(false),
     m_playBackTime(0),
     m_videoStartTime(0),
-    m_currentFrame(NULL),
     m_decodingThread(decodingThread),
     m_frameQueueManager(frameQueueManager),
     m_audioDecoder(audioDecoder),
     m_audioBufferPos(m_audioBuffer),
     m_audioBufferNpos(m_audioBuffer),
-    m_audioBufferPTS(0)
+    m_audioBufferPTS(0),
+    m_task(m_signal, [this](int64_t& delay) { return this->Step(delay); })
 {
     m_decodingThread->AddListener(this);
+    m_frameQueueManager->SetReadyFrameSignal(&m_signal);
 }
 
 ShowingThread::~ShowingThread()
 {
     m_destroying = true;
     m_decodingThread->RemoveListener(this);
-    m_thread.join();
+    m_signal.Notify();
+    m_task.Stop();
 }
 
-void ShowingThread::Start()
+void ShowingThread::Start(PlayerScheduler* scheduler /*= NULL*/)
 {
-    m_thread = std::thread([this] { this->ThreadFunction(); });
+    //A frame due now is worth more than decoding ahead.
+    m_task.Start(scheduler, true);
 }
 
-
-
-void ShowingThread::ThreadFunction()
+StepResult ShowingThread::Step(int64_t& delay)
 {
-    while (1)
+    if (m_destroying)
+        return StepResult::finished;
+    ScopedLock lock(m_mutex);
+    if (m_isSeeking)
     {
-        if (m_destroying)
-            return;
-        m_mutex.lock();
-        if (m_isSeeking)
+        if (m_showPreview)
         {
-            m_frameMutex.lock();
-            m_currentFrame = NULL;
-            m_frameMutex.unlock();
-            m_mutex.unlock();
-            std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(STANDARD_DELAY));
-            continue;
-        }
-        if (m_showFirstFrame)
-        {
-            m_isPlaying = false;
-            if (m_frameQueueManager->GetReadyFramesCount() < 1)
+            m_showPreview = false;
+            //Gone already if the decoder moved on to the exact frame meanwhile, which is
+            //left in the queue for the first frame path then.
+            InternalFrame* readyFrame = m_frameQueueManager->GetFirstFrame();
+            if (readyFrame == NULL || !readyFrame->IsPreview())
+                return StepResult::wait;
+            FrameLease previewFrame = m_frameQueueManager->RequestReadyFrame();
+            if (previewFrame.Get() == NULL)
+                return StepResult::wait;
+            if (!previewFrame->IsPreview())
             {
-                OnShowingError();
-                m_mutex.unlock();
-                return;
+                //Replaced between the look and the take, kept for OnFirstFrameDone.
+                m_earlyFirstFrame = std::move(previewFrame);
+                return StepResult::wait;
             }
-            m_currentFrame = m_frameQueueManager->RequestReadyFrame();
-            m_currentFrameSize = m_currentFrame->GetFrameSize();
             m_frameMutex.lock();
+            m_currentFrame = std::move(previewFrame);
+            m_currentFrameSize = m_currentFrame->GetFrameSize();
             m_frameReady = true;
             m_playBackTime = m_currentFrame->GetPresentationTime();
             m_lastFrameTimeStamp = std::chrono::system_clock::now();
-            OnFirstFrameShown();
-            m_showFirstFrame = false;
             m_frameMutex.unlock();
-            m_mutex.unlock();
-            continue;
+            m_previewShown = true;
+            OnPreviewShown();
+            return StepResult::again;
         }
-        if ((!m_isPlaying && m_frameQueueManager->GetReadyFramesCount() < 3))
+        if (!m_previewShown)
         {
-            m_mutex.unlock();
-            std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(STANDARD_DELAY));
-            continue;
+            m_frameMutex.lock();
+            m_currentFrame.Reset();
+            m_frameMutex.unlock();
         }
-        if (m_isPlaying && m_frameQueueManager->GetReadyFramesCount() < 1)
+        return StepResult::wait;
+    }
+    if (m_showFirstFrame)
+    {
+        m_isPlaying = false;
+        FrameLease firstFrame = m_frameQueueManager->RequestReadyFrame();
+        //A frame saved after the early one is newer, the early one is dropped then.
+        if (firstFrame.Get() == NULL)
+            firstFrame = std::move(m_earlyFirstFrame);
+        m_earlyFirstFrame.Reset();
+        if (firstFrame.Get() == NULL)
         {
-            if (m_decodingThreadPaused)
-            {
-                m_isPlaying = false;
-                OnNoMoreFrames();
-            }
-            m_mutex.unlock();
-            std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(STANDARD_DELAY));
-            continue;
+            OnShowingError();
+            return StepResult::finished;
         }
         m_frameMutex.lock();
-        m_frameQueueManager->FrameShown(m_currentFrame);
-        m_currentFrame = m_frameQueueManager->RequestReadyFrame();
+        m_currentFrame = std::move(firstFrame);
         m_currentFrameSize = m_currentFrame->GetFrameSize();
-        if (!m_isPlaying)
-        {
-            ResetSound();
-            m_isPlaying = true;
-            m_videoStartTime = m_currentFrame->GetPresentationTime();
-            m_startTime = std::chrono::steady_clock::now();
-        }
         m_frameReady = true;
-        m_lastFrameTimeStamp = std::chrono::system_clock::now();
         m_playBackTime = m_currentFrame->GetPresentationTime();
-        OnFrameShown();
+        m_lastFrameTimeStamp = std::chrono::system_clock::now();
+        OnFirstFrameShown();
+        m_showFirstFrame = false;
         m_frameMutex.unlock();
-        while (1){
-            if (m_frameQueueManager->GetReadyFramesCount() > 0)
-            {
-                int64_t timeLeft = std::chrono::duration_cast<std::chrono::duration<int64_t, std::milli>>(std::chrono::steady_clock::now() - m_startTime).count();
-                int64_t nextFrameTimeStamp = m_frameQueueManager->GetFirstFrame()->GetPresentationTime();
-                int64_t nextFrameShowTime = nextFrameTimeStamp - m_videoStartTime;
-                int64_t nextFrameDelay = nextFrameShowTime - timeLeft;
-                if (nextFrameDelay < 0){
-                    InternalFrame* frame = m_frameQueueManager->RequestReadyFrame();
-                    m_frameQueueManager->FrameShown(frame);
-                    continue;
-                }
-                m_mutex.unlock();
-                std::this_thread::sleep_for(std::chrono::duration<int64_t, std::milli>(nextFrameDelay));
-                break;
-            }
-            else
-            {
-                m_mutex.unlock();
-                std::this_thread::sleep_for(std::chrono::duration<int, std::milli>(STANDARD_DELAY));
-                break;
-            }
+        return StepResult::again;
+    }
+    //A shallow queue cannot hold three ready frames next to the one on screen.
+    int startFrames = std::min(3, m_frameQueueManager->GetDepth() - 1);
+    if ((!m_isPlaying && m_frameQueueManager->GetReadyFramesCount() < startFrames))
+        return StepResult::wait;
+    if (m_isPlaying && m_frameQueueManager->GetReadyFramesCount() < 1)
+    {
+        if (m_decodingThreadPaused)
+        {
+            m_isPlaying = false;
+            OnNoMoreFrames();
         }
-
-
+        else if (!m_underrunReported)
+        {
+            m_frameQueueManager->ReportUnderrun();
+            m_underrunReported = true;
+        }
+        return StepResult::wait;
+    }
+    if (m_isPlaying)
+    {
+        //Sleep until the next frame is due, seek and stop notifications cut the wait short.
+        delay = NextFrameDelay();
+        if (delay > 0)
+            return StepResult::waitFor;
     }
+    FrameLease nextFrame = m_frameQueueManager->RequestReadyFrame();
+    if (nextFrame.Get() == NULL)
+    {
+        //A seek dropped the frames counted above.
+        return StepResult::again;
+    }
+    m_frameMutex.lock();
+    //The frame shown until now goes back to the queue with its lease.
+    m_currentFrame = std::move(nextFrame);
+    m_currentFrameSize = m_currentFrame->GetFrameSize();
+    if (!m_isPlaying)
+    {
+        ResetSound();
+        m_isPlaying = true;
+        m_videoStartTime = m_currentFrame->GetPresentationTime();
+        m_startTime = std::chrono::steady_clock::now();
+    }
+    m_frameReady = true;
+    m_underrunReported = false;
+    m_lastFrameTimeStamp = std::chrono::system_clock::now();
+    m_playBackTime = m_currentFrame->GetPresentationTime();
+    OnFrameShown();
+    m_frameMutex.unlock();
+    //Drop the frames that are already late.
+    while (m_frameQueueManager->GetReadyFramesCount() > 0 && NextFrameDelay() < 0)
+    {
+        FrameLease lateFrame = m_frameQueueManager->RequestReadyFrame();
+    }
+    return StepResult::again;
+}
+
+int64_t ShowingThread::NextFrameDelay() const
+{
+    InternalFrame* nextFrame = m_frameQueueManager->GetFirstFrame();
+    if (nextFrame == NULL)
+        return 0;
+    int64_t timeLeft = std::chrono::duration_cast<std::chrono::duration<int64_t, std::milli>>(std::chrono::steady_clock::now() - m_startTime).count();
+    int64_t nextFrameShowTime = nextFrame->GetPresentationTime() - m_videoStartTime;
+    return nextFrameShowTime - timeLeft;
 }
 
 void ShowingThread::AddListener(ShowingThreadListener *listener)
@@ -167,12 +212,44 @@ void ShowingThread::RemoveListener(ShowingThreadListener *listener)
 bool ShowingThread::GetCurrentFrame(uint8_t** buffer, int32_t& bufferSize) const
 {
     ScopedLock lock(m_frameMutex);
-    if (m_destroying || !m_frameReady || m_currentFrame == NULL)
+    if (m_destroying || !m_frameReady || m_currentFrame.Get() == NULL)
         return false;
     m_currentFrame->CopyFrame(buffer, bufferSize);
     return true;
 }
 
+bool ShowingThread::GetCurrentFrame(uint8_t* const data[4], const int linesize[4], int width, int height) const
+{
+    ScopedLock lock(m_frameMutex);
+    if (m_destroying || !m_frameReady || m_currentFrame.Get() == NULL)
+        return false;
+    //The destination was sized for an earlier frame, the caller has to resize it first.
+    if (m_currentFrame->GetFrameSize() != FrameSize(width, height))
+        return false;
+    m_currentFrame->CopyFrame(data, linesize);
+    return true;
+}
+
+bool ShowingThread::IsShowingPreview() const
+{
+    ScopedLock lock(m_frameMutex);
+    return m_currentFrame.Get() != NULL && m_currentFrame->IsPreview();
+}
+
+InternalFrame* ShowingThread::AcquireCurrentFrame()
+{
+    ScopedLock lock(m_frameMutex);
+    if (m_destroying || !m_frameReady || m_currentFrame.Get() == NULL)
+        return NULL;
+    m_frameQueueManager->PinFrame(m_currentFrame.Get());
+    return m_currentFrame.Get();
+}
+
+void ShowingThread::ReleaseFrame(InternalFrame* frame)
+{
+    m_frameQueueManager->UnpinFrame(frame);
+}
+
 int64_t ShowingThread::GetPlayBackTime() const
 {
     ScopedLock lock(m_frameMutex);
@@ -276,6 +353,7 @@ void ShowingThread::OnError(DecodingThreadErrorCode error)
 {
     ScopedLock lock(m_mutex);
     m_decodingThreadPaused = true;
+    m_signal.Notify();
 }
 
 void ShowingThread::OnFrameReady()
@@ -288,6 +366,7 @@ void ShowingThread::OnPaused()
 {
     ScopedLock lock(m_mutex);
     m_decodingThreadPaused = true;
+    m_signal.Notify();
 }
 
 void ShowingThread::OnStopped()
@@ -295,30 +374,45 @@ void ShowingThread::OnStopped()
     ScopedLock lock(m_mutex);
     m_isSeeking = false;
     m_decodingThreadPaused = true;
+    m_signal.Notify();
 }
 
 void ShowingThread::OnSeekStart()
 {
     ScopedLock lock(m_mutex);
     m_isSeeking = true;
+    m_showPreview = false;
+    m_previewShown = false;
+    m_earlyFirstFrame.Reset();
+    m_signal.Notify();
 }
 
 void ShowingThread::OnSeekDone()
 {
     ScopedLock lock(m_mutex);
     m_isSeeking = false;
+    m_signal.Notify();
 }
 
 void ShowingThread::OnVideoEnd()
 {
     ScopedLock lock(m_mutex);
     m_decodingThreadPaused = true;
+    m_signal.Notify();
 }
 
 void ShowingThread::OnFirstFrameDone()
 {
     ScopedLock lock(m_mutex);
     m_showFirstFrame = true;
+    m_signal.Notify();
+}
+
+void ShowingThread::OnPreviewReady()
+{
+    ScopedLock lock(m_mutex);
+    m_showPreview = true;
+    m_signal.Notify();
 }
 
 //ShowingThreadListener interface
@@ -356,4 +450,11 @@ void ShowingThread::OnStartPlaying()
     ScopedLock lock(m_mutex);
     for (auto listener : m_listeners)
         listener->OnStartPlaying();
-}
\ No newline at end of file
+}
+
+void ShowingThread::OnPreviewShown()
+{
+    ScopedLock lock(m_mutex);
+    for (auto listener : m_listeners)
+        listener->OnPreviewShown();
+}
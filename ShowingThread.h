@@ -7,7 +7,8 @@
 
 class ShowingThread : public ShowingThreadListener, public DecodingThreadListener
 {
-    std::thread m_thread;
+    ThreadSignal m_signal;
+    ScheduledTask m_task;
     std::recursive_mutex m_mutex;
     mutable std::recursive_mutex m_frameMutex;
     std::list<ShowingThreadListener*> m_listeners;
@@ -17,11 +18,15 @@ class ShowingThread : public ShowingThreadListener, public DecodingThreadListene
     bool m_destroying;
     bool m_showFirstFrame;
     bool m_isSeeking;
+    bool m_showPreview;
+    bool m_previewShown; //kept on screen until the exact frame of the seek replaces it
+    bool m_underrunReported; //once per run dry, until a frame is shown again
     int64_t m_videoStartTime;
     int64_t m_playBackTime;
     std::chrono::system_clock::time_point m_lastFrameTimeStamp;
     std::chrono::steady_clock::time_point m_startTime;
-    InternalFrame *m_currentFrame;
+    FrameLease m_currentFrame;
+    FrameLease m_earlyFirstFrame; //exact frame of a preview seek taken in place of the preview
     DecodingThread *m_decodingThread;
     FrameQueueManager *m_frameQueueManager;
     AudioDecoder* m_audioDecoder;
@@ -32,17 +37,25 @@ class ShowingThread : public ShowingThreadListener, public DecodingThreadListene
     int64_t m_audioBufferPTS;
 
     void ResetSound();
+    int64_t NextFrameDelay() const;
+    StepResult Step(int64_t& delay);
 
 
 public:
     ShowingThread(DecodingThread* decodingThread, FrameQueueManager *frameQueueManager, AudioDecoder* audioDecoder);
     ~ShowingThread();
-    void ThreadFunction();
-    void Start();
+    //Presents on its own thread, or as an urgent task of scheduler if not NULL.
+    void Start(PlayerScheduler* scheduler = NULL);
     
     void AddListener(ShowingThreadListener *listener);
     void RemoveListener(ShowingThreadListener *listener);
     bool GetCurrentFrame(uint8_t** buffer, int32_t& bufferSize) const;
+    bool GetCurrentFrame(uint8_t* const data[4], const int linesize[4], int width, int height) const;
+    //The frame on screen is the keyframe of a preview seek that is still refined.
+    bool IsShowingPreview() const;
+    //Pins the frame on screen for the caller, NULL when there is none yet.
+    InternalFrame* AcquireCurrentFrame();
+    void ReleaseFrame(InternalFrame* frame);
     FrameSize GetCurrentFrameSize() const;
     int64_t GetPlayBackTime() const;
     int64_t GetPresizePlayBackTime() const;
@@ -58,12 +71,14 @@ public:
     void OnSeekDone();
     void OnVideoEnd();
     void OnFirstFrameDone();
+    void OnPreviewReady();
     //ShowingThreadListener interface
     void OnFirstFrameShown();
     void OnNoMoreFrames();
     void OnFrameShown();
     void OnShowingError();
     void OnStartPlaying();
+    void OnPreviewShown();
 };
 
 #endif//SHOWINGTHREAD_H
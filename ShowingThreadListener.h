@@ -9,6 +9,7 @@ public:
     virtual void OnFrameShown() = 0;
     virtual void OnShowingError() = 0;
     virtual void OnStartPlaying() = 0;
+    virtual void OnPreviewShown() = 0;
 };
 
 #endif
\ No newline at end of file
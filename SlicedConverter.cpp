@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+#include "WorkerPool.h"
+#include "ColorKernels.h"
+#include "SlicedConverter.h"
+
+SlicedConverter::SlicedConverter() :
+    m_scaleContext(NULL),
+    m_convertScaled(false),
+    m_width(0),
+    m_height(0),
+    m_dstWidth(0),
+    m_dstHeight(0),
+    m_srcFormat(AV_PIX_FMT_NONE),
+    m_srcRange(AVCOL_RANGE_UNSPECIFIED),
+    m_dstFormat(AV_PIX_FMT_NONE),
+    m_rowKernel(NULL),
+    m_threads(0),
+    m_pool(WorkerPool::Shared()),
+    m_src(NULL),
+    m_srcLinesize(NULL),
+    m_dst(NULL),
+    m_dstLinesize(NULL)
+{
+    memset(m_scaled, 0, sizeof(m_scaled));
+    memset(m_scaledLinesize, 0, sizeof(m_scaledLinesize));
+    m_sliceBody = [this](int index) { this->ConvertSlice(index); };
+}
+
+SlicedConverter::~SlicedConverter()
+{
+    FreeSlices();
+}
+
+void SlicedConverter::FreeSlices()
+{
+    for (auto& slice : m_slices)
+    {
+        if (slice.context != NULL)
+            sws_freeContext(slice.context);
+    }
+    m_slices.clear();
+    if (m_scaleContext != NULL)
+    {
+        sws_freeContext(m_scaleContext);
+        m_scaleContext = NULL;
+    }
+    av_freep(&m_scaled[0]);
+    memset(m_scaled, 0, sizeof(m_scaled));
+    m_convertScaled = false;
+}
+
+void SlicedConverter::SetThreads(int threads)
+{
+    if (threads < 0)
+        threads = 0;
+    if (threads == m_threads)
+        return;
+    m_threads = threads;
+    //Rebuilt on the next frame.
+    FreeSlices();
+    m_width = 0;
+}
+
+void SlicedConverter::Setup(int width, int height, AVPixelFormat srcFormat, AVColorRange srcRange,
+    int dstWidth, int dstHeight, AVPixelFormat dstFormat)
+{
+    if (width == m_width && height == m_height && srcFormat == m_srcFormat && srcRange == m_srcRange &&
+        dstWidth == m_dstWidth && dstHeight == m_dstHeight && dstFormat == m_dstFormat &&
+        (!m_slices.empty() || m_scaleContext != NULL))
+        return;
+    FreeSlices();
+    m_width = width;
+    m_height = height;
+    m_srcFormat = srcFormat;
+    m_srcRange = srcRange;
+    m_dstWidth = dstWidth;
+    m_dstHeight = dstHeight;
+    m_dstFormat = dstFormat;
+    if (dstWidth != width || dstHeight != height)
+    {
+        //Paletted and other formats swscale cannot write are scaled and converted in one go.
+        m_convertScaled = srcFormat != dstFormat && sws_isSupportedOutput(srcFormat) &&
+            av_image_alloc(m_scaled, m_scaledLinesize, dstWidth, dstHeight, srcFormat, 32) >= 0;
+        m_scaleContext = sws_getContext(width, height, srcFormat, dstWidth, dstHeight,
+            m_convertScaled ? srcFormat : dstFormat, SWS_BILINEAR, NULL, NULL, NULL);
+        if (!m_convertScaled)
+            return;
+    }
+    m_rowKernel = FindColorRowKernel(srcFormat, srcRange, dstFormat);
+    //Slice borders have to be on whole chroma rows of the source and the output format.
+    const AVPixFmtDescriptor* dstDesc = av_pix_fmt_desc_get(dstFormat);
+    int dstAlign = dstDesc != NULL && !(dstDesc->flags & AV_PIX_FMT_FLAG_RGB) ? 1 << dstDesc->log2_chroma_h : 1;
+    int align = std::max(SLICE_ROW_ALIGN, dstAlign);
+    int threads = m_threads > 0 ? m_threads : m_pool->GetThreadCount() + 1;
+    int count = std::max(1, std::min(threads, dstHeight / SLICE_MIN_HEIGHT));
+    int sliceHeight = (dstHeight / count + align - 1) & ~(align - 1);
+    for (int top = 0; top < dstHeight; top += sliceHeight)
+    {
+        Slice slice;
+        slice.context = NULL;
+        slice.top = top;
+        slice.height = std::min(sliceHeight, dstHeight - top);
+        if (m_rowKernel == NULL)
+        {
+            slice.context = sws_getContext(dstWidth, slice.height, srcFormat,
+                dstWidth, slice.height, dstFormat, SWS_BILINEAR, NULL, NULL, NULL);
+        }
+        m_slices.push_back(slice);
+    }
+}
+
+int SlicedConverter::PlaneRow(const AVPixFmtDescriptor* desc, int plane, int row)
+{
+    if (desc == NULL || row == 0)
+        return row;
+    //The palette of paletted formats is not a picture plane.
+    if (plane == 1 && (desc->flags & AV_PIX_FMT_FLAG_PAL))
+        return 0;
+    //Chroma planes of YUV formats are subsampled vertically, alpha and RGB planes are not.
+    if ((plane == 1 || plane == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB))
+        return row >> desc->log2_chroma_h;
+    return row;
+}
+
+void SlicedConverter::ConvertSlice(int index)
+{
+    const Slice& slice = m_slices[index];
+    if (m_rowKernel != NULL)
+    {
+        //Both kernel layouts have 4:2:0 chroma, nv12 keeps it interleaved in the second plane.
+        for (int row = slice.top; row < slice.top + slice.height; ++row)
+        {
+            const uint8_t* y = m_src[0] + row * m_srcLinesize[0];
+            const uint8_t* u = m_src[1] + (row >> 1) * m_srcLinesize[1];
+            const uint8_t* v = m_src[2] != NULL ? m_src[2] + (row >> 1) * m_srcLinesize[2] : u;
+            m_rowKernel(y, u, v, m_dst[0] + row * m_dstLinesize[0], m_dstWidth);
+        }
+        return;
+    }
+    if (slice.context == NULL)
+        return;
+    const AVPixFmtDescriptor* srcDesc = av_pix_fmt_desc_get(m_srcFormat);
+    const AVPixFmtDescriptor* dstDesc = av_pix_fmt_desc_get(m_dstFormat);
+    const uint8_t* srcSlice[4] = { NULL, NULL, NULL, NULL };
+    uint8_t* dstSlice[4] = { NULL, NULL, NULL, NULL };
+    for (int plane = 0; plane < 4; ++plane)
+    {
+        if (m_src[plane] != NULL)
+            srcSlice[plane] = m_src[plane] + PlaneRow(srcDesc, plane, slice.top) * m_srcLinesize[plane];
+        if (m_dst[plane] != NULL)
+            dstSlice[plane] = m_dst[plane] + PlaneRow(dstDesc, plane, slice.top) * m_dstLinesize[plane];
+    }
+    sws_scale(slice.context, srcSlice, m_srcLinesize, 0, slice.height, dstSlice, m_dstLinesize);
+}
+
+void SlicedConverter::Convert(const AVFrame* src, AVPixelFormat dstFormat, int dstWidth, int dstHeight,
+    uint8_t* const dst[], const int dstLinesize[])
+{
+    Setup(src->width, src->height, (AVPixelFormat)src->format, src->color_range, dstWidth, dstHeight, dstFormat);
+    m_src = src->data;
+    m_srcLinesize = src->linesize;
+    if (m_scaleContext != NULL)
+    {
+        //Sequential, it is the only part that filters across rows.
+        if (!m_convertScaled)
+        {
+            sws_scale(m_scaleContext, src->data, src->linesize, 0, src->height, dst, dstLinesize);
+            m_src = NULL;
+            m_srcLinesize = NULL;
+            return;
+        }
+        sws_scale(m_scaleContext, src->data, src->linesize, 0, src->height, m_scaled, m_scaledLinesize);
+        m_src = m_scaled;
+        m_srcLinesize = m_scaledLinesize;
+    }
+    m_dst = dst;
+    m_dstLinesize = dstLinesize;
+    m_pool->ParallelFor((int)m_slices.size(), m_sliceBody);
+    m_src = NULL;
+    m_srcLinesize = NULL;
+    m_dst = NULL;
+    m_dstLinesize = NULL;
+}
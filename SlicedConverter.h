@@ -0,0 +1,64 @@
+#ifndef SLICEDCONVERTER_H
+#define SLICEDCONVERTER_H
+
+#define SLICE_ROW_ALIGN 16 //slice borders stay on whole chroma rows for every subsampling
+#define SLICE_MIN_HEIGHT 64 //thinner slices cost more in scheduling than they save
+
+class WorkerPool;
+
+//Pixel format conversion split into horizontal slices that run in parallel on the shared
+//WorkerPool. YUV to RGBA/BGRA uses the SIMD row kernels, everything else gives each slice
+//its own SwsContext. Scaling is done first, in one SwsContext over the whole picture and in
+//the source format: a scaler per slice would clamp its filter at the slice borders and round
+//each slice to a slightly different ratio, which shows as seams. The slices then convert
+//the scaled picture.
+class SlicedConverter
+{
+    struct Slice
+    {
+        SwsContext* context;
+        int top;
+        int height;
+    };
+
+    std::vector<Slice> m_slices;
+    SwsContext* m_scaleContext; //NULL when not scaling
+    bool m_convertScaled; //the scaled picture still needs converting, i.e. m_scaled is used
+    uint8_t* m_scaled[4]; //scaled picture in the source format
+    int m_scaledLinesize[4];
+    int m_width;
+    int m_height;
+    int m_dstWidth;
+    int m_dstHeight;
+    AVPixelFormat m_srcFormat;
+    AVColorRange m_srcRange;
+    AVPixelFormat m_dstFormat;
+    ColorRowKernel m_rowKernel; //NULL when swscale converts
+    int m_threads; //0 uses every pool thread
+    WorkerPool* m_pool;
+    std::function<void(int)> m_sliceBody; //built once, so converting allocates nothing
+    //Arguments of the running Convert() for the slice body.
+    const uint8_t* const* m_src;
+    const int* m_srcLinesize;
+    uint8_t* const* m_dst;
+    const int* m_dstLinesize;
+
+    SlicedConverter(const SlicedConverter&) = delete;
+    SlicedConverter& operator=(const SlicedConverter&) = delete;
+
+    void Setup(int width, int height, AVPixelFormat srcFormat, AVColorRange srcRange,
+        int dstWidth, int dstHeight, AVPixelFormat dstFormat);
+    void FreeSlices();
+    void ConvertSlice(int index);
+    static int PlaneRow(const AVPixFmtDescriptor* desc, int plane, int row);
+public:
+    SlicedConverter();
+    ~SlicedConverter();
+    //Number of slices converted at once, 0 picks one per available core.
+    void SetThreads(int threads);
+    //Converts src to a dstWidth x dstHeight picture in dstFormat.
+    void Convert(const AVFrame* src, AVPixelFormat dstFormat, int dstWidth, int dstHeight,
+        uint8_t* const dst[], const int dstLinesize[]);
+};
+
+#endif//SLICEDCONVERTER_H
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <map>
+#include <list>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <atomic>
+#include "ThreadSignal.h"
+#include "PlayerScheduler.h"
+
+ThreadSignal::ThreadSignal() :
+    m_signaled(false),
+    m_task(NULL)
+{
+
+}
+
+void ThreadSignal::Notify()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_signaled = true;
+    m_condition.notify_one();
+    if (m_task != NULL)
+        m_task->Wake();
+}
+
+void ThreadSignal::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_signaled)
+        m_condition.wait(lock);
+    m_signaled = false;
+}
+
+bool ThreadSignal::WaitFor(int64_t milliseconds)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_signaled)
+        m_condition.wait_for(lock, std::chrono::milliseconds(milliseconds));
+    bool ret = m_signaled;
+    m_signaled = false;
+    return ret;
+}
+
+void ThreadSignal::SetTask(ScheduledTask* task)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = task;
+}
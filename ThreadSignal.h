@@ -0,0 +1,29 @@
+#ifndef THREADSIGNAL_H
+#define THREADSIGNAL_H
+
+//Auto-reset wakeup for a worker thread. Producers call Notify() whenever they change
+//something the worker waits for, a notification sent while the worker is busy is kept
+//and makes the next Wait() return at once.
+//A signal bound to a ScheduledTask on a PlayerScheduler queues the task instead.
+class ScheduledTask;
+
+class ThreadSignal
+{
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_signaled;
+    ScheduledTask* m_task;
+
+    ThreadSignal(const ThreadSignal&) = delete;
+    ThreadSignal& operator=(const ThreadSignal&) = delete;
+public:
+    ThreadSignal();
+    void Notify();
+    void Wait();
+    //Returns false if the timeout passed without a notification.
+    bool WaitFor(int64_t milliseconds);
+    //Wakes task on every Notify(), NULL unbinds it.
+    void SetTask(ScheduledTask* task);
+};
+
+#endif//THREADSIGNAL_H
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <tchar.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "WorkerPool.h"
+
+std::mutex WorkerPool::s_instanceGuard;
+WorkerPool* WorkerPool::s_instance = NULL;
+
+WorkerPool* WorkerPool::Shared()
+{
+    std::lock_guard<std::mutex> lock(s_instanceGuard);
+    if (s_instance == NULL)
+    {
+        //The calling thread always takes part, so one core is left out of the pool.
+        int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+        s_instance = new WorkerPool(cores - 1);
+    }
+    return s_instance;
+}
+
+WorkerPool::WorkerPool(int threads) :
+    m_jobs(NULL),
+    m_stopping(false)
+{
+    for (int i = 0; i < threads; ++i)
+        m_threads.push_back(std::thread([this] { this->ThreadFunc(); }));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_workCondition.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+bool WorkerPool::TakeIndex(Job*& job, int& index)
+{
+    while (m_jobs != NULL)
+    {
+        job = m_jobs;
+        if (job->next < job->count)
+        {
+            index = job->next++;
+            return true;
+        }
+        //Every index is handed out, the owner waits for the running ones.
+        m_jobs = job->nextJob;
+    }
+    return false;
+}
+
+void WorkerPool::RunIndex(Job* job, int index, WorkerPool* pool)
+{
+    (*job->body)(index);
+    //The owner may return as soon as the last index is done, job must not be touched after this.
+    if (job->done.fetch_add(1) + 1 == job->count)
+    {
+        std::lock_guard<std::mutex> lock(pool->m_mutex);
+        pool->m_doneCondition.notify_all();
+    }
+}
+
+void WorkerPool::ThreadFunc()
+{
+    while (true)
+    {
+        Job* job = NULL;
+        int index = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stopping && !TakeIndex(job, index))
+                m_workCondition.wait(lock);
+            if (m_stopping)
+                return;
+        }
+        RunIndex(job, index, this);
+    }
+}
+
+void WorkerPool::ParallelFor(int count, const std::function<void(int)>& body)
+{
+    if (count <= 0)
+        return;
+    if (count == 1 || m_threads.empty())
+    {
+        for (int i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+    //The job lives on this stack frame, nothing is allocated per call.
+    Job job;
+    job.body = &body;
+    job.count = count;
+    job.next = 0;
+    job.done = 0;
+    job.nextJob = NULL;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job** tail = &m_jobs;
+        while (*tail != NULL)
+            tail = &(*tail)->nextJob;
+        *tail = &job;
+    }
+    m_workCondition.notify_all();
+    while (true)
+    {
+        int index = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (job.next >= job.count)
+                break;
+            index = job.next++;
+        }
+        RunIndex(&job, index, this);
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    //Unlink the job in case no worker has seen it run out.
+    for (Job** link = &m_jobs; *link != NULL; link = &(*link)->nextJob)
+    {
+        if (*link == &job)
+        {
+            *link = job.nextJob;
+            break;
+        }
+    }
+    while (job.done < job.count)
+        m_doneCondition.wait(lock);
+}
@@ -0,0 +1,44 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+//Process wide pool for data parallel work such as sliced colour conversion. Every
+//player shares it, so the number of busy cores does not grow with the number of players.
+class WorkerPool
+{
+    struct Job
+    {
+        const std::function<void(int)>* body;
+        int count;
+        int next; //next index to hand out, guarded by m_mutex
+        std::atomic<int> done;
+        Job* nextJob;
+    };
+
+    static std::mutex s_instanceGuard;
+    static WorkerPool* s_instance;
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_workCondition;
+    std::condition_variable m_doneCondition;
+    Job* m_jobs; //jobs with indices left to hand out
+    bool m_stopping;
+
+    WorkerPool(int threads);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void ThreadFunc();
+    //Takes the next index of any job, m_mutex must be held.
+    bool TakeIndex(Job*& job, int& index);
+    static void RunIndex(Job* job, int index, WorkerPool* pool);
+public:
+    ~WorkerPool();
+    static WorkerPool* Shared();
+    //Threads available besides the calling one.
+    int GetThreadCount() const { return (int)m_threads.size(); }
+    //Runs body(0) .. body(count - 1) on the pool and the calling thread, returns when all are done.
+    void ParallelFor(int count, const std::function<void(int)>& body);
+};
+
+#endif//WORKERPOOL_H
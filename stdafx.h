@@ -11,10 +11,15 @@
 #include <tchar.h>
 #include <map>
 #include <list>
+#include <vector>
+#include <functional>
+#include <string>
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <chrono>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 extern "C"{